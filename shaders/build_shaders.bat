@@ -1,3 +1,3 @@
-C:\VulkanSDK\1.4.309.0\Bin\glslc.exe vert.vert -o vert.spv
-C:\VulkanSDK\1.4.309.0\Bin\glslc.exe frag.frag -o frag.spv
+"%VULKAN_SDK%\Bin\glslc.exe" vert.vert -o vert.spv
+"%VULKAN_SDK%\Bin\glslc.exe" frag.frag -o frag.spv
 pause
\ No newline at end of file
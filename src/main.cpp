@@ -1,13 +1,25 @@
-#define VK_USE_PLATFORM_WIN32_KHR
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
-#define GLFW_EXPOSE_NATIVE_WIN32
-#include <GLFW/glfw3native.h>
 
+// NOTE: Surfaces come from GLFW on every platform (Win32, XCB, Wayland), so the platform-specific bits left are file I/O
+// and Assert
+#if _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <mutex>
+#include <thread>
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -29,9 +41,12 @@ typedef uint32_t b32;
 typedef float f32;
 typedef double f64;
 
-#define AllocArray(T, N) ((T*)malloc(N * sizeof(T)));
 #define ArrayCount(X) (sizeof(X) / sizeof((X)[0]))
+#if _WIN32
 #define Assert(X) if (!(X)) __debugbreak()
+#else
+#define Assert(X) if (!(X)) __builtin_trap()
+#endif
 
 static u32 Clamp(u32 Value, u32 Min, u32 Max)
 {
@@ -47,6 +62,414 @@ static u32 Clamp(u32 Value, u32 Min, u32 Max)
 	return Result;
 }
 
+// NOTE: The only heap allocations left are for things with genuinely dynamic lifetimes (GPU blocks, upload batches,
+// streamables). They all go through here, so we can count them and check the frame loop isn't making any. Atomic,
+// because the driver calls into the host allocator (which comes through here too) from its own threads.
+static std::atomic<u64> s_NumHeapAllocations;
+
+static void* AllocateMemory(size_t Size)
+{
+	s_NumHeapAllocations++;
+	void* Result = calloc(1, Size);
+	return Result;
+}
+
+static void* ReallocateMemory(void* Memory, size_t Size)
+{
+	s_NumHeapAllocations++;
+	void* Result = realloc(Memory, Size);
+	return Result;
+}
+
+static void FreeMemory(void* Memory)
+{
+	free(Memory);
+}
+
+// NOTE: Linear arenas, for everything with a known lifetime. The permanent arena lives as long as the app, the
+// swapchain arena gets reset whenever the swapchain is recreated, and the frame arena is scratch that gets reset at
+// the start of every frame (during init, it's the scratch space for all the enumerate-then-throw-away stuff).
+struct memory_arena
+{
+	const char* Name;
+	u8* Base;
+	size_t Size;
+	size_t Used;
+	size_t HighWater;
+};
+
+struct temp_memory
+{
+	memory_arena* Arena;
+	size_t Used;
+};
+
+static memory_arena CreateArena(const char* Name, size_t Size)
+{
+	memory_arena Result = {};
+	Result.Name = Name;
+	Result.Base = (u8*)AllocateMemory(Size);
+	Result.Size = Size;
+	return Result;
+}
+
+static void* PushSize(memory_arena* Arena, size_t Size)
+{
+	void* Result = nullptr;
+	// Everything's 16-byte aligned, which is plenty for anything we put in here
+	size_t Start = (Arena->Used + 15) & ~(size_t)15;
+	if (Start + Size <= Arena->Size)
+	{
+		Result = Arena->Base + Start;
+		Arena->Used = Start + Size;
+		if (Arena->Used > Arena->HighWater)
+		{
+			Arena->HighWater = Arena->Used;
+		}
+	}
+	else
+	{
+		fprintf(stderr, "Arena '%s' is out of space (%zu/%zu bytes used, wanted %zu more)\n", Arena->Name, Arena->Used, Arena->Size, Size);
+		Assert(false);
+	}
+	return Result;
+}
+
+#define PushArray(Arena, T, N) ((T*)PushSize(Arena, (N) * sizeof(T)))
+
+static void ResetArena(memory_arena* Arena)
+{
+	Arena->Used = 0;
+}
+
+static temp_memory BeginTempMemory(memory_arena* Arena)
+{
+	temp_memory Result = { .Arena = Arena, .Used = Arena->Used };
+	return Result;
+}
+
+static void EndTempMemory(temp_memory Temp)
+{
+	Assert(Temp.Arena->Used >= Temp.Used);
+	Temp.Arena->Used = Temp.Used;
+}
+
+static void PrintArenaStats(memory_arena* Arena)
+{
+	printf("\tArena '%s': %zu bytes used, high-water mark %zu/%zu bytes\n", Arena->Name, Arena->Used, Arena->HighWater, Arena->Size);
+}
+
+static void DestroyArena(memory_arena* Arena)
+{
+	FreeMemory(Arena->Base);
+	*Arena = {};
+}
+
+// NOTE: Work-stealing job system. Every worker (the main thread is worker 0) has its own deque of jobs: it pushes and
+// pops at the bottom, so it keeps working on whatever it kicked off most recently (and is probably still in cache),
+// and when that runs dry it steals from the top of somebody else's. Jobs hang off a job_counter that ticks down as they
+// finish. Waiting on a counter runs other jobs in the meantime instead of blocking, so it's fine to wait from inside a
+// job - that's how dependencies work: a job that needs another job's output kicks it (or gets handed its counter) and
+// waits. Idle workers sleep until something gets queued.
+// Job data has to outlive the job, which in practice means it lives on the stack of whoever waits on the counter.
+// Threads get made once at startup; kicking and running jobs doesn't touch the heap.
+static constexpr u32 MAX_WORKERS = 16;
+static constexpr u32 MAX_JOBS_PER_WORKER = 1024; // Power of two
+
+typedef void job_func(void* UserData, u32 Index);
+
+struct job_counter
+{
+	std::atomic<u32> Remaining;
+};
+
+struct job
+{
+	job_func* Func;
+	void* UserData;
+	u32 Index;
+	job_counter* Counter;
+};
+
+// TODO: A lock-free (Chase-Lev) deque, if the lock ever actually shows up in a profile. Jobs here are chunky enough
+// that it hasn't.
+struct job_deque
+{
+	std::mutex Mutex;
+	job Jobs[MAX_JOBS_PER_WORKER];
+	u32 Top;    // Thieves take from here
+	u32 Bottom; // The owner pushes and pops here
+};
+
+struct job_system
+{
+	u32 NumWorkers;
+	std::thread Threads[MAX_WORKERS];
+	job_deque Deques[MAX_WORKERS];
+
+	std::atomic<u32> NumQueued;
+	std::atomic<b32> ShuttingDown;
+	std::mutex SleepMutex;
+	std::condition_variable WakeUp;
+};
+
+static job_system s_Jobs;
+static thread_local u32 t_WorkerIndex; // 0 on the main thread (and any thread that isn't ours)
+
+static b32 PushJob(job_deque* Deque, job Job)
+{
+	std::lock_guard<std::mutex> Lock(Deque->Mutex);
+	b32 Result = Deque->Bottom - Deque->Top < MAX_JOBS_PER_WORKER;
+	if (Result)
+	{
+		Deque->Jobs[Deque->Bottom++ & (MAX_JOBS_PER_WORKER - 1)] = Job;
+	}
+	return Result;
+}
+
+static b32 PopJob(job_deque* Deque, job* OutJob)
+{
+	std::lock_guard<std::mutex> Lock(Deque->Mutex);
+	b32 Result = Deque->Bottom != Deque->Top;
+	if (Result)
+	{
+		*OutJob = Deque->Jobs[--Deque->Bottom & (MAX_JOBS_PER_WORKER - 1)];
+	}
+	return Result;
+}
+
+static b32 StealJob(job_deque* Deque, job* OutJob)
+{
+	std::lock_guard<std::mutex> Lock(Deque->Mutex);
+	b32 Result = Deque->Bottom != Deque->Top;
+	if (Result)
+	{
+		*OutJob = Deque->Jobs[Deque->Top++ & (MAX_JOBS_PER_WORKER - 1)];
+	}
+	return Result;
+}
+
+static void RunJob(job* Job)
+{
+	Job->Func(Job->UserData, Job->Index);
+	Job->Counter->Remaining.fetch_sub(1, std::memory_order_release);
+}
+
+// Own deque first, then go stealing. Returns false if there was nothing to do anywhere.
+static b32 TryRunOneJob()
+{
+	job_system* Jobs = &s_Jobs;
+	u32 WorkerIndex = t_WorkerIndex;
+	job Job;
+	b32 Result = PopJob(Jobs->Deques + WorkerIndex, &Job);
+	for (u32 i = 1; !Result && i < Jobs->NumWorkers; i++)
+	{
+		Result = StealJob(Jobs->Deques + (WorkerIndex + i) % Jobs->NumWorkers, &Job);
+	}
+	if (Result)
+	{
+		Jobs->NumQueued.fetch_sub(1);
+		RunJob(&Job);
+	}
+	return Result;
+}
+
+static void WorkerThreadProc(u32 WorkerIndex)
+{
+	job_system* Jobs = &s_Jobs;
+	t_WorkerIndex = WorkerIndex;
+	while (!Jobs->ShuttingDown)
+	{
+		if (!TryRunOneJob())
+		{
+			std::unique_lock<std::mutex> Lock(Jobs->SleepMutex);
+			while (Jobs->NumQueued == 0 && !Jobs->ShuttingDown)
+			{
+				Jobs->WakeUp.wait(Lock);
+			}
+		}
+	}
+}
+
+static void InitJobSystem(u32 NumWorkers)
+{
+	job_system* Jobs = &s_Jobs;
+	Jobs->NumWorkers = Clamp(NumWorkers, 1, MAX_WORKERS);
+	for (u32 i = 1; i < Jobs->NumWorkers; i++)
+	{
+		Jobs->Threads[i] = std::thread(WorkerThreadProc, i);
+	}
+}
+
+static u32 GetNumWorkers()
+{
+	u32 Result = s_Jobs.NumWorkers;
+	return Result;
+}
+
+// Queues Count jobs, calling Func(UserData, 0..Count-1). Counter must outlive them.
+static void KickJobs(job_func* Func, void* UserData, u32 Count, job_counter* Counter)
+{
+	job_system* Jobs = &s_Jobs;
+	Counter->Remaining.fetch_add(Count);
+	for (u32 i = 0; i < Count; i++)
+	{
+		job Job = { Func, UserData, i, Counter };
+		if (PushJob(Jobs->Deques + t_WorkerIndex, Job))
+		{
+			Jobs->NumQueued.fetch_add(1);
+			{
+				// NOTE: Taking the lock means a worker can't be between checking NumQueued and going to sleep right now
+				std::lock_guard<std::mutex> Lock(Jobs->SleepMutex);
+			}
+			Jobs->WakeUp.notify_one();
+		}
+		else
+		{
+			// Deque's full, just do it here and now
+			RunJob(&Job);
+		}
+	}
+}
+
+static void KickJob(job_func* Func, void* UserData, job_counter* Counter)
+{
+	KickJobs(Func, UserData, 1, Counter);
+}
+
+static void WaitForCounter(job_counter* Counter)
+{
+	while (Counter->Remaining.load(std::memory_order_acquire) != 0)
+	{
+		if (!TryRunOneJob())
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+// NOTE: Startup timing. Every stage of init (on whatever thread it runs) records when it started and finished, relative
+// to the start of main, so we can see what's on the critical path to the first frame.
+static constexpr u32 MAX_STARTUP_STAGES = 64;
+
+struct startup_stage
+{
+	const char* Name;
+	f64 Start;
+	f64 End;
+	u32 WorkerIndex;
+};
+
+struct startup_timeline
+{
+	std::chrono::high_resolution_clock::time_point Origin;
+	std::atomic<u32> NumStages;
+	startup_stage Stages[MAX_STARTUP_STAGES];
+};
+
+static startup_timeline s_Startup;
+
+static void StartStartupTimeline()
+{
+	s_Startup.Origin = std::chrono::high_resolution_clock::now();
+}
+
+static f64 SecondsSinceStartup()
+{
+	f64 Result = std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - s_Startup.Origin).count();
+	return Result;
+}
+
+// Returns a handle for EndStartupStage. Fine to call from any thread.
+static u32 BeginStartupStage(const char* Name)
+{
+	u32 Result = s_Startup.NumStages.fetch_add(1);
+	if (Result < MAX_STARTUP_STAGES)
+	{
+		startup_stage* Stage = s_Startup.Stages + Result;
+		Stage->Name = Name;
+		Stage->Start = SecondsSinceStartup();
+		Stage->WorkerIndex = t_WorkerIndex;
+	}
+	return Result;
+}
+
+static void EndStartupStage(u32 StageIndex)
+{
+	if (StageIndex < MAX_STARTUP_STAGES)
+	{
+		s_Startup.Stages[StageIndex].End = SecondsSinceStartup();
+	}
+}
+
+// Only once every stage has ended
+static void PrintStartupTimeline()
+{
+	u32 NumStages = s_Startup.NumStages < MAX_STARTUP_STAGES ? (u32)s_Startup.NumStages : MAX_STARTUP_STAGES;
+	// Insertion sort by start time, there's only a handful
+	for (u32 i = 1; i < NumStages; i++)
+	{
+		startup_stage Stage = s_Startup.Stages[i];
+		u32 j = i;
+		while (j > 0 && s_Startup.Stages[j - 1].Start > Stage.Start)
+		{
+			s_Startup.Stages[j] = s_Startup.Stages[j - 1];
+			j--;
+		}
+		s_Startup.Stages[j] = Stage;
+	}
+
+	printf("Startup (ms since main, worker, duration):\n");
+	for (u32 i = 0; i < NumStages; i++)
+	{
+		startup_stage* Stage = s_Startup.Stages + i;
+		printf("\t[%8.2f - %8.2f] %2u %8.2f  %s\n", Stage->Start * 1000.0, Stage->End * 1000.0, Stage->WorkerIndex,
+			   (Stage->End - Stage->Start) * 1000.0, Stage->Name);
+	}
+}
+
+typedef void parallel_for_func(void* UserData, u32 First, u32 OnePastLast);
+
+struct parallel_for_job
+{
+	parallel_for_func* Func;
+	void* UserData;
+	u32 Count;
+	u32 BatchSize;
+};
+
+static void ParallelForJob(void* UserData, u32 BatchIndex)
+{
+	parallel_for_job* Job = (parallel_for_job*)UserData;
+	u32 First = BatchIndex * Job->BatchSize;
+	u32 OnePastLast = First + Job->BatchSize < Job->Count ? First + Job->BatchSize : Job->Count;
+	Job->Func(Job->UserData, First, OnePastLast);
+}
+
+// Splits [0, Count) into batches of (up to) BatchSize and runs them across the workers. Returns when they're all done.
+static void ParallelFor(u32 Count, u32 BatchSize, parallel_for_func* Func, void* UserData)
+{
+	Assert(BatchSize > 0);
+	parallel_for_job Job = { Func, UserData, Count, BatchSize };
+	job_counter Counter = {};
+	KickJobs(ParallelForJob, &Job, (Count + BatchSize - 1) / BatchSize, &Counter);
+	WaitForCounter(&Counter);
+}
+
+static void ShutdownJobSystem()
+{
+	job_system* Jobs = &s_Jobs;
+	{
+		std::lock_guard<std::mutex> Lock(Jobs->SleepMutex);
+		Jobs->ShuttingDown = true;
+	}
+	Jobs->WakeUp.notify_all();
+	for (u32 i = 1; i < Jobs->NumWorkers; i++)
+	{
+		Jobs->Threads[i].join();
+	}
+}
+
 struct vertex
 {
 	glm::vec3 Position;
@@ -130,1868 +553,6183 @@ struct uniform_buffer_object
 	alignas(16) glm::mat4 Proj;
 };
 
-static u32 FindMemoryType(u32 TypeFilter, VkMemoryPropertyFlags Properties, VkPhysicalDevice PhysicalDevice)
+// NOTE: Host memory the driver allocates on our behalf, via VkAllocationCallbacks. Small allocations come out of
+// power-of-two size-class pools, anything bigger (or more aligned than 16 bytes) goes straight to the heap. Every object
+// kind gets its own VkAllocationCallbacks, with the kind stashed in pUserData, so each allocation can be pinned on both
+// the VkSystemAllocationScope the driver asked for and the kind of object it was made for.
+enum host_object_kind : u32
 {
-	VkPhysicalDeviceMemoryProperties MemoryProperties;
-	vkGetPhysicalDeviceMemoryProperties(PhysicalDevice, &MemoryProperties);
-
-	for (u32 i = 0; i < MemoryProperties.memoryTypeCount; i++)
-	{
-		VkMemoryType MemType = MemoryProperties.memoryTypes[i];
-		if ((TypeFilter & (1 << i)) &&
-			(MemType.propertyFlags & Properties) == Properties)
-		{
-			return i;
-		}
-	}
-	fprintf(stderr, "Failed to find suitable memory type\n");
-	Assert(false);
-	return 0;
-}
+	HostObject_Instance,
+	HostObject_DebugMessenger,
+	HostObject_Surface,
+	HostObject_Device,
+	HostObject_DeviceMemory,
+	HostObject_Swapchain,
+	HostObject_Buffer,
+	HostObject_Image,
+	HostObject_ImageView,
+	HostObject_Sampler,
+	HostObject_Framebuffer,
+	HostObject_RenderPass,
+	HostObject_ShaderModule,
+	HostObject_PipelineLayout,
+	HostObject_Pipeline,
+	HostObject_PipelineCache,
+	HostObject_DescriptorSetLayout,
+	HostObject_DescriptorPool,
+	HostObject_CommandPool,
+	HostObject_Semaphore,
+	HostObject_Fence,
+	HostObject_Count
+};
 
-struct file_buffer
+static constexpr const char* HOST_OBJECT_NAMES[HostObject_Count] =
 {
-	u8* Contents;
-	u32 Size;
+	"Instance", "DebugMessenger", "Surface", "Device", "DeviceMemory", "Swapchain", "Buffer", "Image", "ImageView",
+	"Sampler", "Framebuffer", "RenderPass", "ShaderModule", "PipelineLayout", "Pipeline", "PipelineCache", "DescriptorSetLayout",
+	"DescriptorPool", "CommandPool", "Semaphore", "Fence",
 };
 
-static file_buffer LoadFile(const char* FileName)
-{
-	file_buffer Result = {};
+// Indexed by VkSystemAllocationScope
+static constexpr const char* ALLOCATION_SCOPE_NAMES[] = { "Command", "Object", "Cache", "Device", "Instance" };
 
-	HANDLE FileHandle = CreateFileA(FileName, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
-	if (FileHandle == INVALID_HANDLE_VALUE)
-	{
-		fprintf(stderr, "Seems like file '%s' doesn't exist, bro\n", FileName);
-		Assert(false);
-	}
-	else
-	{
-		LARGE_INTEGER FileSize;
-		if (GetFileSizeEx(FileHandle, &FileSize))
-		{
-			Result.Size = (u32)FileSize.QuadPart;
-			Result.Contents = AllocArray(u8, Result.Size);
-			DWORD BytesRead;
-			if (!ReadFile(FileHandle, Result.Contents, Result.Size, &BytesRead, nullptr) ||
-				Result.Size != BytesRead)
-			{
-				fprintf(stderr, "Failed to read file '%s'\n", FileName);
-				free(Result.Contents);
-				Result = {};
-			}
-		}
-		else
-		{
-			Assert(false); // Couldn't get file size??
-		}
-	}
-	return Result;
-}
+static constexpr u32 HOST_MIN_SIZE_CLASS = 4; // 16 bytes
+static constexpr u32 HOST_NUM_SIZE_CLASSES = 9; // 16 bytes up to 4KB
+static constexpr size_t HOST_POOL_CHUNK_SIZE = 64 * 1024;
 
-static constexpr const char* VALIDATION_LAYERS[] =
+struct host_alloc_stats
 {
-	"VK_LAYER_KHRONOS_validation"
+	u64 NumAllocations; // Reallocations count as one of these and one free
+	u64 NumFrees;
+	u64 CurrentBytes;
+	u64 PeakBytes;
+	u64 TotalBytes;
 };
 
-static constexpr const char* DEVICE_EXTENSIONS[] =
+// Sits right in front of every allocation we hand the driver
+struct host_alloc_header
 {
-	VK_KHR_SWAPCHAIN_EXTENSION_NAME
+	u64 Size;
+	u32 Offset;   // Back to the start of the heap block, for big allocations
+	u8 SizeClass; // HOST_NUM_SIZE_CLASSES for big allocations
+	u8 Scope;
+	u8 Kind;
+	u8 Unused;
 };
+static_assert(sizeof(host_alloc_header) == 16);
 
-struct extensions_list
+struct host_pool_chunk
 {
-	const char** Names;
-	u32 Count;
+	host_pool_chunk* Next;
+	u64 Unused; // Keeps the slots 16-byte aligned
 };
 
-static extensions_list GetRequiredExtensions()
+struct host_allocator
 {
-	extensions_list Result = {};
+	std::mutex Lock; // Drivers can (and do) call these from their own threads
+	void* FreeSlots[HOST_NUM_SIZE_CLASSES];
+	host_pool_chunk* Chunks;
+	host_alloc_stats ScopeStats[ArrayCount(ALLOCATION_SCOPE_NAMES)];
+	host_alloc_stats KindStats[HostObject_Count];
+	host_alloc_stats InternalStats[ArrayCount(ALLOCATION_SCOPE_NAMES)]; // The driver's own allocations, we just get told about them
+	VkAllocationCallbacks Callbacks[HostObject_Count];
+};
 
-	u32 NumGlfwExtensions = 0;
-	const char** GlfwExtensionNames = glfwGetRequiredInstanceExtensions(&NumGlfwExtensions);
+static host_allocator s_HostAllocator;
 
-#if _DEBUG
-	Result.Count = NumGlfwExtensions + 1;
-	Result.Names = AllocArray(const char*, Result.Count);
-	for (u32 i = 0; i < NumGlfwExtensions; i++)
+static void RecordHostAlloc(host_alloc_stats* Stats, u64 Size)
+{
+	Stats->NumAllocations++;
+	Stats->TotalBytes += Size;
+	Stats->CurrentBytes += Size;
+	if (Stats->CurrentBytes > Stats->PeakBytes)
 	{
-		Result.Names[i] = GlfwExtensionNames[i];
+		Stats->PeakBytes = Stats->CurrentBytes;
 	}
-	Result.Names[NumGlfwExtensions] = VK_EXT_DEBUG_UTILS_EXTENSION_NAME;
-#else
-	Result.Count = NumGlfwExtensions;
-	Result.Names = GlfwExtensionNames;
-#endif
-	return Result;
 }
 
+static void RecordHostFree(host_alloc_stats* Stats, u64 Size)
+{
+	Stats->NumFrees++;
+	Stats->CurrentBytes -= Size;
+}
 
-#if _DEBUG
-static VkDebugUtilsMessengerEXT s_DebugHandle;
-
-static VKAPI_ATTR VkBool32 VKAPI_CALL DebugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT SeverityBits,
-													VkDebugUtilsMessageTypeFlagsEXT TypeFlags,
-													const VkDebugUtilsMessengerCallbackDataEXT* CallbackData,
-													void* UserData)
+static void RefillHostPool(host_allocator* Allocator, u32 ClassIndex)
 {
-	if (SeverityBits >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT)
+	host_pool_chunk* Chunk = (host_pool_chunk*)AllocateMemory(HOST_POOL_CHUNK_SIZE);
+	Chunk->Next = Allocator->Chunks;
+	Allocator->Chunks = Chunk;
+
+	size_t SlotSize = ((size_t)1 << (ClassIndex + HOST_MIN_SIZE_CLASS)) + sizeof(host_alloc_header);
+	u8* Slot = (u8*)(Chunk + 1);
+	u8* End = (u8*)Chunk + HOST_POOL_CHUNK_SIZE;
+	while (Slot + SlotSize <= End)
 	{
-		fprintf(stderr, "Validation layer: %s\n", CallbackData->pMessage);
-		u32 YourMum = 69;
+		*(void**)Slot = Allocator->FreeSlots[ClassIndex];
+		Allocator->FreeSlots[ClassIndex] = Slot;
+		Slot += SlotSize;
 	}
-	return VK_FALSE;
 }
 
-static VkDebugUtilsMessengerCreateInfoEXT DebugCallbackCreateInfo()
+static VKAPI_ATTR void* VKAPI_CALL HostAllocation(void* UserData, size_t Size, size_t Alignment, VkSystemAllocationScope Scope)
 {
-	VkDebugUtilsMessengerCreateInfoEXT CreateInfo
+	host_allocator* Allocator = &s_HostAllocator;
+	u32 ClassIndex = 0;
+	while (((size_t)1 << (ClassIndex + HOST_MIN_SIZE_CLASS)) < Size && ClassIndex < HOST_NUM_SIZE_CLASSES)
 	{
-		.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT,
-		.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
-						   VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
-						   VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT,
-		.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
-					   VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
-					   VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT,
-		.pfnUserCallback = DebugCallback
-	};
-	return CreateInfo;
-}
+		ClassIndex++;
+	}
 
-static void InitDebugCallback(VkInstance Instance)
-{
-	VkDebugUtilsMessengerCreateInfoEXT CreateInfo = DebugCallbackCreateInfo();
-	PFN_vkCreateDebugUtilsMessengerEXT Func = (PFN_vkCreateDebugUtilsMessengerEXT)vkGetInstanceProcAddr(Instance,
-																										"vkCreateDebugUtilsMessengerEXT");
-	if (Func)
+	Allocator->Lock.lock();
+	host_alloc_header* Header = nullptr;
+	if (ClassIndex < HOST_NUM_SIZE_CLASSES && Alignment <= sizeof(host_alloc_header))
 	{
-		Func(Instance, &CreateInfo, nullptr, &s_DebugHandle); // pAllocator
+		if (!Allocator->FreeSlots[ClassIndex])
+		{
+			RefillHostPool(Allocator, ClassIndex);
+		}
+		Header = (host_alloc_header*)Allocator->FreeSlots[ClassIndex];
+		Allocator->FreeSlots[ClassIndex] = *(void**)Header;
+		Header->Offset = 0;
 	}
 	else
 	{
-		fprintf(stderr, "Failed to set up debug callback function\n");
-		Assert(false);
+		ClassIndex = HOST_NUM_SIZE_CLASSES;
+		if (Alignment < sizeof(host_alloc_header))
+		{
+			Alignment = sizeof(host_alloc_header);
+		}
+		u8* Base = (u8*)AllocateMemory(Size + Alignment + sizeof(host_alloc_header));
+		if (Base)
+		{
+			uintptr_t Data = ((uintptr_t)Base + sizeof(host_alloc_header) + Alignment - 1) & ~(uintptr_t)(Alignment - 1);
+			Header = (host_alloc_header*)Data - 1;
+			Header->Offset = (u32)((u8*)Header - Base);
+		}
 	}
-}
 
-static void DestroyDebugCallback(VkInstance Instance)
-{
-	PFN_vkDestroyDebugUtilsMessengerEXT Func = (PFN_vkDestroyDebugUtilsMessengerEXT)vkGetInstanceProcAddr(Instance,
-																										  "vkDestroyDebugUtilsMessengerEXT");
-	if (Func)
+	void* Result = nullptr;
+	if (Header)
 	{
-		Func(Instance, s_DebugHandle, nullptr); // pAllocator
+		Header->Size = Size;
+		Header->SizeClass = (u8)ClassIndex;
+		Header->Scope = (u8)Scope;
+		Header->Kind = (u8)(uintptr_t)UserData;
+		RecordHostAlloc(Allocator->ScopeStats + Scope, Size);
+		RecordHostAlloc(Allocator->KindStats + Header->Kind, Size);
+		Result = Header + 1;
 	}
+	Allocator->Lock.unlock();
+	return Result;
 }
 
-static b32 AreValidationLayersSupported()
+static VKAPI_ATTR void VKAPI_CALL HostFree(void* UserData, void* Memory)
 {
-	u32 NumValidationLayers = 0;
-	vkEnumerateInstanceLayerProperties(&NumValidationLayers, nullptr);
-
-	VkLayerProperties* AvailableLayers = AllocArray(VkLayerProperties, NumValidationLayers);
-	vkEnumerateInstanceLayerProperties(&NumValidationLayers, AvailableLayers);
-	b32 Result = true;
-	for (u32 i = 0; i < ArrayCount(VALIDATION_LAYERS); i++)
+	if (Memory)
 	{
-		const char* LayerName = VALIDATION_LAYERS[i];
-		b32 FoundLayer = false;
-		for (u32 j = 0; j < NumValidationLayers; j++)
+		host_allocator* Allocator = &s_HostAllocator;
+		host_alloc_header* Header = (host_alloc_header*)Memory - 1;
+
+		Allocator->Lock.lock();
+		RecordHostFree(Allocator->ScopeStats + Header->Scope, Header->Size);
+		RecordHostFree(Allocator->KindStats + Header->Kind, Header->Size);
+		if (Header->SizeClass < HOST_NUM_SIZE_CLASSES)
 		{
-			if (strcmp(LayerName, AvailableLayers[j].layerName) == 0)
-			{
-				FoundLayer = true;
-				break;
-			}
+			*(void**)Header = Allocator->FreeSlots[Header->SizeClass];
+			Allocator->FreeSlots[Header->SizeClass] = Header;
 		}
-		if (!FoundLayer)
+		else
 		{
-			Result = false;
-			break;
+			FreeMemory((u8*)Header - Header->Offset);
 		}
+		Allocator->Lock.unlock();
 	}
-
-	free(AvailableLayers);
-	return Result;
 }
-#endif
 
-static VkShaderModule CreateShaderModule(VkDevice Device, file_buffer ShaderFile)
+static VKAPI_ATTR void* VKAPI_CALL HostReallocation(void* UserData, void* Original, size_t Size, size_t Alignment, VkSystemAllocationScope Scope)
 {
-	VkShaderModuleCreateInfo CreateInfo
+	void* Result = nullptr;
+	if (Size == 0)
 	{
-		.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-		.codeSize = ShaderFile.Size,
-		.pCode = (u32*)ShaderFile.Contents, // TODO: Align to 4-byte memory necessary here?
-	};
-	VkShaderModule Result = VK_NULL_HANDLE;
-	if (vkCreateShaderModule(Device, &CreateInfo, nullptr, &Result) != VK_SUCCESS) // pAllocator
+		HostFree(UserData, Original);
+	}
+	else
 	{
-		fprintf(stderr, "Failed to create shader... :(\n");
-		Assert(false);
+		Result = HostAllocation(UserData, Size, Alignment, Scope);
+		if (Result && Original)
+		{
+			u64 OriginalSize = ((host_alloc_header*)Original - 1)->Size;
+			memcpy(Result, Original, OriginalSize < Size ? OriginalSize : Size);
+			HostFree(UserData, Original);
+		}
 	}
 	return Result;
 }
 
-struct swap_chain_deets
+static VKAPI_ATTR void VKAPI_CALL HostInternalAllocation(void* UserData, size_t Size, VkInternalAllocationType Type, VkSystemAllocationScope Scope)
 {
-	VkSurfaceCapabilitiesKHR Capabilities;
-	
-	VkSurfaceFormatKHR* Formats;
-	u32 NumFormats;
-
-	VkPresentModeKHR* PresentModes;
-	u32 NumPresentModes;
-};
+	s_HostAllocator.Lock.lock();
+	RecordHostAlloc(s_HostAllocator.InternalStats + Scope, Size);
+	s_HostAllocator.Lock.unlock();
+}
 
-static swap_chain_deets QuerySwapChainSupport(VkPhysicalDevice Device, VkSurfaceKHR Surface)
+static VKAPI_ATTR void VKAPI_CALL HostInternalFree(void* UserData, size_t Size, VkInternalAllocationType Type, VkSystemAllocationScope Scope)
 {
-	swap_chain_deets Result = {};
-
-	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(Device, Surface, &Result.Capabilities);
-
-	vkGetPhysicalDeviceSurfaceFormatsKHR(Device, Surface, &Result.NumFormats, nullptr);
-	if (Result.NumFormats != 0)
-	{
-		Result.Formats = AllocArray(VkSurfaceFormatKHR, Result.NumFormats);
-		vkGetPhysicalDeviceSurfaceFormatsKHR(Device, Surface, &Result.NumFormats, Result.Formats);
-		
-		vkGetPhysicalDeviceSurfacePresentModesKHR(Device, Surface, &Result.NumPresentModes, nullptr);
-		if (Result.NumPresentModes == 0)
-		{
-			free(Result.Formats);
-			Result.Formats = nullptr;
-		}
-		else
-		{
-			Result.PresentModes = AllocArray(VkPresentModeKHR, Result.NumPresentModes);
-			vkGetPhysicalDeviceSurfacePresentModesKHR(Device, Surface, &Result.NumPresentModes, Result.PresentModes);
-		}
-	}
-	return Result;
+	s_HostAllocator.Lock.lock();
+	RecordHostFree(s_HostAllocator.InternalStats + Scope, Size);
+	s_HostAllocator.Lock.unlock();
 }
 
-static b32 CheckDeviceSupportsExtensions(VkPhysicalDevice Device)
+static void InitHostAllocator()
 {
-	u32 NumExtensions = 0;
-	vkEnumerateDeviceExtensionProperties(Device, nullptr, &NumExtensions, nullptr);
-	VkExtensionProperties* AvailableExtensions = AllocArray(VkExtensionProperties, NumExtensions);
-	vkEnumerateDeviceExtensionProperties(Device, nullptr, &NumExtensions, AvailableExtensions);
-	
-	u32 FoundExtensions = 0;
-	for (u32 i = 0; i < ArrayCount(DEVICE_EXTENSIONS); i++)
+	for (u32 i = 0; i < HostObject_Count; i++)
 	{
-		for (u32 j = 0; j < NumExtensions; j++)
+		s_HostAllocator.Callbacks[i] =
 		{
-			if (strcmp(DEVICE_EXTENSIONS[i], AvailableExtensions[j].extensionName) == 0)
-			{
-				FoundExtensions++;
-				break;
-			}
-		}
+			.pUserData = (void*)(uintptr_t)i,
+			.pfnAllocation = HostAllocation,
+			.pfnReallocation = HostReallocation,
+			.pfnFree = HostFree,
+			.pfnInternalAllocation = HostInternalAllocation,
+			.pfnInternalFree = HostInternalFree,
+		};
 	}
+}
 
-	free(AvailableExtensions);
-	b32 Result = FoundExtensions == ArrayCount(DEVICE_EXTENSIONS);
+// What to pass as pAllocator. Objects have to be destroyed with the same kind they were created with.
+static const VkAllocationCallbacks* HostCallbacks(host_object_kind Kind)
+{
+	const VkAllocationCallbacks* Result = s_HostAllocator.Callbacks + Kind;
 	return Result;
 }
 
-enum queue_family_flags : u32
+struct host_alloc_snapshot
 {
-	QueueFamily_Graphics = 1,
-	QueueFamily_Present  = 1 << 1
+	host_alloc_stats KindStats[HostObject_Count];
 };
 
-struct queue_family_indices
+// NOTE: Debug builds only, like everything that calls them
+#if _DEBUG
+static host_alloc_snapshot TakeHostAllocSnapshot()
 {
-	u32 GraphicsFamily;
-	u32 PresentFamily;
-	u32 ValidFlags;
-};
+	host_alloc_snapshot Result = {};
+	s_HostAllocator.Lock.lock();
+	memcpy(Result.KindStats, s_HostAllocator.KindStats, sizeof(Result.KindStats));
+	s_HostAllocator.Lock.unlock();
+	return Result;
+}
 
-// TODO: Don't we just want to find the one queue that supports both graphics and presenting, and save some hassle?
-static queue_family_indices FindQueueFamilies(VkPhysicalDevice Device, VkSurfaceKHR Surface)
+// Prints which object kinds allocated what since the snapshot - for hunting down spikes around e.g. swapchain recreation
+static void PrintHostAllocsSince(const char* Label, host_alloc_snapshot* Snapshot)
 {
-	queue_family_indices Result = {};
-
-	u32 NumFamilies = 0;
-	vkGetPhysicalDeviceQueueFamilyProperties(Device, &NumFamilies, nullptr);
+	host_alloc_snapshot Now = TakeHostAllocSnapshot();
+	printf("Host allocations during %s:\n", Label);
+	for (u32 i = 0; i < HostObject_Count; i++)
+	{
+		host_alloc_stats* Before = Snapshot->KindStats + i;
+		host_alloc_stats* After = Now.KindStats + i;
+		if (After->NumAllocations != Before->NumAllocations || After->NumFrees != Before->NumFrees)
+		{
+			printf("\t%-20s %6llu allocs (%8llu bytes), %6llu frees\n", HOST_OBJECT_NAMES[i],
+				   (unsigned long long)(After->NumAllocations - Before->NumAllocations),
+				   (unsigned long long)(After->TotalBytes - Before->TotalBytes),
+				   (unsigned long long)(After->NumFrees - Before->NumFrees));
+		}
+	}
+}
+#endif
 
-	if (NumFamilies == 0)
+static void PrintHostAllocStats()
+{
+	printf("Host allocations by scope:\n");
+	for (u32 i = 0; i < ArrayCount(ALLOCATION_SCOPE_NAMES); i++)
 	{
-		fprintf(stderr, "No queue families WTF\n");
+		host_alloc_stats* Stats = s_HostAllocator.ScopeStats + i;
+		host_alloc_stats* Internal = s_HostAllocator.InternalStats + i;
+		printf("\t%-20s %6llu allocs, %6llu frees, %8llu bytes total, peak %8llu, %llu still live (+%llu internal)\n", ALLOCATION_SCOPE_NAMES[i],
+			   (unsigned long long)Stats->NumAllocations, (unsigned long long)Stats->NumFrees, (unsigned long long)Stats->TotalBytes,
+			   (unsigned long long)Stats->PeakBytes, (unsigned long long)Stats->CurrentBytes, (unsigned long long)Internal->CurrentBytes);
 	}
-	else
+	printf("Host allocations by object:\n");
+	for (u32 i = 0; i < HostObject_Count; i++)
 	{
-		VkQueueFamilyProperties* QueueFamilies = AllocArray(VkQueueFamilyProperties, NumFamilies);
-		vkGetPhysicalDeviceQueueFamilyProperties(Device, &NumFamilies, QueueFamilies);
-		for (u32 i = 0; i < NumFamilies; i++)
+		host_alloc_stats* Stats = s_HostAllocator.KindStats + i;
+		if (Stats->NumAllocations)
 		{
-			if (QueueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
-			{
-				Result.GraphicsFamily = i;
-				Result.ValidFlags |= QueueFamily_Graphics;
-			}
-
-			b32 HasPresentSupport = false;
-			vkGetPhysicalDeviceSurfaceSupportKHR(Device, i, Surface, &HasPresentSupport);
-			if (HasPresentSupport)
-			{
-				Result.PresentFamily = i;
-				Result.ValidFlags |= QueueFamily_Present;
-			}
-			if ((Result.ValidFlags & QueueFamily_Present) && (Result.ValidFlags & QueueFamily_Graphics))
-			{
-				break;
-			}
-			else
-			{
-				Result = {};
-			}
+			printf("\t%-20s %6llu allocs, %6llu frees, %8llu bytes total, peak %8llu\n", HOST_OBJECT_NAMES[i],
+				   (unsigned long long)Stats->NumAllocations, (unsigned long long)Stats->NumFrees,
+				   (unsigned long long)Stats->TotalBytes, (unsigned long long)Stats->PeakBytes);
 		}
-		free(QueueFamilies);
 	}
-	return Result;
 }
 
-static u32 RateDeviceSuitability(VkPhysicalDevice Device, queue_family_indices QueueFamilyBois, swap_chain_deets* SwapChainDeets)
+// Only once everything Vulkan has been destroyed
+static void DestroyHostAllocator()
 {
-	u32 Score = 0;
-
-	VkPhysicalDeviceFeatures DeviceFeatures;
-	vkGetPhysicalDeviceFeatures(Device, &DeviceFeatures);
-
-	if ((QueueFamilyBois.ValidFlags & QueueFamily_Graphics) && 
-		(QueueFamilyBois.ValidFlags & QueueFamily_Present) &&
-		CheckDeviceSupportsExtensions(Device) &&
-		SwapChainDeets->NumFormats > 0 &&
-		SwapChainDeets->NumPresentModes > 0 &&
-		DeviceFeatures.samplerAnisotropy)
+	host_pool_chunk* Chunk = s_HostAllocator.Chunks;
+	while (Chunk)
 	{
-		VkPhysicalDeviceProperties DeviceProps;
-		vkGetPhysicalDeviceProperties(Device, &DeviceProps);
-		if (DeviceProps.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
-		{
-			Score += 1'000;
-		}
-		Score += DeviceProps.limits.maxImageDimension2D;
+		host_pool_chunk* Next = Chunk->Next;
+		FreeMemory(Chunk);
+		Chunk = Next;
 	}
-	return Score;
+	s_HostAllocator.Chunks = nullptr;
+	memset(s_HostAllocator.FreeSlots, 0, sizeof(s_HostAllocator.FreeSlots));
 }
 
-static VkSurfaceFormatKHR ChooseSwapSurfaceFormat(VkSurfaceFormatKHR* Formats, u32 NumFormats)
+static u32 FindMemoryType(u32 TypeFilter, VkMemoryPropertyFlags Properties, const VkPhysicalDeviceMemoryProperties* MemoryProperties)
 {
-	Assert(NumFormats != 0 && Formats);
-	VkSurfaceFormatKHR Result = Formats[0]; // TODO: Pick the 'next best' option instead?
-	for (u32 i = 0; i < NumFormats; i++)
+	for (u32 i = 0; i < MemoryProperties->memoryTypeCount; i++)
 	{
-		VkSurfaceFormatKHR Format = Formats[i];
-		if (Format.format == VK_FORMAT_B8G8R8_SRGB && Format.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
+		VkMemoryType MemType = MemoryProperties->memoryTypes[i];
+		if ((TypeFilter & (1 << i)) &&
+			(MemType.propertyFlags & Properties) == Properties)
 		{
-			Result = Format;
-			break;
+			return i;
 		}
 	}
-	return Result;
+	fprintf(stderr, "Failed to find suitable memory type\n");
+	Assert(false);
+	return 0;
 }
 
-static VkPresentModeKHR ChooseSwapPresentMode(VkPresentModeKHR* PresentModes, u32 NumPresentModes)
+// NOTE: Device memory sub-allocator. Instead of one vkAllocateMemory per buffer/image (which is slow, and runs into
+// maxMemoryAllocationCount pretty quickly), we grab big blocks per memory type and carve them up with a buddy allocator.
+// Buddy nodes are power-of-two sized and aligned to their own size, so any (power-of-two) alignment the driver asks for
+// up to the node size comes for free. Linear resources (buffers) and optimal-tiling images get separate blocks, which
+// means neighbours in a block are always the same kind and we never have to worry about bufferImageGranularity.
+static constexpr VkDeviceSize GPU_MAX_BLOCK_SIZE = 64 * 1024 * 1024;
+static constexpr VkDeviceSize GPU_MIN_BLOCK_SIZE = 4 * 1024 * 1024;
+static constexpr VkDeviceSize GPU_MIN_NODE_SIZE = 256;
+static constexpr u32 GPU_MAX_LEVELS = 19; // log2(GPU_MAX_BLOCK_SIZE / GPU_MIN_NODE_SIZE) + 1
+
+static u32 Log2(VkDeviceSize Value)
 {
-	Assert(NumPresentModes > 0 && PresentModes);
-	VkPresentModeKHR Result = VK_PRESENT_MODE_FIFO_KHR;
-	for (u32 i = 0; i < NumPresentModes; i++)
+	u32 Result = 0;
+	while (Value > 1)
 	{
-		VkPresentModeKHR PresentMode = PresentModes[i];
-		if (PresentMode == VK_PRESENT_MODE_MAILBOX_KHR)
-		{
-			Result = PresentMode;
-			break;
-		}
+		Value >>= 1;
+		Result++;
 	}
 	return Result;
 }
 
-static VkExtent2D ChooseSwapExtent(VkSurfaceCapabilitiesKHR* Capabilities, GLFWwindow* Window)
+static VkDeviceSize AlignUp(VkDeviceSize Value, VkDeviceSize Alignment)
 {
-	VkExtent2D Result = Capabilities->currentExtent;
-	if (Capabilities->currentExtent.width == 0xFF'FF'FF'FF)
-	{
-		// TODO: Is this shit actually necessary?
-		s32 WindowWidth, WindowHeight;
-		glfwGetFramebufferSize(Window, &WindowWidth, &WindowHeight);
+	VkDeviceSize Result = (Value + Alignment - 1) & ~(Alignment - 1);
+	return Result;
+}
 
-		Result.width = Clamp((u32)WindowWidth, Capabilities->minImageExtent.width, Capabilities->maxImageExtent.width);
-		Result.height = Clamp((u32)WindowHeight, Capabilities->minImageExtent.height, Capabilities->maxImageExtent.height);
+static VkDeviceSize RoundUpPow2(VkDeviceSize Value)
+{
+	VkDeviceSize Result = 1;
+	while (Result < Value)
+	{
+		Result <<= 1;
 	}
 	return Result;
 }
 
-struct physical_device_deets
+enum gpu_resource_kind : u32
 {
-	VkPhysicalDevice Handle;
-	queue_family_indices QueueFamilyIndices;
-	swap_chain_deets SwapChainDeets;
+	GpuResource_Linear,  // Buffers and linear-tiling images
+	GpuResource_Optimal, // Optimal-tiling images
+	GpuResource_Count
 };
 
-static physical_device_deets PickPhysicalDevice(VkInstance Instance, VkSurfaceKHR Surface)
+struct gpu_free_list
 {
-	physical_device_deets Result = {};
+	u32* Nodes; // Node indices within the level
+	u32 Count;
+	u32 Capacity;
+};
 
-	u32 NumDevices = 0;
-	vkEnumeratePhysicalDevices(Instance, &NumDevices, nullptr);
-	if (NumDevices == 0)
-	{
-		fprintf(stderr, "Found no GPUs with Vulkan support!\n");
-	}
-	else
-	{
-		VkPhysicalDevice* Devices = AllocArray(VkPhysicalDevice, NumDevices);
-		vkEnumeratePhysicalDevices(Instance, &NumDevices, Devices);
-
-		u32 HighestScore = 0;
-		for (u32 i = 0; i < NumDevices; i++)
-		{
-			queue_family_indices QueueFamilyIndices = FindQueueFamilies(Devices[i], Surface);
-			swap_chain_deets SwapChainDeets = QuerySwapChainSupport(Devices[i], Surface);
-			u32 Score = RateDeviceSuitability(Devices[i], QueueFamilyIndices, &SwapChainDeets);
-			if (Score > HighestScore)
-			{
-				Result = { .Handle = Devices[i], .QueueFamilyIndices = QueueFamilyIndices, .SwapChainDeets = SwapChainDeets };
-				HighestScore = Score;
-			}
-			else
-			{
-				if (SwapChainDeets.Formats)
-				{
-					free(SwapChainDeets.Formats);
-				}
-				if (SwapChainDeets.PresentModes)
-				{
-					free(SwapChainDeets.PresentModes);
-				}
-			}
-		}
-		if (!Result.Handle)
-		{
-			Assert(false);
-			fprintf(stderr, "Failed to find suitable GPU - they're all shit!\n");
-		}
-		free(Devices);
-	}
-	return Result;
-}
+struct gpu_block
+{
+	VkDeviceMemory Memory;
+	u8* Mapped; // Only for HOST_VISIBLE memory types - the whole block stays mapped for its lifetime
+	VkDeviceSize Size;
+	VkDeviceSize UsedBytes;
+	u32 NumLevels; // Level 0 is the whole block, each level down halves the node size
+	gpu_resource_kind Kind;
+	gpu_free_list FreeLists[GPU_MAX_LEVELS];
+	gpu_block* Next;
+};
 
+struct gpu_allocation
+{
+	VkDeviceMemory Memory;
+	VkDeviceSize Offset;
+	VkDeviceSize Size; // Size of the buddy node (or dedicated allocation), may be bigger than what was asked for
+	void* Mapped;
+	gpu_block* Block; // nullptr for dedicated allocations
+	u32 Level;
+	u32 Node;
+	u32 MemoryTypeIndex;
+};
 
-static VkInstance CreateInstance()
+struct gpu_heap_stats
 {
-	VkInstance Instance = nullptr;
+	VkDeviceSize BlockBytes;     // Reserved from the driver, whether we've handed it out or not
+	VkDeviceSize AllocatedBytes; // Actually handed out to resources
+	u32 NumBlocks;
+	u32 NumDedicated;
+	u32 NumAllocations;
+};
 
-	VkApplicationInfo AppInfo
-	{
-		.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
-		.pApplicationName = "Sondie's Triangle",
-		.applicationVersion = VK_MAKE_VERSION(1, 0, 0),
-		.pEngineName = "SondieEngine",
-		.engineVersion = VK_MAKE_VERSION(1, 0, 0),
-		.apiVersion = VK_API_VERSION_1_3
-	};
+struct gpu_heap_budget
+{
+	VkDeviceSize Usage;  // Whole process, as of the last UpdateGpuBudget
+	VkDeviceSize Budget; // What the driver reckons we can have, clamped to the VRAM ceiling for device-local heaps
+	VkDeviceSize BlockBytesAtUpdate; // So we can account for our own allocations between budget queries
+};
 
-	u32 NumSupportedExtensions = 0;
-	vkEnumerateInstanceExtensionProperties(nullptr, &NumSupportedExtensions, nullptr);
+// Called when a heap is about to go over budget. Should free up (at least) BytesNeeded on the heap if it can, and
+// return how much it actually freed.
+typedef VkDeviceSize gpu_evict_func(void* UserData, u32 HeapIndex, VkDeviceSize BytesNeeded);
 
-	VkExtensionProperties* SupportedExtensions = AllocArray(VkExtensionProperties, NumSupportedExtensions);
-	vkEnumerateInstanceExtensionProperties(nullptr, &NumSupportedExtensions, SupportedExtensions);
+struct gpu_allocator
+{
+	VkDevice Device;
+	VkPhysicalDevice PhysicalDevice;
+	// Queue families that upload targets get shared between (graphics + transfer, if those are different families)
+	u32 QueueFamilies[2];
+	u32 NumQueueFamilies;
+	VkPhysicalDeviceMemoryProperties MemoryProperties;
+	gpu_block* Blocks[VK_MAX_MEMORY_TYPES][GpuResource_Count];
+	gpu_heap_stats HeapStats[VK_MAX_MEMORY_HEAPS];
+	u32 NumDeviceAllocations;
+	u32 MaxDeviceAllocations;
+
+	b32 HasMemoryBudget; // VK_EXT_memory_budget - without it we have to guess the budget from the heap sizes
+	VkDeviceSize VramCeiling; // 0 for no ceiling
+	gpu_heap_budget HeapBudgets[VK_MAX_MEMORY_HEAPS];
+	gpu_evict_func* Evict;
+	void* EvictUserData;
+
+	// Set when VRAM can be written straight from the CPU - integrated GPUs, lavapipe, discrete cards with the whole of
+	// VRAM exposed through the BAR. Not set for the small 256MB BAR window, we'd just end up fighting over it.
+	b32 HasUnifiedMemory;
+};
 
-	printf("Available extensions (%u):\n", NumSupportedExtensions);
-	for (u32 i = 0; i < NumSupportedExtensions; i++)
+// Re-reads the per-heap budgets from the driver. Cheap-ish, but it's a driver call, so once a frame is plenty.
+static void UpdateGpuBudget(gpu_allocator* Allocator)
+{
+	VkPhysicalDeviceMemoryBudgetPropertiesEXT BudgetProps
 	{
-		printf("\t%s\n", SupportedExtensions[i].extensionName);
-	}
-
-	extensions_list RequiredExtensions = GetRequiredExtensions();
-	u32 NumExtensionMatches = 0;
-	for (u32 i = 0; i < RequiredExtensions.Count; i++)
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT,
+	};
+	if (Allocator->HasMemoryBudget)
 	{
-		for (u32 j = 0; j < NumSupportedExtensions; j++)
+		VkPhysicalDeviceMemoryProperties2 Props
 		{
-			if (strcmp(RequiredExtensions.Names[i], SupportedExtensions[j].extensionName) == 0)
-			{
-				NumExtensionMatches++;
-				break;
-			}
-		}
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+			.pNext = &BudgetProps,
+		};
+		vkGetPhysicalDeviceMemoryProperties2(Allocator->PhysicalDevice, &Props);
 	}
 
-	free(SupportedExtensions);
-	if (NumExtensionMatches >= RequiredExtensions.Count)
+	for (u32 i = 0; i < Allocator->MemoryProperties.memoryHeapCount; i++)
 	{
-		printf("All %u required extensions are supported.\n", RequiredExtensions.Count);
-
-		VkInstanceCreateInfo CreateInfo
+		gpu_heap_budget* Budget = Allocator->HeapBudgets + i;
+		VkMemoryHeap Heap = Allocator->MemoryProperties.memoryHeaps[i];
+		if (Allocator->HasMemoryBudget)
 		{
-			.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
-			.pApplicationInfo = &AppInfo,
-			.enabledExtensionCount = RequiredExtensions.Count,
-			.ppEnabledExtensionNames = RequiredExtensions.Names
-		};
-
-#if _DEBUG
-		Assert(AreValidationLayersSupported());
-		VkDebugUtilsMessengerCreateInfoEXT DebugCreateInfo = DebugCallbackCreateInfo();
-
-		CreateInfo.enabledLayerCount = ArrayCount(VALIDATION_LAYERS);
-		CreateInfo.ppEnabledLayerNames = VALIDATION_LAYERS;
-		CreateInfo.pNext = &DebugCreateInfo;
-#endif
-
-		if (vkCreateInstance(&CreateInfo, nullptr, &Instance) != VK_SUCCESS) // pAllocator
+			Budget->Usage = BudgetProps.heapUsage[i];
+			Budget->Budget = BudgetProps.heapBudget[i];
+		}
+		else
 		{
-			fprintf(stderr, "ERROR: Failed to create Vulkan instance\n");
+			// NOTE: All we know about is our own allocations, and ~80% of the heap is about what drivers will
+			// let one process have before things start getting paged out
+			Budget->Usage = Allocator->HeapStats[i].BlockBytes;
+			Budget->Budget = Heap.size / 10 * 8;
 		}
 
-#if _DEBUG
-		InitDebugCallback(Instance);
-#endif
-	}
-	else
-	{
-		fprintf(stderr, "ERROR: Some extensions required for GLFW are not supported.\n");
+		if (Allocator->VramCeiling && (Heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) && Budget->Budget > Allocator->VramCeiling)
+		{
+			Budget->Budget = Allocator->VramCeiling;
+		}
+		Budget->BlockBytesAtUpdate = Allocator->HeapStats[i].BlockBytes;
 	}
-	return Instance;
 }
 
-struct logical_device
+static VkDeviceSize GetGpuHeapUsage(gpu_allocator* Allocator, u32 HeapIndex)
 {
-	VkDevice Device;
-	VkQueue PresentQueue;
-};
+	gpu_heap_budget* Budget = Allocator->HeapBudgets + HeapIndex;
+	VkDeviceSize Result = Budget->Usage + Allocator->HeapStats[HeapIndex].BlockBytes;
+	Result = Result > Budget->BlockBytesAtUpdate ? Result - Budget->BlockBytesAtUpdate : 0;
+	return Result;
+}
 
-static VkDevice CreateLogicalDevice(physical_device_deets DeviceDeets)
+static gpu_allocator CreateGpuAllocator(VkDevice Device,
+										VkPhysicalDevice PhysicalDevice,
+										const VkPhysicalDeviceMemoryProperties* MemoryProperties,
+										b32 HasMemoryBudget,
+										VkDeviceSize VramCeiling,
+										u32 GraphicsFamily, 
+										u32 TransferFamily)
 {
-	Assert((DeviceDeets.QueueFamilyIndices.ValidFlags & QueueFamily_Graphics) && (DeviceDeets.QueueFamilyIndices.ValidFlags & QueueFamily_Present));
-	// TODO: Oink oink
-	Assert(DeviceDeets.QueueFamilyIndices.GraphicsFamily == DeviceDeets.QueueFamilyIndices.PresentFamily);
-
-	VkPhysicalDeviceFeatures DeviceFeatures 
-	{
-		.samplerAnisotropy = VK_TRUE, // TODO: Probably actually don't want this for pixel art stuff later
-	};
-
-	f32 QueuePriority = 1.0f;
-	VkDeviceQueueCreateInfo QueueCreateInfo
-	{
-		.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-		.queueFamilyIndex = DeviceDeets.QueueFamilyIndices.GraphicsFamily,
-		.queueCount = 1,
-		.pQueuePriorities = &QueuePriority
-	};
+	gpu_allocator Result = {};
+	Result.Device = Device;
+	Result.PhysicalDevice = PhysicalDevice;
+	Result.QueueFamilies[0] = GraphicsFamily;
+	Result.QueueFamilies[1] = TransferFamily;
+	Result.NumQueueFamilies = GraphicsFamily == TransferFamily ? 1 : 2;
+	Result.MemoryProperties = *MemoryProperties;
+	Result.HasMemoryBudget = HasMemoryBudget;
+	Result.VramCeiling = VramCeiling;
+
+	VkPhysicalDeviceProperties Props;
+	vkGetPhysicalDeviceProperties(PhysicalDevice, &Props);
+	Result.MaxDeviceAllocations = Props.limits.maxMemoryAllocationCount;
 
-	VkDeviceCreateInfo DeviceCreateInfo
+	VkDeviceSize BiggestDeviceLocalHeap = 0;
+	for (u32 i = 0; i < MemoryProperties->memoryHeapCount; i++)
 	{
-		.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-		.queueCreateInfoCount = 1,
-		.pQueueCreateInfos = &QueueCreateInfo,
-		.enabledExtensionCount = ArrayCount(DEVICE_EXTENSIONS),
-		.ppEnabledExtensionNames = DEVICE_EXTENSIONS,
-		.pEnabledFeatures = &DeviceFeatures,
-	};
-#if _DEBUG
-	DeviceCreateInfo.enabledLayerCount = ArrayCount(VALIDATION_LAYERS);
-	DeviceCreateInfo.ppEnabledLayerNames = VALIDATION_LAYERS;
-#endif
-	VkDevice Result = VK_NULL_HANDLE;
-	if (vkCreateDevice(DeviceDeets.Handle, &DeviceCreateInfo, nullptr, &Result) != VK_SUCCESS) // pAllocator
+		VkMemoryHeap Heap = MemoryProperties->memoryHeaps[i];
+		if ((Heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) && Heap.size > BiggestDeviceLocalHeap)
+		{
+			BiggestDeviceLocalHeap = Heap.size;
+		}
+	}
+	VkMemoryPropertyFlags UnifiedFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	for (u32 i = 0; i < MemoryProperties->memoryTypeCount; i++)
 	{
-		Assert(false);
-		fprintf(stderr, "Failed to create logical device!\n");
+		VkMemoryType MemType = MemoryProperties->memoryTypes[i];
+		if ((MemType.propertyFlags & UnifiedFlags) == UnifiedFlags &&
+			MemoryProperties->memoryHeaps[MemType.heapIndex].size >= BiggestDeviceLocalHeap)
+		{
+			Result.HasUnifiedMemory = true;
+		}
 	}
+
+	UpdateGpuBudget(&Result);
 	return Result;
 }
 
-static VkSurfaceKHR CreateSurface(VkInstance Instance, GLFWwindow* Window)
+// Asks whoever owns the evictable stuff to make room if taking another Size bytes from the heap would put us over
+// budget. Returns false if we're still going to be over afterwards.
+static b32 MakeRoomInHeap(gpu_allocator* Allocator, u32 MemoryTypeIndex, VkDeviceSize Size)
 {
-	VkWin32SurfaceCreateInfoKHR CreateInfo
-	{
-		.sType = VK_STRUCTURE_TYPE_WIN32_SURFACE_CREATE_INFO_KHR,
-		.hinstance = GetModuleHandle(nullptr),
-		.hwnd = glfwGetWin32Window(Window),
-	};
-
-	VkSurfaceKHR Result = VK_NULL_HANDLE;
-	if (vkCreateWin32SurfaceKHR(Instance, &CreateInfo, nullptr, &Result) != VK_SUCCESS) // pAllocator
+	u32 HeapIndex = Allocator->MemoryProperties.memoryTypes[MemoryTypeIndex].heapIndex;
+	VkDeviceSize Budget = Allocator->HeapBudgets[HeapIndex].Budget;
+	VkDeviceSize Usage = GetGpuHeapUsage(Allocator, HeapIndex);
+	if (Usage + Size > Budget && Allocator->Evict)
 	{
-		Assert(false);
-		fprintf(stderr, "Couldn't make a Win32 surface, bro\n");
+		Allocator->Evict(Allocator->EvictUserData, HeapIndex, Usage + Size - Budget);
+		Usage = GetGpuHeapUsage(Allocator, HeapIndex);
 	}
+	b32 Result = Usage + Size <= Budget;
 	return Result;
 }
 
-struct image
-{
-	VkImage Image;
-	VkImageView ImageView;
-	VkDeviceMemory Memory;
-};
-
-struct swap_chain
+static void PushFreeNode(gpu_free_list* List, u32 Node)
 {
-	VkSwapchainKHR Handle;
-	VkImage* Images;
-	VkImageView* ImageViews;
-	VkFramebuffer* Framebuffers;
-	u32 NumImages;
-	VkFormat Format;
-	VkExtent2D Extents;
-};
+	if (List->Count == List->Capacity)
+	{
+		List->Capacity = List->Capacity ? List->Capacity * 2 : 16;
+		List->Nodes = (u32*)ReallocateMemory(List->Nodes, List->Capacity * sizeof(u32));
+	}
+	List->Nodes[List->Count++] = Node;
+}
 
-static void CreateFramebuffers(swap_chain* Swapchain, image DepthImage, VkDevice Device, VkRenderPass RenderPass)
+static b32 RemoveFreeNode(gpu_free_list* List, u32 Node)
 {
-	// TODO: Is this the cleanest way of reusing memory from previous framebuffers?
-	Swapchain->Framebuffers = AllocArray(VkFramebuffer, Swapchain->NumImages);
-	for (u32 i = 0; i < Swapchain->NumImages; i++)
+	b32 Result = false;
+	for (u32 i = 0; i < List->Count; i++)
 	{
-		VkImageView Attachments[] = { Swapchain->ImageViews[i], DepthImage.ImageView };
-
-		VkFramebufferCreateInfo FramebufferInfo
-		{
-			.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-			.renderPass = RenderPass,
-			.attachmentCount = ArrayCount(Attachments),
-			.pAttachments = Attachments,
-			.width = Swapchain->Extents.width,
-			.height = Swapchain->Extents.height,
-			.layers = 1,
-		};
-		if (vkCreateFramebuffer(Device, &FramebufferInfo, nullptr, Swapchain->Framebuffers + i) != VK_SUCCESS) // pAllocator
+		if (List->Nodes[i] == Node)
 		{
-			fprintf(stderr, "Failed to create framebuffer number %u\n", i);
-			Assert(false);
+			List->Nodes[i] = List->Nodes[--List->Count];
+			Result = true;
+			break;
 		}
 	}
+	return Result;
 }
 
-static VkImageView CreateImageView(VkDevice Device, VkImage Image, VkFormat Format, VkImageAspectFlags AspectFlags)
+static b32 BuddyAlloc(gpu_block* Block, u32 Level, u32* OutNode)
 {
-	VkImageViewCreateInfo IvCreateInfo
+	s32 SearchLevel = (s32)Level;
+	while (SearchLevel >= 0 && Block->FreeLists[SearchLevel].Count == 0)
 	{
-		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-		.image = Image,
-		.viewType = VK_IMAGE_VIEW_TYPE_2D,
-		.format = Format,
-		.components
-		{
-			.r = VK_COMPONENT_SWIZZLE_IDENTITY,
-			.g = VK_COMPONENT_SWIZZLE_IDENTITY,
-			.b = VK_COMPONENT_SWIZZLE_IDENTITY,
-			.a = VK_COMPONENT_SWIZZLE_IDENTITY,
-		},
-		.subresourceRange
-		{
-			.aspectMask = AspectFlags,
-			.baseMipLevel = 0,
-			.levelCount = 1,
-			.baseArrayLayer = 0,
-			.layerCount = 1,
-		},
-	};
+		SearchLevel--;
+	}
 
-	VkImageView Result = VK_NULL_HANDLE;
-	if (vkCreateImageView(Device, &IvCreateInfo, nullptr, &Result) != VK_SUCCESS) // pAllocator
+	b32 Result = false;
+	if (SearchLevel >= 0)
 	{
-		Assert(false);
-		fprintf(stderr, "Failed to create image view...\n");
+		gpu_free_list* List = Block->FreeLists + SearchLevel;
+		u32 Node = List->Nodes[--List->Count];
+		// Split down to the size we actually want, leaving the right-hand halves on the free lists
+		for (u32 l = (u32)SearchLevel; l < Level; l++)
+		{
+			PushFreeNode(Block->FreeLists + l + 1, Node * 2 + 1);
+			Node = Node * 2;
+		}
+		*OutNode = Node;
+		Result = true;
 	}
 	return Result;
 }
 
-static swap_chain CreateSwapChain(physical_device_deets* DeviceDeets,
-								  VkDevice LogicalDevice,
-								  GLFWwindow* Window,
-								  VkSurfaceKHR Surface)
+static void BuddyFree(gpu_block* Block, u32 Level, u32 Node)
 {
-	swap_chain Result = {};
-
-	swap_chain_deets* SwapChainDeets = &DeviceDeets->SwapChainDeets;
-	VkSurfaceFormatKHR SurfaceFormat = ChooseSwapSurfaceFormat(SwapChainDeets->Formats, SwapChainDeets->NumFormats);
-	VkPresentModeKHR PresentMode = ChooseSwapPresentMode(SwapChainDeets->PresentModes, SwapChainDeets->NumPresentModes);
-	Result.Extents = ChooseSwapExtent(&SwapChainDeets->Capabilities, Window);
-
-	u32 ImageCount = SwapChainDeets->Capabilities.minImageCount + 1;
-	if (SwapChainDeets->Capabilities.maxImageCount != 0 && ImageCount > SwapChainDeets->Capabilities.maxImageCount)
+	// Keep merging with our buddy for as long as it's free too
+	while (Level > 0 && RemoveFreeNode(Block->FreeLists + Level, Node ^ 1))
 	{
-		ImageCount = SwapChainDeets->Capabilities.maxImageCount;
+		Node >>= 1;
+		Level--;
 	}
+	PushFreeNode(Block->FreeLists + Level, Node);
+}
 
-	// TODO: Oink, oink...
-	Assert(DeviceDeets->QueueFamilyIndices.GraphicsFamily == DeviceDeets->QueueFamilyIndices.PresentFamily);
-	Assert((DeviceDeets->QueueFamilyIndices.ValidFlags & QueueFamily_Graphics) && (DeviceDeets->QueueFamilyIndices.ValidFlags & QueueFamily_Present));
-	VkSwapchainCreateInfoKHR CreateInfo
+static VkDeviceSize GetGpuBlockSize(gpu_allocator* Allocator, u32 MemoryTypeIndex)
+{
+	u32 HeapIndex = Allocator->MemoryProperties.memoryTypes[MemoryTypeIndex].heapIndex;
+	VkDeviceSize HeapSize = Allocator->MemoryProperties.memoryHeaps[HeapIndex].size;
+
+	// Don't let one block eat a big chunk of a small heap (e.g. the 256MB BAR heap on discrete cards)
+	VkDeviceSize Result = GPU_MAX_BLOCK_SIZE;
+	while (Result > HeapSize / 8 && Result > GPU_MIN_BLOCK_SIZE)
 	{
-		.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
-		.surface = Surface,
-		.minImageCount = ImageCount,
-		.imageFormat = SurfaceFormat.format,
-		.imageColorSpace = SurfaceFormat.colorSpace,
-		.imageExtent = Result.Extents,
-		.imageArrayLayers = 1, // Only > 1 if we're doing stereo 3D rendering
-		.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-		.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
-		.preTransform = SwapChainDeets->Capabilities.currentTransform,
-		.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
-		.presentMode = PresentMode,
-		.clipped = VK_TRUE, // TODO: Any case where we don't want to do any clipping?
-		// TODO: Handle window resizing via 'oldSwapchain'
-	};
-	Result.Format = SurfaceFormat.format;
+		Result >>= 1;
+	}
+	return Result;
+}
 
-	if (vkCreateSwapchainKHR(LogicalDevice, &CreateInfo, nullptr, &Result.Handle) == VK_SUCCESS) // pAllocator
+static VkDeviceMemory AllocateDeviceMemory(gpu_allocator* Allocator, VkDeviceSize Size, u32 MemoryTypeIndex, void** OutMapped)
+{
+	VkDeviceMemory Result = VK_NULL_HANDLE;
+	*OutMapped = nullptr;
+	if (Allocator->NumDeviceAllocations < Allocator->MaxDeviceAllocations)
 	{
-		vkGetSwapchainImagesKHR(LogicalDevice, Result.Handle, &Result.NumImages, nullptr);
-		Result.Images = AllocArray(VkImage, Result.NumImages);
-		vkGetSwapchainImagesKHR(LogicalDevice, Result.Handle, &Result.NumImages, Result.Images);
-		Result.ImageViews = AllocArray(VkImageView, Result.NumImages);
-		for (u32 i = 0; i < Result.NumImages; i++)
+		VkMemoryAllocateInfo AllocInfo
 		{
-			Result.ImageViews[i] = CreateImageView(LogicalDevice, Result.Images[i], Result.Format, VK_IMAGE_ASPECT_COLOR_BIT);
+			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+			.allocationSize = Size,
+			.memoryTypeIndex = MemoryTypeIndex,
+		};
+		VkResult AllocResult = vkAllocateMemory(Allocator->Device, &AllocInfo, HostCallbacks(HostObject_DeviceMemory), &Result);
+		if (AllocResult == VK_ERROR_OUT_OF_DEVICE_MEMORY && Allocator->Evict)
+		{
+			// The budget is only ever an estimate - if the driver disagrees, throw out whatever we can and have another go
+			u32 HeapIndex = Allocator->MemoryProperties.memoryTypes[MemoryTypeIndex].heapIndex;
+			if (Allocator->Evict(Allocator->EvictUserData, HeapIndex, Size) > 0)
+			{
+				AllocResult = vkAllocateMemory(Allocator->Device, &AllocInfo, HostCallbacks(HostObject_DeviceMemory), &Result);
+			}
+		}
+		if (AllocResult == VK_SUCCESS)
+		{
+			Allocator->NumDeviceAllocations++;
+			VkMemoryType MemType = Allocator->MemoryProperties.memoryTypes[MemoryTypeIndex];
+			Allocator->HeapStats[MemType.heapIndex].BlockBytes += Size;
+			if (MemType.propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+			{
+				vkMapMemory(Allocator->Device, Result, 0, VK_WHOLE_SIZE, 0, OutMapped);
+			}
+		}
+		else
+		{
+			Result = VK_NULL_HANDLE;
 		}
 	}
 	else
 	{
-		Assert(false);
-		fprintf(stderr, "Failed to create swap chain, my dude\n");
+		fprintf(stderr, "Hit maxMemoryAllocationCount (%u), can't allocate any more device memory\n", Allocator->MaxDeviceAllocations);
 	}
 	return Result;
 }
 
-static VkFormat FindSupportedFormat(VkFormat* Candidates, u32 NumCandidates, VkImageTiling Tiling, VkFormatFeatureFlags FeatureFlags, VkPhysicalDevice PhysicalDevice)
+static void FreeDeviceMemory(gpu_allocator* Allocator, VkDeviceMemory Memory, VkDeviceSize Size, u32 MemoryTypeIndex)
 {
-	VkFormat Result = VK_FORMAT_UNDEFINED;
-	for (u32 i = 0; i < NumCandidates; i++)
-	{
-		VkFormat Format = Candidates[i];
+	// NOTE: Freeing implicitly unmaps, so no need for vkUnmapMemory here
+	vkFreeMemory(Allocator->Device, Memory, HostCallbacks(HostObject_DeviceMemory));
+	Allocator->NumDeviceAllocations--;
+	u32 HeapIndex = Allocator->MemoryProperties.memoryTypes[MemoryTypeIndex].heapIndex;
+	Allocator->HeapStats[HeapIndex].BlockBytes -= Size;
+}
 
-		VkFormatProperties Props;
-		vkGetPhysicalDeviceFormatProperties(PhysicalDevice, Format, &Props);
+static gpu_block* CreateGpuBlock(gpu_allocator* Allocator, u32 MemoryTypeIndex, gpu_resource_kind Kind)
+{
+	gpu_block* Result = nullptr;
 
-		if (Tiling == VK_IMAGE_TILING_LINEAR && (Props.linearTilingFeatures & FeatureFlags) == FeatureFlags)
-		{
+	VkDeviceSize BlockSize = GetGpuBlockSize(Allocator, MemoryTypeIndex);
+	void* Mapped = nullptr;
+	VkDeviceMemory Memory = AllocateDeviceMemory(Allocator, BlockSize, MemoryTypeIndex, &Mapped);
+	if (Memory)
+	{
+		Result = (gpu_block*)AllocateMemory(sizeof(gpu_block));
+		Result->Memory = Memory;
+		Result->Mapped = (u8*)Mapped;
+		Result->Size = BlockSize;
+		Result->NumLevels = Log2(BlockSize / GPU_MIN_NODE_SIZE) + 1;
+		Result->Kind = Kind;
+		Assert(Result->NumLevels <= GPU_MAX_LEVELS);
+		PushFreeNode(Result->FreeLists, 0);
+
+		Result->Next = Allocator->Blocks[MemoryTypeIndex][Kind];
+		Allocator->Blocks[MemoryTypeIndex][Kind] = Result;
+
+		u32 HeapIndex = Allocator->MemoryProperties.memoryTypes[MemoryTypeIndex].heapIndex;
+		Allocator->HeapStats[HeapIndex].NumBlocks++;
+	}
+	return Result;
+}
+
+static void DestroyGpuBlock(gpu_allocator* Allocator, gpu_block* Block, u32 MemoryTypeIndex)
+{
+	FreeDeviceMemory(Allocator, Block->Memory, Block->Size, MemoryTypeIndex);
+	for (u32 i = 0; i < Block->NumLevels; i++)
+	{
+		FreeMemory(Block->FreeLists[i].Nodes);
+	}
+	FreeMemory(Block);
+
+	u32 HeapIndex = Allocator->MemoryProperties.memoryTypes[MemoryTypeIndex].heapIndex;
+	Allocator->HeapStats[HeapIndex].NumBlocks--;
+}
+
+static gpu_allocation AllocateGpuMemory(gpu_allocator* Allocator,
+										VkMemoryRequirements Reqs,
+										VkMemoryPropertyFlags PropertyFlags,
+										gpu_resource_kind Kind)
+{
+	gpu_allocation Result = {};
+	Result.MemoryTypeIndex = FindMemoryType(Reqs.memoryTypeBits, PropertyFlags, &Allocator->MemoryProperties);
+
+	VkDeviceSize BlockSize = GetGpuBlockSize(Allocator, Result.MemoryTypeIndex);
+	VkDeviceSize NodeSize = Reqs.size > Reqs.alignment ? Reqs.size : Reqs.alignment;
+	NodeSize = RoundUpPow2(NodeSize > GPU_MIN_NODE_SIZE ? NodeSize : GPU_MIN_NODE_SIZE);
+
+	if (NodeSize <= BlockSize)
+	{
+		u32 Level = Log2(BlockSize / NodeSize);
+		gpu_block* Block = Allocator->Blocks[Result.MemoryTypeIndex][Kind];
+		while (Block && !BuddyAlloc(Block, Level, &Result.Node))
+		{
+			Block = Block->Next;
+		}
+		if (!Block)
+		{
+			if (!MakeRoomInHeap(Allocator, Result.MemoryTypeIndex, BlockSize))
+			{
+				fprintf(stderr, "WARNING: Going over budget on heap %u\n", Allocator->MemoryProperties.memoryTypes[Result.MemoryTypeIndex].heapIndex);
+			}
+			// Evicting may well have freed up a node in one of the blocks we've already got
+			Block = Allocator->Blocks[Result.MemoryTypeIndex][Kind];
+			while (Block && !BuddyAlloc(Block, Level, &Result.Node))
+			{
+				Block = Block->Next;
+			}
+		}
+		if (!Block)
+		{
+			Block = CreateGpuBlock(Allocator, Result.MemoryTypeIndex, Kind);
+			if (Block && !BuddyAlloc(Block, Level, &Result.Node))
+			{
+				Block = nullptr;
+			}
+		}
+
+		if (Block)
+		{
+			Result.Memory = Block->Memory;
+			Result.Offset = (VkDeviceSize)Result.Node * NodeSize;
+			Result.Size = NodeSize;
+			Result.Mapped = Block->Mapped ? Block->Mapped + Result.Offset : nullptr;
+			Result.Block = Block;
+			Result.Level = Level;
+			Block->UsedBytes += NodeSize;
+		}
+	}
+
+	if (!Result.Memory)
+	{
+		// Either too big for a block, or we couldn't get a new block - try giving it its own allocation
+		if (!MakeRoomInHeap(Allocator, Result.MemoryTypeIndex, Reqs.size))
+		{
+			fprintf(stderr, "WARNING: Going over budget on heap %u\n", Allocator->MemoryProperties.memoryTypes[Result.MemoryTypeIndex].heapIndex);
+		}
+		Result.Memory = AllocateDeviceMemory(Allocator, Reqs.size, Result.MemoryTypeIndex, &Result.Mapped);
+		Result.Size = Reqs.size;
+		if (Result.Memory)
+		{
+			u32 HeapIndex = Allocator->MemoryProperties.memoryTypes[Result.MemoryTypeIndex].heapIndex;
+			Allocator->HeapStats[HeapIndex].NumDedicated++;
+		}
+	}
+
+	if (Result.Memory)
+	{
+		u32 HeapIndex = Allocator->MemoryProperties.memoryTypes[Result.MemoryTypeIndex].heapIndex;
+		Allocator->HeapStats[HeapIndex].AllocatedBytes += Result.Size;
+		Allocator->HeapStats[HeapIndex].NumAllocations++;
+	}
+	else
+	{
+		fprintf(stderr, "Ran out of device memory trying to allocate %llu bytes\n", (unsigned long long)Reqs.size);
+		Result = {};
+	}
+	return Result;
+}
+
+static void FreeGpuMemory(gpu_allocator* Allocator, gpu_allocation* Allocation)
+{
+	if (Allocation->Memory)
+	{
+		u32 MemoryTypeIndex = Allocation->MemoryTypeIndex;
+		u32 HeapIndex = Allocator->MemoryProperties.memoryTypes[MemoryTypeIndex].heapIndex;
+		gpu_heap_stats* Stats = Allocator->HeapStats + HeapIndex;
+		Stats->AllocatedBytes -= Allocation->Size;
+		Stats->NumAllocations--;
+
+		gpu_block* Block = Allocation->Block;
+		if (Block)
+		{
+			BuddyFree(Block, Allocation->Level, Allocation->Node);
+			Block->UsedBytes -= Allocation->Size;
+
+			// Give empty blocks back to the driver, unless it's the last one of its kind (staging buffers come and go
+			// constantly, and we don't want to bounce a block in and out of existence every time)
+			gpu_block** Link = &Allocator->Blocks[MemoryTypeIndex][Block->Kind];
+			if (Block->UsedBytes == 0 && (Block->Next || *Link != Block))
+			{
+				while (*Link != Block)
+				{
+					Link = &(*Link)->Next;
+				}
+				*Link = Block->Next;
+				DestroyGpuBlock(Allocator, Block, MemoryTypeIndex);
+			}
+		}
+		else
+		{
+			FreeDeviceMemory(Allocator, Allocation->Memory, Allocation->Size, MemoryTypeIndex);
+			Stats->NumDedicated--;
+		}
+	}
+	*Allocation = {};
+}
+
+static void PrintGpuMemoryStats(gpu_allocator* Allocator)
+{
+	printf("GPU memory (%u device allocations):\n", Allocator->NumDeviceAllocations);
+	for (u32 i = 0; i < Allocator->MemoryProperties.memoryHeapCount; i++)
+	{
+		gpu_heap_stats* Stats = Allocator->HeapStats + i;
+		printf("\tHeap %u: %.2f/%.2f MB used in %u blocks + %u dedicated, %u allocations\n", i,
+			   Stats->AllocatedBytes / (1024.0 * 1024.0), Stats->BlockBytes / (1024.0 * 1024.0),
+			   Stats->NumBlocks, Stats->NumDedicated, Stats->NumAllocations);
+		printf("\t\tProcess usage %.2f MB, budget %.2f MB%s\n",
+			   GetGpuHeapUsage(Allocator, i) / (1024.0 * 1024.0), Allocator->HeapBudgets[i].Budget / (1024.0 * 1024.0),
+			   Allocator->HasMemoryBudget ? "" : " (estimated)");
+	}
+}
+
+static void DestroyGpuAllocator(gpu_allocator* Allocator)
+{
+	for (u32 i = 0; i < Allocator->MemoryProperties.memoryHeapCount; i++)
+	{
+		if (Allocator->HeapStats[i].NumAllocations != 0)
+		{
+			fprintf(stderr, "Leaked %u GPU allocations on heap %u!\n", Allocator->HeapStats[i].NumAllocations, i);
+		}
+	}
+	for (u32 TypeIndex = 0; TypeIndex < VK_MAX_MEMORY_TYPES; TypeIndex++)
+	{
+		for (u32 Kind = 0; Kind < GpuResource_Count; Kind++)
+		{
+			gpu_block* Block = Allocator->Blocks[TypeIndex][Kind];
+			while (Block)
+			{
+				gpu_block* Next = Block->Next;
+				DestroyGpuBlock(Allocator, Block, TypeIndex);
+				Block = Next;
+			}
+			Allocator->Blocks[TypeIndex][Kind] = nullptr;
+		}
+	}
+}
+
+struct file_buffer
+{
+	u8* Contents;
+	u32 Size;
+};
+
+#if _WIN32
+// Empty buffer if the file isn't there (or couldn't be read)
+static file_buffer TryLoadFile(memory_arena* Arena, const char* FileName)
+{
+	file_buffer Result = {};
+
+	HANDLE FileHandle = CreateFileA(FileName, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 0, 0);
+	if (FileHandle != INVALID_HANDLE_VALUE)
+	{
+		LARGE_INTEGER FileSize;
+		if (GetFileSizeEx(FileHandle, &FileSize))
+		{
+			Result.Size = (u32)FileSize.QuadPart;
+			temp_memory Temp = BeginTempMemory(Arena);
+			Result.Contents = PushArray(Arena, u8, Result.Size);
+			DWORD BytesRead;
+			if (!ReadFile(FileHandle, Result.Contents, Result.Size, &BytesRead, nullptr) ||
+				Result.Size != BytesRead)
+			{
+				fprintf(stderr, "Failed to read file '%s'\n", FileName);
+				EndTempMemory(Temp);
+				Result = {};
+			}
+		}
+		else
+		{
+			Assert(false); // Couldn't get file size??
+		}
+		CloseHandle(FileHandle);
+	}
+	return Result;
+}
+
+// Contents live in the arena they got loaded into, so there's nothing to give back
+static void UnloadFile(file_buffer* File)
+{
+	*File = {};
+}
+#else
+// Empty buffer if the file isn't there (or couldn't be read). No copy - Contents points straight at a read-only mapping
+// of the file (Arena's unused), which stays valid until UnloadFile.
+static file_buffer TryLoadFile(memory_arena* Arena, const char* FileName)
+{
+	file_buffer Result = {};
+
+	int FileHandle = open(FileName, O_RDONLY);
+	if (FileHandle != -1)
+	{
+		struct stat FileStat;
+		if (fstat(FileHandle, &FileStat) == 0)
+		{
+			// NOTE: MAP_POPULATE reads the whole thing in now, so the I/O happens on whichever thread loaded it (see
+			// ReadStartupFileJob) rather than as page faults on whoever touches it first. Can't map an empty file.
+			void* Mapping = FileStat.st_size ? mmap(nullptr, FileStat.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, FileHandle, 0) : MAP_FAILED;
+			if (Mapping != MAP_FAILED)
+			{
+				Result.Contents = (u8*)Mapping;
+				Result.Size = (u32)FileStat.st_size;
+			}
+			else
+			{
+				fprintf(stderr, "Failed to map file '%s'\n", FileName);
+			}
+		}
+		else
+		{
+			Assert(false); // Couldn't get file size??
+		}
+		close(FileHandle); // The mapping hangs on to the file by itself
+	}
+	return Result;
+}
+
+static void UnloadFile(file_buffer* File)
+{
+	if (File->Contents)
+	{
+		munmap(File->Contents, File->Size);
+	}
+	*File = {};
+}
+#endif
+
+static file_buffer LoadFile(memory_arena* Arena, const char* FileName)
+{
+	file_buffer Result = TryLoadFile(Arena, FileName);
+	if (!Result.Contents)
+	{
+		fprintf(stderr, "Seems like file '%s' doesn't exist, bro\n", FileName);
+		Assert(false);
+	}
+	return Result;
+}
+
+// NOTE: Writes to a temp file next to the real one and renames it over the top, so a crash halfway through leaves the
+// old file alone rather than a truncated one
+static b32 SaveFileAtomically(memory_arena* Scratch, const char* FileName, const void* Data, u32 Size)
+{
+	b32 Result = false;
+	temp_memory Temp = BeginTempMemory(Scratch);
+	size_t TempNameSize = strlen(FileName) + sizeof(".tmp");
+	char* TempFileName = PushArray(Scratch, char, TempNameSize);
+	snprintf(TempFileName, TempNameSize, "%s.tmp", FileName);
+
+#if _WIN32
+	HANDLE FileHandle = CreateFileA(TempFileName, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, 0, 0);
+	if (FileHandle == INVALID_HANDLE_VALUE)
+	{
+		fprintf(stderr, "Couldn't open '%s' for writing\n", TempFileName);
+	}
+	else
+	{
+		DWORD BytesWritten;
+		b32 Written = WriteFile(FileHandle, Data, Size, &BytesWritten, nullptr) && BytesWritten == Size;
+		CloseHandle(FileHandle);
+		if (!Written)
+		{
+			fprintf(stderr, "Failed to write '%s'\n", TempFileName);
+		}
+		else if (!MoveFileExA(TempFileName, FileName, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+		{
+			fprintf(stderr, "Couldn't move '%s' over '%s'\n", TempFileName, FileName);
+		}
+		else
+		{
+			Result = true;
+		}
+	}
+#else
+	int FileHandle = open(TempFileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (FileHandle == -1)
+	{
+		fprintf(stderr, "Couldn't open '%s' for writing\n", TempFileName);
+	}
+	else
+	{
+		b32 Written = write(FileHandle, Data, Size) == (ssize_t)Size;
+		// Same as MOVEFILE_WRITE_THROUGH - the data's on disk before the rename can make it the real file
+		Written = fsync(FileHandle) == 0 && Written;
+		close(FileHandle);
+		if (!Written)
+		{
+			fprintf(stderr, "Failed to write '%s'\n", TempFileName);
+		}
+		else if (rename(TempFileName, FileName) != 0)
+		{
+			fprintf(stderr, "Couldn't move '%s' over '%s'\n", TempFileName, FileName);
+		}
+		else
+		{
+			Result = true;
+		}
+	}
+#endif
+	EndTempMemory(Temp);
+	return Result;
+}
+
+static constexpr const char* VALIDATION_LAYERS[] =
+{
+	"VK_LAYER_KHRONOS_validation"
+};
+
+static constexpr const char* DEVICE_EXTENSIONS[] =
+{
+	VK_KHR_SWAPCHAIN_EXTENSION_NAME
+};
+
+struct extensions_list
+{
+	const char** Names;
+	u32 Count;
+};
+
+// NOTE: Headless, GLFW never gets initialised and we don't need any surface extensions anyway
+static extensions_list GetRequiredExtensions(memory_arena* Arena, b32 Headless)
+{
+	extensions_list Result = {};
+
+	u32 NumGlfwExtensions = 0;
+	const char** GlfwExtensionNames = Headless ? nullptr : glfwGetRequiredInstanceExtensions(&NumGlfwExtensions);
+
+#if _DEBUG
+	Result.Count = NumGlfwExtensions + 1;
+	Result.Names = PushArray(Arena, const char*, Result.Count);
+	for (u32 i = 0; i < NumGlfwExtensions; i++)
+	{
+		Result.Names[i] = GlfwExtensionNames[i];
+	}
+	Result.Names[NumGlfwExtensions] = VK_EXT_DEBUG_UTILS_EXTENSION_NAME;
+#else
+	Result.Count = NumGlfwExtensions;
+	Result.Names = GlfwExtensionNames;
+#endif
+	return Result;
+}
+
+
+#if _DEBUG
+static VkDebugUtilsMessengerEXT s_DebugHandle;
+
+static VKAPI_ATTR VkBool32 VKAPI_CALL DebugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT SeverityBits,
+													VkDebugUtilsMessageTypeFlagsEXT TypeFlags,
+													const VkDebugUtilsMessengerCallbackDataEXT* CallbackData,
+													void* UserData)
+{
+	if (SeverityBits >= VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT)
+	{
+		// NOTE: Breakpoint here to catch whatever set it off
+		fprintf(stderr, "Validation layer: %s\n", CallbackData->pMessage);
+	}
+	return VK_FALSE;
+}
+
+static VkDebugUtilsMessengerCreateInfoEXT DebugCallbackCreateInfo()
+{
+	VkDebugUtilsMessengerCreateInfoEXT CreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT,
+		.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
+						   VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
+						   VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT,
+		.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
+					   VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
+					   VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT,
+		.pfnUserCallback = DebugCallback
+	};
+	return CreateInfo;
+}
+
+static void InitDebugCallback(VkInstance Instance)
+{
+	VkDebugUtilsMessengerCreateInfoEXT CreateInfo = DebugCallbackCreateInfo();
+	PFN_vkCreateDebugUtilsMessengerEXT Func = (PFN_vkCreateDebugUtilsMessengerEXT)vkGetInstanceProcAddr(Instance,
+																										"vkCreateDebugUtilsMessengerEXT");
+	if (Func)
+	{
+		Func(Instance, &CreateInfo, HostCallbacks(HostObject_DebugMessenger), &s_DebugHandle);
+	}
+	else
+	{
+		fprintf(stderr, "Failed to set up debug callback function\n");
+		Assert(false);
+	}
+}
+
+static void DestroyDebugCallback(VkInstance Instance)
+{
+	PFN_vkDestroyDebugUtilsMessengerEXT Func = (PFN_vkDestroyDebugUtilsMessengerEXT)vkGetInstanceProcAddr(Instance,
+																										  "vkDestroyDebugUtilsMessengerEXT");
+	if (Func)
+	{
+		Func(Instance, s_DebugHandle, HostCallbacks(HostObject_DebugMessenger));
+	}
+}
+
+static b32 AreValidationLayersSupported(memory_arena* Scratch)
+{
+	u32 NumValidationLayers = 0;
+	vkEnumerateInstanceLayerProperties(&NumValidationLayers, nullptr);
+
+	temp_memory Temp = BeginTempMemory(Scratch);
+	VkLayerProperties* AvailableLayers = PushArray(Scratch, VkLayerProperties, NumValidationLayers);
+	vkEnumerateInstanceLayerProperties(&NumValidationLayers, AvailableLayers);
+	b32 Result = true;
+	for (u32 i = 0; i < ArrayCount(VALIDATION_LAYERS); i++)
+	{
+		const char* LayerName = VALIDATION_LAYERS[i];
+		b32 FoundLayer = false;
+		for (u32 j = 0; j < NumValidationLayers; j++)
+		{
+			if (strcmp(LayerName, AvailableLayers[j].layerName) == 0)
+			{
+				FoundLayer = true;
+				break;
+			}
+		}
+		if (!FoundLayer)
+		{
+			Result = false;
+			break;
+		}
+	}
+
+	EndTempMemory(Temp);
+	return Result;
+}
+#endif
+
+static VkShaderModule CreateShaderModule(VkDevice Device, file_buffer ShaderFile)
+{
+	VkShaderModuleCreateInfo CreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+		.codeSize = ShaderFile.Size,
+		.pCode = (u32*)ShaderFile.Contents, // TODO: Align to 4-byte memory necessary here?
+	};
+	VkShaderModule Result = VK_NULL_HANDLE;
+	if (vkCreateShaderModule(Device, &CreateInfo, HostCallbacks(HostObject_ShaderModule), &Result) != VK_SUCCESS)
+	{
+		fprintf(stderr, "Failed to create shader... :(\n");
+		Assert(false);
+	}
+	return Result;
+}
+
+struct swap_chain_deets
+{
+	VkSurfaceCapabilitiesKHR Capabilities;
+	
+	VkSurfaceFormatKHR* Formats;
+	u32 NumFormats;
+
+	VkPresentModeKHR* PresentModes;
+	u32 NumPresentModes;
+};
+
+static swap_chain_deets QuerySwapChainSupport(memory_arena* Arena, VkPhysicalDevice Device, VkSurfaceKHR Surface)
+{
+	swap_chain_deets Result = {};
+
+	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(Device, Surface, &Result.Capabilities);
+
+	vkGetPhysicalDeviceSurfaceFormatsKHR(Device, Surface, &Result.NumFormats, nullptr);
+	if (Result.NumFormats != 0)
+	{
+		Result.Formats = PushArray(Arena, VkSurfaceFormatKHR, Result.NumFormats);
+		vkGetPhysicalDeviceSurfaceFormatsKHR(Device, Surface, &Result.NumFormats, Result.Formats);
+		
+		vkGetPhysicalDeviceSurfacePresentModesKHR(Device, Surface, &Result.NumPresentModes, nullptr);
+		if (Result.NumPresentModes == 0)
+		{
+			Result.Formats = nullptr;
+		}
+		else
+		{
+			Result.PresentModes = PushArray(Arena, VkPresentModeKHR, Result.NumPresentModes);
+			vkGetPhysicalDeviceSurfacePresentModesKHR(Device, Surface, &Result.NumPresentModes, Result.PresentModes);
+		}
+	}
+	return Result;
+}
+
+static b32 CheckDeviceSupportsExtensions(memory_arena* Scratch, VkPhysicalDevice Device)
+{
+	u32 NumExtensions = 0;
+	vkEnumerateDeviceExtensionProperties(Device, nullptr, &NumExtensions, nullptr);
+	temp_memory Temp = BeginTempMemory(Scratch);
+	VkExtensionProperties* AvailableExtensions = PushArray(Scratch, VkExtensionProperties, NumExtensions);
+	vkEnumerateDeviceExtensionProperties(Device, nullptr, &NumExtensions, AvailableExtensions);
+	
+	u32 FoundExtensions = 0;
+	for (u32 i = 0; i < ArrayCount(DEVICE_EXTENSIONS); i++)
+	{
+		for (u32 j = 0; j < NumExtensions; j++)
+		{
+			if (strcmp(DEVICE_EXTENSIONS[i], AvailableExtensions[j].extensionName) == 0)
+			{
+				FoundExtensions++;
+				break;
+			}
+		}
+	}
+
+	EndTempMemory(Temp);
+	b32 Result = FoundExtensions == ArrayCount(DEVICE_EXTENSIONS);
+	return Result;
+}
+
+static b32 IsDeviceExtensionSupported(memory_arena* Scratch, VkPhysicalDevice Device, const char* ExtensionName)
+{
+	u32 NumExtensions = 0;
+	vkEnumerateDeviceExtensionProperties(Device, nullptr, &NumExtensions, nullptr);
+	temp_memory Temp = BeginTempMemory(Scratch);
+	VkExtensionProperties* AvailableExtensions = PushArray(Scratch, VkExtensionProperties, NumExtensions);
+	vkEnumerateDeviceExtensionProperties(Device, nullptr, &NumExtensions, AvailableExtensions);
+
+	b32 Result = false;
+	for (u32 i = 0; i < NumExtensions && !Result; i++)
+	{
+		Result = strcmp(ExtensionName, AvailableExtensions[i].extensionName) == 0;
+	}
+	EndTempMemory(Temp);
+	return Result;
+}
+
+enum queue_family_flags : u32
+{
+	QueueFamily_Graphics = 1,
+	QueueFamily_Present  = 1 << 1,
+	QueueFamily_Transfer = 1 << 2, // Only set if there's a dedicated transfer family, otherwise TransferFamily == GraphicsFamily
+};
+
+struct queue_family_indices
+{
+	u32 GraphicsFamily;
+	u32 PresentFamily;
+	u32 TransferFamily;
+	u32 ValidFlags;
+};
+
+// TODO: Don't we just want to find the one queue that supports both graphics and presenting, and save some hassle?
+static queue_family_indices FindQueueFamilies(memory_arena* Scratch, VkPhysicalDevice Device, VkSurfaceKHR Surface)
+{
+	queue_family_indices Result = {};
+
+	u32 NumFamilies = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(Device, &NumFamilies, nullptr);
+
+	if (NumFamilies == 0)
+	{
+		fprintf(stderr, "No queue families WTF\n");
+	}
+	else
+	{
+		temp_memory Temp = BeginTempMemory(Scratch);
+		VkQueueFamilyProperties* QueueFamilies = PushArray(Scratch, VkQueueFamilyProperties, NumFamilies);
+		vkGetPhysicalDeviceQueueFamilyProperties(Device, &NumFamilies, QueueFamilies);
+		for (u32 i = 0; i < NumFamilies; i++)
+		{
+			if (QueueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+			{
+				Result.GraphicsFamily = i;
+				Result.ValidFlags |= QueueFamily_Graphics;
+			}
+
+			b32 HasPresentSupport = false;
+			if (Surface)
+			{
+				vkGetPhysicalDeviceSurfaceSupportKHR(Device, i, Surface, &HasPresentSupport);
+			}
+			else
+			{
+				// Headless: 'presenting' is just the graphics queue finishing with an offscreen image
+				HasPresentSupport = QueueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT;
+			}
+			if (HasPresentSupport)
+			{
+				Result.PresentFamily = i;
+				Result.ValidFlags |= QueueFamily_Present;
+			}
+			if ((Result.ValidFlags & QueueFamily_Present) && (Result.ValidFlags & QueueFamily_Graphics))
+			{
+				break;
+			}
+			else
+			{
+				Result = {};
+			}
+		}
+
+		// Uploads go on a transfer-only family if there is one (that's the dedicated copy engine on discrete cards),
+		// otherwise they just share the graphics queue
+		Result.TransferFamily = Result.GraphicsFamily;
+		for (u32 i = 0; i < NumFamilies && (Result.ValidFlags & QueueFamily_Graphics); i++)
+		{
+			VkQueueFlags Flags = QueueFamilies[i].queueFlags;
+			if ((Flags & VK_QUEUE_TRANSFER_BIT) && !(Flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+			{
+				Result.TransferFamily = i;
+				Result.ValidFlags |= QueueFamily_Transfer;
+				break;
+			}
+		}
+		EndTempMemory(Temp);
+	}
+	return Result;
+}
+
+// NOTE: Headless devices don't need a swapchain, so anything that can draw will do - including CPU rasterisers like lavapipe
+static u32 RateDeviceSuitability(memory_arena* Scratch, VkPhysicalDevice Device, queue_family_indices QueueFamilyBois, swap_chain_deets* SwapChainDeets,
+								 b32 Headless)
+{
+	u32 Score = 0;
+
+	VkPhysicalDeviceProperties DeviceProps;
+	vkGetPhysicalDeviceProperties(Device, &DeviceProps);
+
+	// NOTE: Can only chain the 1.2/1.3 feature structs if the device actually speaks 1.2/1.3
+	VkPhysicalDeviceVulkan13Features Vulkan13Features
+	{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
+	};
+	VkPhysicalDeviceVulkan12Features Vulkan12Features
+	{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+		.pNext = DeviceProps.apiVersion >= VK_API_VERSION_1_3 ? &Vulkan13Features : nullptr,
+	};
+	VkPhysicalDeviceFeatures2 DeviceFeatures
+	{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+		.pNext = DeviceProps.apiVersion >= VK_API_VERSION_1_2 ? &Vulkan12Features : nullptr,
+	};
+	vkGetPhysicalDeviceFeatures2(Device, &DeviceFeatures);
+
+	if ((QueueFamilyBois.ValidFlags & QueueFamily_Graphics) && 
+		(QueueFamilyBois.ValidFlags & QueueFamily_Present) &&
+		(Headless || (CheckDeviceSupportsExtensions(Scratch, Device) &&
+					  SwapChainDeets->NumFormats > 0 &&
+					  SwapChainDeets->NumPresentModes > 0)) &&
+		DeviceFeatures.features.samplerAnisotropy &&
+		Vulkan12Features.timelineSemaphore &&
+		Vulkan13Features.synchronization2)
+	{
+		if (DeviceProps.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
+		{
+			Score += 1'000;
+		}
+		Score += DeviceProps.limits.maxImageDimension2D;
+	}
+	return Score;
+}
+
+static VkSurfaceFormatKHR ChooseSwapSurfaceFormat(VkSurfaceFormatKHR* Formats, u32 NumFormats)
+{
+	Assert(NumFormats != 0 && Formats);
+	VkSurfaceFormatKHR Result = Formats[0]; // TODO: Pick the 'next best' option instead?
+	for (u32 i = 0; i < NumFormats; i++)
+	{
+		VkSurfaceFormatKHR Format = Formats[i];
+		if (Format.format == VK_FORMAT_B8G8R8_SRGB && Format.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
+		{
+			Result = Format;
+			break;
+		}
+	}
+	return Result;
+}
+
+// Lowest power at the top, lowest latency at the bottom - roughly, anyway. Which one wins depends on the deployment, so
+// it's picked with --present-mode and can be flipped through at runtime with P
+enum present_policy
+{
+	PresentPolicy_Fifo, // Vsync, queues up behind the display. Always supported.
+	PresentPolicy_FifoRelaxed, // Vsync, unless we missed one, in which case it tears instead of waiting for the next
+	PresentPolicy_Mailbox, // Vsync, but newer frames replace queued ones, so we never block
+	PresentPolicy_Immediate, // No vsync, tears
+	PresentPolicy_Count
+};
+
+static constexpr VkPresentModeKHR PRESENT_POLICY_MODES[PresentPolicy_Count] =
+{
+	VK_PRESENT_MODE_FIFO_KHR,
+	VK_PRESENT_MODE_FIFO_RELAXED_KHR,
+	VK_PRESENT_MODE_MAILBOX_KHR,
+	VK_PRESENT_MODE_IMMEDIATE_KHR,
+};
+
+static constexpr const char* PRESENT_POLICY_NAMES[PresentPolicy_Count] =
+{
+	"fifo",
+	"fifo-relaxed",
+	"mailbox",
+	"immediate",
+};
+
+// Falls back to FIFO if the surface can't do what we want, since that one's guaranteed to be there
+static present_policy ChooseSwapPresentMode(VkPresentModeKHR* PresentModes, u32 NumPresentModes, present_policy Wanted)
+{
+	Assert(NumPresentModes > 0 && PresentModes);
+	present_policy Result = PresentPolicy_Fifo;
+	for (u32 i = 0; i < NumPresentModes; i++)
+	{
+		if (PresentModes[i] == PRESENT_POLICY_MODES[Wanted])
+		{
+			Result = Wanted;
+			break;
+		}
+	}
+	return Result;
+}
+
+static VkExtent2D ChooseSwapExtent(VkSurfaceCapabilitiesKHR* Capabilities, GLFWwindow* Window)
+{
+	VkExtent2D Result = Capabilities->currentExtent;
+	if (Capabilities->currentExtent.width == 0xFF'FF'FF'FF)
+	{
+		// TODO: Is this shit actually necessary?
+		s32 WindowWidth, WindowHeight;
+		glfwGetFramebufferSize(Window, &WindowWidth, &WindowHeight);
+
+		Result.width = Clamp((u32)WindowWidth, Capabilities->minImageExtent.width, Capabilities->maxImageExtent.width);
+		Result.height = Clamp((u32)WindowHeight, Capabilities->minImageExtent.height, Capabilities->maxImageExtent.height);
+	}
+	return Result;
+}
+
+struct physical_device_deets
+{
+	VkPhysicalDevice Handle;
+	queue_family_indices QueueFamilyIndices;
+	swap_chain_deets SwapChainDeets;
+	VkPhysicalDeviceMemoryProperties MemoryProperties;
+	b32 HasMemoryBudget; // VK_EXT_memory_budget is optional
+	b32 HasPipelineLibrary; // So is VK_EXT_graphics_pipeline_library
+	b32 HasPresentWait; // And VK_KHR_present_wait (plus VK_KHR_present_id, which it needs)
+	b32 Headless; // No surface, so no swapchain either
+};
+
+// NOTE: Surface formats/present modes for the device we end up with go in Arena, everything else in Scratch.
+// No surface means we're headless.
+static physical_device_deets PickPhysicalDevice(memory_arena* Arena, memory_arena* Scratch, VkInstance Instance, VkSurfaceKHR Surface)
+{
+	physical_device_deets Result = {};
+
+	u32 NumDevices = 0;
+	vkEnumeratePhysicalDevices(Instance, &NumDevices, nullptr);
+	if (NumDevices == 0)
+	{
+		fprintf(stderr, "Found no GPUs with Vulkan support!\n");
+	}
+	else
+	{
+		temp_memory Temp = BeginTempMemory(Scratch);
+		VkPhysicalDevice* Devices = PushArray(Scratch, VkPhysicalDevice, NumDevices);
+		vkEnumeratePhysicalDevices(Instance, &NumDevices, Devices);
+
+		u32 HighestScore = 0;
+		for (u32 i = 0; i < NumDevices; i++)
+		{
+			queue_family_indices QueueFamilyIndices = FindQueueFamilies(Scratch, Devices[i], Surface);
+			swap_chain_deets SwapChainDeets = Surface ? QuerySwapChainSupport(Scratch, Devices[i], Surface) : swap_chain_deets{};
+			u32 Score = RateDeviceSuitability(Scratch, Devices[i], QueueFamilyIndices, &SwapChainDeets, !Surface);
+			if (Score > HighestScore)
+			{
+				Result = { .Handle = Devices[i], .QueueFamilyIndices = QueueFamilyIndices, .SwapChainDeets = SwapChainDeets, .Headless = !Surface };
+				HighestScore = Score;
+			}
+		}
+		if (!Result.Handle)
+		{
+			Assert(false);
+			fprintf(stderr, "Failed to find suitable GPU - they're all shit!\n");
+		}
+		else
+		{
+			vkGetPhysicalDeviceMemoryProperties(Result.Handle, &Result.MemoryProperties);
+			Result.HasMemoryBudget = IsDeviceExtensionSupported(Scratch, Result.Handle, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+			if (IsDeviceExtensionSupported(Scratch, Result.Handle, VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME) &&
+				IsDeviceExtensionSupported(Scratch, Result.Handle, VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME))
+			{
+				VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT PipelineLibraryFeatures
+				{
+					.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT,
+				};
+				VkPhysicalDeviceFeatures2 Features
+				{
+					.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+					.pNext = &PipelineLibraryFeatures,
+				};
+				vkGetPhysicalDeviceFeatures2(Result.Handle, &Features);
+				Result.HasPipelineLibrary = PipelineLibraryFeatures.graphicsPipelineLibrary;
+			}
+			if (!Result.Headless &&
+				IsDeviceExtensionSupported(Scratch, Result.Handle, VK_KHR_PRESENT_ID_EXTENSION_NAME) &&
+				IsDeviceExtensionSupported(Scratch, Result.Handle, VK_KHR_PRESENT_WAIT_EXTENSION_NAME))
+			{
+				VkPhysicalDevicePresentIdFeaturesKHR PresentIdFeatures
+				{
+					.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR,
+				};
+				VkPhysicalDevicePresentWaitFeaturesKHR PresentWaitFeatures
+				{
+					.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR,
+					.pNext = &PresentIdFeatures,
+				};
+				VkPhysicalDeviceFeatures2 Features
+				{
+					.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+					.pNext = &PresentWaitFeatures,
+				};
+				vkGetPhysicalDeviceFeatures2(Result.Handle, &Features);
+				Result.HasPresentWait = PresentIdFeatures.presentId && PresentWaitFeatures.presentWait;
+			}
+		}
+
+		// The winner's swapchain deets have to outlive the scratch memory
+		swap_chain_deets* Deets = &Result.SwapChainDeets;
+		VkSurfaceFormatKHR* Formats = PushArray(Arena, VkSurfaceFormatKHR, Deets->NumFormats);
+		VkPresentModeKHR* PresentModes = PushArray(Arena, VkPresentModeKHR, Deets->NumPresentModes);
+		memcpy(Formats, Deets->Formats, Deets->NumFormats * sizeof(VkSurfaceFormatKHR));
+		memcpy(PresentModes, Deets->PresentModes, Deets->NumPresentModes * sizeof(VkPresentModeKHR));
+		Deets->Formats = Formats;
+		Deets->PresentModes = PresentModes;
+		EndTempMemory(Temp);
+	}
+	return Result;
+}
+
+
+static VkInstance CreateInstance(memory_arena* Scratch, b32 Headless)
+{
+	VkInstance Instance = nullptr;
+
+	VkApplicationInfo AppInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+		.pApplicationName = "Sondie's Triangle",
+		.applicationVersion = VK_MAKE_VERSION(1, 0, 0),
+		.pEngineName = "SondieEngine",
+		.engineVersion = VK_MAKE_VERSION(1, 0, 0),
+		.apiVersion = VK_API_VERSION_1_3
+	};
+
+	u32 NumSupportedExtensions = 0;
+	vkEnumerateInstanceExtensionProperties(nullptr, &NumSupportedExtensions, nullptr);
+
+	temp_memory Temp = BeginTempMemory(Scratch);
+	VkExtensionProperties* SupportedExtensions = PushArray(Scratch, VkExtensionProperties, NumSupportedExtensions);
+	vkEnumerateInstanceExtensionProperties(nullptr, &NumSupportedExtensions, SupportedExtensions);
+
+	printf("Available extensions (%u):\n", NumSupportedExtensions);
+	for (u32 i = 0; i < NumSupportedExtensions; i++)
+	{
+		printf("\t%s\n", SupportedExtensions[i].extensionName);
+	}
+
+	extensions_list RequiredExtensions = GetRequiredExtensions(Scratch, Headless);
+	u32 NumExtensionMatches = 0;
+	for (u32 i = 0; i < RequiredExtensions.Count; i++)
+	{
+		for (u32 j = 0; j < NumSupportedExtensions; j++)
+		{
+			if (strcmp(RequiredExtensions.Names[i], SupportedExtensions[j].extensionName) == 0)
+			{
+				NumExtensionMatches++;
+				break;
+			}
+		}
+	}
+
+	if (NumExtensionMatches >= RequiredExtensions.Count)
+	{
+		printf("All %u required extensions are supported.\n", RequiredExtensions.Count);
+
+		VkInstanceCreateInfo CreateInfo
+		{
+			.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+			.pApplicationInfo = &AppInfo,
+			.enabledExtensionCount = RequiredExtensions.Count,
+			.ppEnabledExtensionNames = RequiredExtensions.Names
+		};
+
+#if _DEBUG
+		Assert(AreValidationLayersSupported(Scratch));
+		VkDebugUtilsMessengerCreateInfoEXT DebugCreateInfo = DebugCallbackCreateInfo();
+
+		CreateInfo.enabledLayerCount = ArrayCount(VALIDATION_LAYERS);
+		CreateInfo.ppEnabledLayerNames = VALIDATION_LAYERS;
+		CreateInfo.pNext = &DebugCreateInfo;
+#endif
+
+		if (vkCreateInstance(&CreateInfo, HostCallbacks(HostObject_Instance), &Instance) != VK_SUCCESS)
+		{
+			fprintf(stderr, "ERROR: Failed to create Vulkan instance\n");
+		}
+
+#if _DEBUG
+		InitDebugCallback(Instance);
+#endif
+	}
+	else
+	{
+		fprintf(stderr, "ERROR: Some extensions required for GLFW are not supported.\n");
+	}
+	EndTempMemory(Temp);
+	return Instance;
+}
+
+struct logical_device
+{
+	VkDevice Device;
+	VkQueue PresentQueue;
+};
+
+static VkDevice CreateLogicalDevice(physical_device_deets DeviceDeets)
+{
+	Assert((DeviceDeets.QueueFamilyIndices.ValidFlags & QueueFamily_Graphics) && (DeviceDeets.QueueFamilyIndices.ValidFlags & QueueFamily_Present));
+	// TODO: Oink oink
+	Assert(DeviceDeets.QueueFamilyIndices.GraphicsFamily == DeviceDeets.QueueFamilyIndices.PresentFamily);
+
+	VkPhysicalDeviceFeatures DeviceFeatures 
+	{
+		.samplerAnisotropy = VK_TRUE, // TODO: Probably actually don't want this for pixel art stuff later
+	};
+
+	// Optional features get chained on the front of the list as we find we've got them
+	void* OptionalFeatures = nullptr;
+	VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT PipelineLibraryFeatures
+	{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT,
+		.graphicsPipelineLibrary = VK_TRUE,
+	};
+	if (DeviceDeets.HasPipelineLibrary)
+	{
+		PipelineLibraryFeatures.pNext = OptionalFeatures;
+		OptionalFeatures = &PipelineLibraryFeatures;
+	}
+	VkPhysicalDevicePresentIdFeaturesKHR PresentIdFeatures
+	{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR,
+		.presentId = VK_TRUE,
+	};
+	VkPhysicalDevicePresentWaitFeaturesKHR PresentWaitFeatures
+	{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR,
+		.pNext = &PresentIdFeatures,
+		.presentWait = VK_TRUE,
+	};
+	if (DeviceDeets.HasPresentWait)
+	{
+		PresentIdFeatures.pNext = OptionalFeatures;
+		OptionalFeatures = &PresentWaitFeatures;
+	}
+	VkPhysicalDeviceVulkan13Features Vulkan13Features
+	{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
+		.pNext = OptionalFeatures,
+		.synchronization2 = VK_TRUE,
+		.dynamicRendering = VK_TRUE,
+	};
+	VkPhysicalDeviceVulkan12Features Vulkan12Features
+	{
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+		.pNext = &Vulkan13Features,
+		.timelineSemaphore = VK_TRUE,
+	};
+
+	f32 QueuePriority = 1.0f;
+	VkDeviceQueueCreateInfo QueueCreateInfos[]
+	{
+		{
+			.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+			.queueFamilyIndex = DeviceDeets.QueueFamilyIndices.GraphicsFamily,
+			.queueCount = 1,
+			.pQueuePriorities = &QueuePriority
+		},
+		{
+			.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+			.queueFamilyIndex = DeviceDeets.QueueFamilyIndices.TransferFamily,
+			.queueCount = 1,
+			.pQueuePriorities = &QueuePriority
+		},
+	};
+	b32 HasTransferFamily = DeviceDeets.QueueFamilyIndices.ValidFlags & QueueFamily_Transfer;
+
+	const char* Extensions[ArrayCount(DEVICE_EXTENSIONS) + 5];
+	u32 NumExtensions = 0;
+	for (u32 i = 0; i < ArrayCount(DEVICE_EXTENSIONS) && !DeviceDeets.Headless; i++)
+	{
+		Extensions[NumExtensions++] = DEVICE_EXTENSIONS[i];
+	}
+	if (DeviceDeets.HasMemoryBudget)
+	{
+		Extensions[NumExtensions++] = VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+	}
+	if (DeviceDeets.HasPipelineLibrary)
+	{
+		Extensions[NumExtensions++] = VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME;
+		Extensions[NumExtensions++] = VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME;
+	}
+	if (DeviceDeets.HasPresentWait)
+	{
+		Extensions[NumExtensions++] = VK_KHR_PRESENT_ID_EXTENSION_NAME;
+		Extensions[NumExtensions++] = VK_KHR_PRESENT_WAIT_EXTENSION_NAME;
+	}
+
+	VkDeviceCreateInfo DeviceCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+		.pNext = &Vulkan12Features,
+		.queueCreateInfoCount = HasTransferFamily ? 2u : 1u,
+		.pQueueCreateInfos = QueueCreateInfos,
+		.enabledExtensionCount = NumExtensions,
+		.ppEnabledExtensionNames = Extensions,
+		.pEnabledFeatures = &DeviceFeatures,
+	};
+#if _DEBUG
+	DeviceCreateInfo.enabledLayerCount = ArrayCount(VALIDATION_LAYERS);
+	DeviceCreateInfo.ppEnabledLayerNames = VALIDATION_LAYERS;
+#endif
+	VkDevice Result = VK_NULL_HANDLE;
+	if (vkCreateDevice(DeviceDeets.Handle, &DeviceCreateInfo, HostCallbacks(HostObject_Device), &Result) != VK_SUCCESS)
+	{
+		Assert(false);
+		fprintf(stderr, "Failed to create logical device!\n");
+	}
+	return Result;
+}
+
+static VkSurfaceKHR CreateSurface(VkInstance Instance, GLFWwindow* Window)
+{
+	// GLFW knows whether we're on Win32, XCB or Wayland, and asked for the right instance extensions for it already
+	VkSurfaceKHR Result = VK_NULL_HANDLE;
+	if (glfwCreateWindowSurface(Instance, Window, HostCallbacks(HostObject_Surface), &Result) != VK_SUCCESS)
+	{
+		Assert(false);
+		fprintf(stderr, "Couldn't make a window surface, bro\n");
+	}
+	return Result;
+}
+
+// NOTE: Image layout/access tracking. Every image remembers the layout it's in and the last stages/accesses that
+// touched it, so instead of hand-writing old/new layout pairs (and guessing at stage masks) you just say how you're
+// about to use it and the right barrier falls out. Barriers get collected in a barrier_batch and go out in one
+// vkCmdPipelineBarrier2 when you flush - call FlushBarriers before recording anything that uses the images.
+// The tracking is CPU-side, so it assumes command buffers execute in the order they're recorded in.
+struct image_state
+{
+	VkImageLayout Layout;
+	VkPipelineStageFlags2 Stage;
+	VkAccessFlags2 Access;
+};
+
+enum image_usage
+{
+	ImageUsage_TransferDst,
+	ImageUsage_UploadedForSampling,
+	ImageUsage_FragmentSampled,
+	ImageUsage_ColourAttachment,
+	ImageUsage_DepthAttachment,
+	ImageUsage_Present,
+	ImageUsage_TransferSrc,
+
+	ImageUsage_Count,
+};
+
+static constexpr image_state IMAGE_USAGE_STATES[ImageUsage_Count] =
+{
+	{ VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT },
+	// NOTE: This can get recorded on a transfer-only queue, which doesn't know about the fragment shader stage. The
+	// graphics queue waits on the upload timeline semaphore before it samples the image, and that wait is what makes
+	// the transfer writes visible - so all we need here is the layout change itself.
+	{ VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE },
+	{ VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT },
+	{ VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+	  VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT },
+	{ VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+	  VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT },
+	// NOTE: Presenting waits on the render-finished semaphore, which covers everything before it
+	{ VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE },
+	{ VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT },
+};
+
+// Where a swapchain image is at right after vkAcquireNextImageKHR: contents are junk, and the only thing it has to wait
+// for is the image-available semaphore, which the frame's submit waits on at COLOR_ATTACHMENT_OUTPUT.
+static constexpr image_state SWAPCHAIN_ACQUIRED_STATE = { VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_NONE };
+
+static constexpr VkAccessFlags2 WRITE_ACCESS_MASK = VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT |
+													VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT |
+													VK_ACCESS_2_HOST_WRITE_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+
+static constexpr u32 MAX_BATCHED_BARRIERS = 16;
+
+struct barrier_batch
+{
+	VkCommandBuffer CommandBuffer;
+	VkImageMemoryBarrier2 ImageBarriers[MAX_BATCHED_BARRIERS];
+	u32 NumImageBarriers;
+};
+
+static barrier_batch BeginBarrierBatch(VkCommandBuffer CommandBuffer)
+{
+	barrier_batch Result = {};
+	Result.CommandBuffer = CommandBuffer;
+	return Result;
+}
+
+static void FlushBarriers(barrier_batch* Batch)
+{
+	if (Batch->NumImageBarriers)
+	{
+		VkDependencyInfo DependencyInfo
+		{
+			.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+			.imageMemoryBarrierCount = Batch->NumImageBarriers,
+			.pImageMemoryBarriers = Batch->ImageBarriers,
+		};
+		vkCmdPipelineBarrier2(Batch->CommandBuffer, &DependencyInfo);
+		Batch->NumImageBarriers = 0;
+	}
+}
+
+// Gets the image ready for Usage. DiscardContents lets the barrier go from UNDEFINED, which is cheaper (no layout
+// conversion of data we're about to clear or overwrite anyway).
+static void RequireImageState(barrier_batch* Batch, VkImage Image, VkImageAspectFlags Aspect, image_state* Current, 
+							  image_usage Usage, b32 DiscardContents)
+{
+	image_state Wanted = IMAGE_USAGE_STATES[Usage];
+	b32 WasWritten = (Current->Access & WRITE_ACCESS_MASK) != 0;
+	b32 WillWrite = (Wanted.Access & WRITE_ACCESS_MASK) != 0;
+	if (Current->Layout == Wanted.Layout && !WasWritten && !WillWrite)
+	{
+		// Read after read, no barrier needed. Remember the extra readers though, so whatever writes next waits for them.
+		Current->Stage |= Wanted.Stage;
+		Current->Access |= Wanted.Access;
+	}
+	else
+	{
+		VkImageMemoryBarrier2* Barrier = nullptr;
+		for (u32 i = 0; i < Batch->NumImageBarriers; i++)
+		{
+			if (Batch->ImageBarriers[i].image == Image)
+			{
+				Barrier = Batch->ImageBarriers + i;
+			}
+		}
+
+		if (Barrier)
+		{
+			// Nothing's been recorded since that barrier, so just retarget it rather than adding a second one
+			if (Barrier->newLayout == Wanted.Layout)
+			{
+				Barrier->dstStageMask |= Wanted.Stage;
+				Barrier->dstAccessMask |= Wanted.Access;
+			}
+			else
+			{
+				Barrier->newLayout = Wanted.Layout;
+				Barrier->dstStageMask = Wanted.Stage;
+				Barrier->dstAccessMask = Wanted.Access;
+			}
+		}
+		else
+		{
+			if (Batch->NumImageBarriers == MAX_BATCHED_BARRIERS)
+			{
+				FlushBarriers(Batch);
+			}
+			Barrier = Batch->ImageBarriers + Batch->NumImageBarriers++;
+			*Barrier =
+			{
+				.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+				.srcStageMask = Current->Stage,
+				// NOTE: Only writes need making available, read accesses in the source scope do nothing
+				.srcAccessMask = Current->Access & WRITE_ACCESS_MASK,
+				.dstStageMask = Wanted.Stage,
+				.dstAccessMask = Wanted.Access,
+				.oldLayout = DiscardContents ? VK_IMAGE_LAYOUT_UNDEFINED : Current->Layout,
+				.newLayout = Wanted.Layout,
+				.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.image = Image,
+				.subresourceRange
+				{
+					.aspectMask = Aspect,
+					.baseMipLevel = 0,
+					.levelCount = VK_REMAINING_MIP_LEVELS,
+					.baseArrayLayer = 0,
+					.layerCount = VK_REMAINING_ARRAY_LAYERS,
+				},
+			};
+		}
+		*Current = Wanted;
+	}
+}
+
+struct image
+{
+	VkImage Image;
+	VkImageView ImageView;
+	VkImageAspectFlags Aspect; // Everything the format has, for barriers - can be more than the view's aspect
+	image_state State;
+	gpu_allocation Allocation;
+};
+
+static void RequireImage(barrier_batch* Batch, image* Image, image_usage Usage, b32 DiscardContents)
+{
+	RequireImageState(Batch, Image->Image, Image->Aspect, &Image->State, Usage, DiscardContents);
+}
+
+struct swap_chain
+{
+	VkSwapchainKHR Handle;
+	VkImage* Images;
+	VkImageView* ImageViews;
+	VkFramebuffer* Framebuffers;
+	image_state* ImageStates;
+	u32 NumImages;
+	VkFormat Format;
+	VkExtent2D Extents;
+	VkImageUsageFlags Usage;
+	present_policy PresentPolicy; // What we actually got, which isn't necessarily what we asked for
+	b32* ImagePresented; // Whether we've presented each image yet
+	b32 HasCompletedPresent; // Once a present to this one is done, so are all the ones to the swapchains it replaced
+	image* OffscreenImages; // Only headless, where there's no Handle and we own the images (Images/ImageViews point into these)
+};
+
+static void CreateFramebuffers(memory_arena* Arena, swap_chain* Swapchain, image DepthImage, VkDevice Device, VkRenderPass RenderPass)
+{
+	Swapchain->Framebuffers = PushArray(Arena, VkFramebuffer, Swapchain->NumImages);
+	for (u32 i = 0; i < Swapchain->NumImages; i++)
+	{
+		VkImageView Attachments[] = { Swapchain->ImageViews[i], DepthImage.ImageView };
+
+		VkFramebufferCreateInfo FramebufferInfo
+		{
+			.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+			.renderPass = RenderPass,
+			.attachmentCount = ArrayCount(Attachments),
+			.pAttachments = Attachments,
+			.width = Swapchain->Extents.width,
+			.height = Swapchain->Extents.height,
+			.layers = 1,
+		};
+		if (vkCreateFramebuffer(Device, &FramebufferInfo, HostCallbacks(HostObject_Framebuffer), Swapchain->Framebuffers + i) != VK_SUCCESS)
+		{
+			fprintf(stderr, "Failed to create framebuffer number %u\n", i);
+			Assert(false);
+		}
+	}
+}
+
+static VkImageView CreateImageView(VkDevice Device, VkImage Image, VkFormat Format, VkImageAspectFlags AspectFlags)
+{
+	VkImageViewCreateInfo IvCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+		.image = Image,
+		.viewType = VK_IMAGE_VIEW_TYPE_2D,
+		.format = Format,
+		.components
+		{
+			.r = VK_COMPONENT_SWIZZLE_IDENTITY,
+			.g = VK_COMPONENT_SWIZZLE_IDENTITY,
+			.b = VK_COMPONENT_SWIZZLE_IDENTITY,
+			.a = VK_COMPONENT_SWIZZLE_IDENTITY,
+		},
+		.subresourceRange
+		{
+			.aspectMask = AspectFlags,
+			.baseMipLevel = 0,
+			.levelCount = 1,
+			.baseArrayLayer = 0,
+			.layerCount = 1,
+		},
+	};
+
+	VkImageView Result = VK_NULL_HANDLE;
+	if (vkCreateImageView(Device, &IvCreateInfo, HostCallbacks(HostObject_ImageView), &Result) != VK_SUCCESS)
+	{
+		Assert(false);
+		fprintf(stderr, "Failed to create image view...\n");
+	}
+	return Result;
+}
+
+static swap_chain CreateSwapChain(memory_arena* Arena,
+								  physical_device_deets* DeviceDeets,
+								  VkDevice LogicalDevice,
+								  GLFWwindow* Window,
+								  VkSurfaceKHR Surface,
+								  VkSwapchainKHR OldSwapchain,
+								  present_policy PresentPolicy,
+								  VkImageUsageFlags Usage)
+{
+	swap_chain Result = {};
+
+	swap_chain_deets* SwapChainDeets = &DeviceDeets->SwapChainDeets;
+	VkSurfaceFormatKHR SurfaceFormat = ChooseSwapSurfaceFormat(SwapChainDeets->Formats, SwapChainDeets->NumFormats);
+	Result.PresentPolicy = ChooseSwapPresentMode(SwapChainDeets->PresentModes, SwapChainDeets->NumPresentModes, PresentPolicy);
+	if (Result.PresentPolicy != PresentPolicy)
+	{
+		fprintf(stderr, "Present mode %s isn't supported here, falling back to %s\n", PRESENT_POLICY_NAMES[PresentPolicy],
+				PRESENT_POLICY_NAMES[Result.PresentPolicy]);
+	}
+	Result.Extents = ChooseSwapExtent(&SwapChainDeets->Capabilities, Window);
+	// Colour attachment's always supported, anything else we can live without
+	Result.Usage = Usage & SwapChainDeets->Capabilities.supportedUsageFlags;
+	if (Result.Usage != Usage)
+	{
+		fprintf(stderr, "Swapchain images don't support usage 0x%x here, going without\n", Usage & ~Result.Usage);
+	}
+
+	u32 ImageCount = SwapChainDeets->Capabilities.minImageCount + 1;
+	if (SwapChainDeets->Capabilities.maxImageCount != 0 && ImageCount > SwapChainDeets->Capabilities.maxImageCount)
+	{
+		ImageCount = SwapChainDeets->Capabilities.maxImageCount;
+	}
+
+	// TODO: Oink, oink...
+	Assert(DeviceDeets->QueueFamilyIndices.GraphicsFamily == DeviceDeets->QueueFamilyIndices.PresentFamily);
+	Assert((DeviceDeets->QueueFamilyIndices.ValidFlags & QueueFamily_Graphics) && (DeviceDeets->QueueFamilyIndices.ValidFlags & QueueFamily_Present));
+	VkSwapchainCreateInfoKHR CreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
+		.surface = Surface,
+		.minImageCount = ImageCount,
+		.imageFormat = SurfaceFormat.format,
+		.imageColorSpace = SurfaceFormat.colorSpace,
+		.imageExtent = Result.Extents,
+		.imageArrayLayers = 1, // Only > 1 if we're doing stereo 3D rendering
+		.imageUsage = Result.Usage,
+		.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.preTransform = SwapChainDeets->Capabilities.currentTransform,
+		.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR,
+		.presentMode = PRESENT_POLICY_MODES[Result.PresentPolicy],
+		.clipped = VK_TRUE, // TODO: Any case where we don't want to do any clipping?
+		// Lets the driver hand resources over from the one we're replacing, and retires it
+		.oldSwapchain = OldSwapchain,
+	};
+	Result.Format = SurfaceFormat.format;
+
+	if (vkCreateSwapchainKHR(LogicalDevice, &CreateInfo, HostCallbacks(HostObject_Swapchain), &Result.Handle) == VK_SUCCESS)
+	{
+		vkGetSwapchainImagesKHR(LogicalDevice, Result.Handle, &Result.NumImages, nullptr);
+		Result.Images = PushArray(Arena, VkImage, Result.NumImages);
+		vkGetSwapchainImagesKHR(LogicalDevice, Result.Handle, &Result.NumImages, Result.Images);
+		Result.ImageViews = PushArray(Arena, VkImageView, Result.NumImages);
+		Result.ImageStates = PushArray(Arena, image_state, Result.NumImages);
+		Result.ImagePresented = PushArray(Arena, b32, Result.NumImages);
+		for (u32 i = 0; i < Result.NumImages; i++)
+		{
+			Result.ImageViews[i] = CreateImageView(LogicalDevice, Result.Images[i], Result.Format, VK_IMAGE_ASPECT_COLOR_BIT);
+			Result.ImageStates[i] = {};
+			Result.ImagePresented[i] = false;
+		}
+	}
+	else
+	{
+		Assert(false);
+		fprintf(stderr, "Failed to create swap chain, my dude\n");
+	}
+	return Result;
+}
+
+static VkFormat FindSupportedFormat(VkFormat* Candidates, u32 NumCandidates, VkImageTiling Tiling, VkFormatFeatureFlags FeatureFlags, VkPhysicalDevice PhysicalDevice)
+{
+	VkFormat Result = VK_FORMAT_UNDEFINED;
+	for (u32 i = 0; i < NumCandidates; i++)
+	{
+		VkFormat Format = Candidates[i];
+
+		VkFormatProperties Props;
+		vkGetPhysicalDeviceFormatProperties(PhysicalDevice, Format, &Props);
+
+		if (Tiling == VK_IMAGE_TILING_LINEAR && (Props.linearTilingFeatures & FeatureFlags) == FeatureFlags)
+		{
+			Result = Format;
+			break;
+		}
+		else if (Tiling == VK_IMAGE_TILING_OPTIMAL && (Props.optimalTilingFeatures & FeatureFlags) == FeatureFlags)
+		{
 			Result = Format;
 			break;
 		}
-		else if (Tiling == VK_IMAGE_TILING_OPTIMAL && (Props.optimalTilingFeatures & FeatureFlags) == FeatureFlags)
+	}
+	if (Result == VK_FORMAT_UNDEFINED)
+	{
+		fprintf(stderr, "Sorry couldn't find supported format\n");
+		Assert(false);
+	}
+	return Result;
+}
+
+static VkFormat FindDepthFormat(VkPhysicalDevice PhysicalDevice)
+{
+	VkFormat CandidateFormats[] = { VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT };
+	VkFormat Result = FindSupportedFormat(CandidateFormats, ArrayCount(CandidateFormats),
+										  VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT, PhysicalDevice);
+	return Result;
+}
+
+// What pipelines and secondary command buffers need to know about the attachments when there's no render pass
+struct rendering_formats
+{
+	VkFormat Colour;
+	VkFormat Depth;
+	VkFormat Stencil; // VK_FORMAT_UNDEFINED if the depth format hasn't got stencil
+};
+
+static rendering_formats GetRenderingFormats(VkPhysicalDevice PhysicalDevice, swap_chain* Swapchain)
+{
+	rendering_formats Result
+	{
+		.Colour = Swapchain->Format,
+		.Depth = FindDepthFormat(PhysicalDevice),
+	};
+	Result.Stencil = Result.Depth == VK_FORMAT_D32_SFLOAT ? VK_FORMAT_UNDEFINED : Result.Depth;
+	return Result;
+}
+
+// NOTE: Only for the --render-pass path, by default we use dynamic rendering and there's no render pass at all
+static VkRenderPass CreateRenderPass(VkDevice Device, VkPhysicalDevice PhysicalDevice, swap_chain* Swapchain)
+{
+	VkAttachmentDescription ColourAttachment
+	{
+		.format = Swapchain->Format,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+		.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+		.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+		.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+		// NOTE: Layout transitions happen outside the render pass, see RecordCommandBuffer
+		.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+		.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+	};
+	VkAttachmentReference ColourAttachmentRef
+	{
+		.attachment = 0, // NOTE: This is the index of 'layout(location = 0)' in the fragment shader
+		.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+	};
+
+	VkAttachmentDescription DepthAttachment
+	{
+		.format = FindDepthFormat(PhysicalDevice),
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+		.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+		.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+		.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+		.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+	};
+	VkAttachmentReference DepthAttachmentRef
+	{
+		.attachment = 1,
+		.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+	};
+
+	VkSubpassDescription Subpass
+	{
+		.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+		.colorAttachmentCount = 1,
+		.pColorAttachments = &ColourAttachmentRef,
+		.pDepthStencilAttachment = &DepthAttachmentRef,
+	};
+
+	// NOTE: No subpass dependencies - the barriers recorded around the render pass (from the images' tracked state)
+	// take care of everything, and the attachments never change layout inside it
+	VkAttachmentDescription Attachments[] = { ColourAttachment, DepthAttachment };
+	VkRenderPassCreateInfo RenderPassInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+		.attachmentCount = ArrayCount(Attachments),
+		.pAttachments = Attachments,
+		.subpassCount = 1,
+		.pSubpasses = &Subpass,
+	};
+
+	VkRenderPass Result = VK_NULL_HANDLE;
+	if (vkCreateRenderPass(Device, &RenderPassInfo, HostCallbacks(HostObject_RenderPass), &Result) != VK_SUCCESS)
+	{
+		fprintf(stderr, "Couldn't make that render pass, my dude\n");
+		Assert(false);
+	}
+	return Result;
+}
+
+static VkDescriptorSetLayout CreateDescriptorSetLayout(VkDevice Device)
+{
+	VkDescriptorSetLayoutBinding UboLayoutBinding
+	{
+		.binding = 0,
+		.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+		.descriptorCount = 1,
+		.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+	};
+	VkDescriptorSetLayoutBinding SamplerLayoutBinding
+	{
+		.binding = 1,
+		.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+		.descriptorCount = 1,
+		.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+	};
+	VkDescriptorSetLayoutBinding Bindings[] = { UboLayoutBinding, SamplerLayoutBinding };
+
+	VkDescriptorSetLayoutCreateInfo LayoutInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+		.bindingCount = ArrayCount(Bindings),
+		.pBindings = Bindings,
+	};
+
+	VkDescriptorSetLayout Result = VK_NULL_HANDLE;
+	if (vkCreateDescriptorSetLayout(Device, &LayoutInfo, HostCallbacks(HostObject_DescriptorSetLayout), &Result) != VK_SUCCESS)
+	{
+		fprintf(stderr, "Failed to create desc set layout\n");
+		Assert(false);
+	}
+	return Result;
+}
+
+// NOTE: Pipeline cache, persisted between runs so we only pay full driver compilation the first time
+static constexpr const char* PIPELINE_CACHE_FILE_NAME = "pipeline_cache.bin";
+
+// Drivers are meant to reject data from another device/driver themselves, but not all of them do it gracefully, so
+// check the header ourselves before handing anything over
+static b32 IsPipelineCacheDataValid(VkPhysicalDevice PhysicalDevice, file_buffer Data)
+{
+	b32 Result = false;
+	VkPipelineCacheHeaderVersionOne Header;
+	if (Data.Contents && Data.Size >= sizeof(Header))
+	{
+		memcpy(&Header, Data.Contents, sizeof(Header));
+		VkPhysicalDeviceProperties Props;
+		vkGetPhysicalDeviceProperties(PhysicalDevice, &Props);
+		Result = Header.headerSize >= sizeof(Header) && Header.headerSize <= Data.Size &&
+				 Header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+				 Header.vendorID == Props.vendorID &&
+				 Header.deviceID == Props.deviceID &&
+				 memcmp(Header.pipelineCacheUUID, Props.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+	}
+	return Result;
+}
+
+// Starts empty if InitialData is empty or was written by a different device/driver
+static VkPipelineCache CreatePipelineCache(VkDevice Device, VkPhysicalDevice PhysicalDevice, file_buffer InitialData)
+{
+	b32 Valid = IsPipelineCacheDataValid(PhysicalDevice, InitialData);
+	VkPipelineCacheCreateInfo CreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+		.initialDataSize = Valid ? InitialData.Size : 0,
+		.pInitialData = Valid ? InitialData.Contents : nullptr,
+	};
+	VkPipelineCache Result = VK_NULL_HANDLE;
+	if (vkCreatePipelineCache(Device, &CreateInfo, HostCallbacks(HostObject_PipelineCache), &Result) != VK_SUCCESS)
+	{
+		fprintf(stderr, "Couldn't create a pipeline cache\n");
+		Assert(false);
+	}
+	return Result;
+}
+
+// Merges in whatever's on disk now (another instance may have written it since we loaded), then writes the lot back
+static void SavePipelineCache(VkDevice Device, VkPhysicalDevice PhysicalDevice, VkPipelineCache Cache, memory_arena* Scratch, const char* FileName)
+{
+	temp_memory Temp = BeginTempMemory(Scratch);
+	file_buffer OnDisk = TryLoadFile(Scratch, FileName);
+	if (IsPipelineCacheDataValid(PhysicalDevice, OnDisk))
+	{
+		VkPipelineCache DiskCache = CreatePipelineCache(Device, PhysicalDevice, OnDisk);
+		vkMergePipelineCaches(Device, Cache, 1, &DiskCache);
+		vkDestroyPipelineCache(Device, DiskCache, HostCallbacks(HostObject_PipelineCache));
+	}
+	// NOTE: Has to go before we write over it
+	UnloadFile(&OnDisk);
+
+	size_t DataSize = 0;
+	vkGetPipelineCacheData(Device, Cache, &DataSize, nullptr);
+	void* Data = PushArray(Scratch, u8, DataSize);
+	if (DataSize && vkGetPipelineCacheData(Device, Cache, &DataSize, Data) == VK_SUCCESS &&
+		SaveFileAtomically(Scratch, FileName, Data, (u32)DataSize))
+	{
+		printf("Saved %.1f KB of pipeline cache to '%s'\n", DataSize / 1024.0, FileName);
+	}
+	EndTempMemory(Temp);
+}
+
+// NOTE: Everything that can differ between our pipelines. The whole struct gets hashed, so zero it before filling it in
+// (designated initialisers do that) and keep it free of padding.
+struct pipeline_state
+{
+	VkPrimitiveTopology Topology;
+	VkCullModeFlags CullMode;
+	VkFrontFace FrontFace;
+	b32 DepthTest;
+	b32 DepthWrite;
+	VkCompareOp DepthCompare;
+	b32 AlphaBlend;
+};
+
+static constexpr pipeline_state DEFAULT_PIPELINE_STATE
+{
+	.Topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+	.CullMode = VK_CULL_MODE_BACK_BIT,
+	.FrontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE, // Temp change because of y-coord flip in proj. matrix??
+	.DepthTest = true,
+	.DepthWrite = true,
+	.DepthCompare = VK_COMPARE_OP_LESS,
+	.AlphaBlend = true,
+};
+
+static VkPipelineLayout CreatePipelineLayout(VkDevice Device, VkDescriptorSetLayout DescSetLayout)
+{
+	VkPipelineLayoutCreateInfo LayoutCreateInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+		.setLayoutCount = 1,
+		.pSetLayouts = &DescSetLayout,
+	};
+	VkPipelineLayout Result = VK_NULL_HANDLE;
+	if (vkCreatePipelineLayout(Device, &LayoutCreateInfo, HostCallbacks(HostObject_PipelineLayout), &Result) != VK_SUCCESS)
+	{
+		fprintf(stderr, "Couldn't create that pipeline layout\n");
+		Assert(false);
+	}
+	return Result;
+}
+
+// All the create infos for one pipeline_state, shared between monolithic pipelines and the pipeline library parts.
+// Points into itself, so fill it in place and don't copy it.
+struct pipeline_create_infos
+{
+	VkPipelineShaderStageCreateInfo VertShaderStage;
+	VkPipelineShaderStageCreateInfo FragShaderStage;
+	VkPipelineDynamicStateCreateInfo DynamicState;
+	VkVertexInputBindingDescription BindingDesc;
+	vertex::attr_desc AttrDesc;
+	VkPipelineVertexInputStateCreateInfo VertexInput;
+	VkPipelineInputAssemblyStateCreateInfo InputAssembly;
+	VkPipelineViewportStateCreateInfo ViewportState;
+	VkPipelineRasterizationStateCreateInfo Rasteriser;
+	VkPipelineMultisampleStateCreateInfo Multisampling;
+	VkPipelineColorBlendAttachmentState ColourBlendAttachment;
+	VkPipelineDepthStencilStateCreateInfo DepthStencil;
+	VkPipelineColorBlendStateCreateInfo ColourBlend;
+	VkPipelineRenderingCreateInfo Rendering; // Chained in when there's no render pass
+};
+
+static constexpr VkDynamicState PIPELINE_DYNAMIC_STATES[] =  { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+static void FillPipelineCreateInfos(pipeline_create_infos* Infos, const pipeline_state* State, const rendering_formats* Formats,
+									VkShaderModule VertShaderModule, VkShaderModule FragShaderModule)
+{
+	Infos->VertShaderStage =
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+		.stage = VK_SHADER_STAGE_VERTEX_BIT,
+		.module = VertShaderModule,
+		.pName = "main",
+	};
+	Infos->FragShaderStage =
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+		.stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+		.module = FragShaderModule,
+		.pName = "main",
+	};
+
+	Infos->DynamicState =
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+		.dynamicStateCount = ArrayCount(PIPELINE_DYNAMIC_STATES),
+		.pDynamicStates = PIPELINE_DYNAMIC_STATES,
+	};
+
+	Infos->BindingDesc = vertex::GetBindingDescription();
+	Infos->AttrDesc = vertex::GetAttributeDescriptions();
+	Infos->VertexInput =
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+		.vertexBindingDescriptionCount = 1,
+		.pVertexBindingDescriptions = &Infos->BindingDesc,
+		.vertexAttributeDescriptionCount = Infos->AttrDesc.Size,
+		.pVertexAttributeDescriptions = Infos->AttrDesc.Data,
+	};
+
+	Infos->InputAssembly =
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+		.topology = State->Topology,
+	};
+
+	Infos->ViewportState =
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+		.viewportCount = 1,
+		.scissorCount = 1,
+	};
+
+	Infos->Rasteriser =
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+		.polygonMode = VK_POLYGON_MODE_FILL,
+		.cullMode = State->CullMode,
+		.frontFace = State->FrontFace,
+		.lineWidth = 1.0f, // TODO: I'm not drawing any lines, do I need this??
+	};
+
+	Infos->Multisampling =
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+		.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+		.sampleShadingEnable = VK_FALSE,
+		.minSampleShading = 1.0f,
+	};
+
+	// TODO: This sets basic bitch alpha blending - is this actually what we want?
+	Infos->ColourBlendAttachment =
+	{
+		.blendEnable = State->AlphaBlend ? VK_TRUE : VK_FALSE,
+		.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
+		.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+		.colorBlendOp = VK_BLEND_OP_ADD,
+		.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+		.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO, // TODO: Is this right?? We're not taking the dest alpha into account at all??
+		.alphaBlendOp = VK_BLEND_OP_ADD,
+		.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
+	};
+
+	Infos->DepthStencil =
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+		.depthTestEnable = State->DepthTest ? VK_TRUE : VK_FALSE,
+		.depthWriteEnable = State->DepthWrite ? VK_TRUE : VK_FALSE,
+		.depthCompareOp = State->DepthCompare,
+		.depthBoundsTestEnable = VK_FALSE,
+		.stencilTestEnable = VK_FALSE,
+	};
+
+	Infos->ColourBlend =
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+		.logicOpEnable = VK_FALSE,
+		.attachmentCount = 1,
+		.pAttachments = &Infos->ColourBlendAttachment,
+	};
+
+	Infos->Rendering =
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
+		.colorAttachmentCount = 1,
+		.pColorAttachmentFormats = &Formats->Colour,
+		.depthAttachmentFormat = Formats->Depth,
+		.stencilAttachmentFormat = Formats->Stencil,
+	};
+}
+
+// The monolithic path, for devices without VK_EXT_graphics_pipeline_library. RenderPass is VK_NULL_HANDLE for dynamic
+// rendering, in which case Formats has to match what we render to.
+static VkPipeline CreateGraphicsPipeline(VkDevice Device, VkPipelineCache Cache, VkRenderPass RenderPass, const rendering_formats* Formats,
+										 VkPipelineLayout Layout, const pipeline_state* State,
+										 VkShaderModule VertShaderModule, VkShaderModule FragShaderModule)
+{
+	pipeline_create_infos Infos;
+	FillPipelineCreateInfos(&Infos, State, Formats, VertShaderModule, FragShaderModule);
+	VkPipelineShaderStageCreateInfo ShaderStages[] = { Infos.VertShaderStage, Infos.FragShaderStage };
+
+	VkGraphicsPipelineCreateInfo PipelineInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+		.pNext = RenderPass ? nullptr : &Infos.Rendering,
+		.stageCount = ArrayCount(ShaderStages),
+		.pStages = ShaderStages,
+		.pVertexInputState = &Infos.VertexInput,
+		.pInputAssemblyState = &Infos.InputAssembly,
+		.pViewportState = &Infos.ViewportState,
+		.pRasterizationState = &Infos.Rasteriser,
+		.pMultisampleState = &Infos.Multisampling,
+		.pDepthStencilState = &Infos.DepthStencil,
+		.pColorBlendState = &Infos.ColourBlend,
+		.pDynamicState = &Infos.DynamicState,
+		.layout = Layout,
+		.renderPass = RenderPass,
+		.subpass = 0,
+	};
+	VkPipeline Result = VK_NULL_HANDLE;
+	if (vkCreateGraphicsPipelines(Device, Cache, 1, &PipelineInfo, HostCallbacks(HostObject_Pipeline), &Result) != VK_SUCCESS)
+	{
+		fprintf(stderr, "Failed to create graphics pipeline\n");
+		Assert(false);
+	}
+	return Result;
+}
+
+// NOTE: With VK_EXT_graphics_pipeline_library a pipeline gets built from four separately compiled parts, each only
+// depending on some of the pipeline_state. Parts get shared between every pipeline that needs them, so a new
+// combination is just a (fast) link of parts we've probably already got.
+enum pipeline_library_part
+{
+	PipelineLibraryPart_VertexInput,
+	PipelineLibraryPart_PreRasterisation,
+	PipelineLibraryPart_FragmentShader,
+	PipelineLibraryPart_FragmentOutput,
+
+	PipelineLibraryPart_Count,
+};
+
+static constexpr VkGraphicsPipelineLibraryFlagsEXT PIPELINE_LIBRARY_PART_FLAGS[PipelineLibraryPart_Count] =
+{
+	VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT,
+	VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT,
+	VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT,
+	VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT,
+};
+
+// Just the bits of State that Part depends on, everything else zeroed, so two states that share a part have the same key
+static pipeline_state GetPipelineLibraryPartKey(pipeline_library_part Part, const pipeline_state* State)
+{
+	pipeline_state Result = {};
+	switch (Part)
+	{
+		case PipelineLibraryPart_VertexInput:
+		{
+			Result.Topology = State->Topology;
+		} break;
+		case PipelineLibraryPart_PreRasterisation:
+		{
+			Result.CullMode = State->CullMode;
+			Result.FrontFace = State->FrontFace;
+		} break;
+		case PipelineLibraryPart_FragmentShader:
+		{
+			Result.DepthTest = State->DepthTest;
+			Result.DepthWrite = State->DepthWrite;
+			Result.DepthCompare = State->DepthCompare;
+		} break;
+		case PipelineLibraryPart_FragmentOutput:
+		{
+			Result.AlphaBlend = State->AlphaBlend;
+		} break;
+		default:
+		{
+			Assert(false);
+		} break;
+	}
+	return Result;
+}
+
+static VkPipeline CreatePipelineLibraryPart(VkDevice Device, VkPipelineCache Cache, VkRenderPass RenderPass, const rendering_formats* Formats,
+											VkPipelineLayout Layout, pipeline_library_part Part, const pipeline_state* Key,
+											VkShaderModule VertShaderModule, VkShaderModule FragShaderModule)
+{
+	pipeline_create_infos Infos;
+	FillPipelineCreateInfos(&Infos, Key, Formats, VertShaderModule, FragShaderModule);
+
+	VkGraphicsPipelineLibraryCreateInfoEXT LibraryInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT,
+		.pNext = RenderPass ? nullptr : &Infos.Rendering,
+		.flags = PIPELINE_LIBRARY_PART_FLAGS[Part],
+	};
+	// NOTE: Keeping the link-time optimisation info is what lets the background link produce a properly optimised pipeline
+	VkGraphicsPipelineCreateInfo PipelineInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+		.pNext = &LibraryInfo,
+		.flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR | VK_PIPELINE_CREATE_RETAIN_LINK_TIME_OPTIMIZATION_INFO_BIT_EXT,
+	};
+	switch (Part)
+	{
+		case PipelineLibraryPart_VertexInput:
+		{
+			PipelineInfo.pVertexInputState = &Infos.VertexInput;
+			PipelineInfo.pInputAssemblyState = &Infos.InputAssembly;
+		} break;
+		case PipelineLibraryPart_PreRasterisation:
+		{
+			PipelineInfo.stageCount = 1;
+			PipelineInfo.pStages = &Infos.VertShaderStage;
+			PipelineInfo.pViewportState = &Infos.ViewportState;
+			PipelineInfo.pRasterizationState = &Infos.Rasteriser;
+			PipelineInfo.pDynamicState = &Infos.DynamicState;
+			PipelineInfo.layout = Layout;
+			PipelineInfo.renderPass = RenderPass;
+		} break;
+		case PipelineLibraryPart_FragmentShader:
+		{
+			PipelineInfo.stageCount = 1;
+			PipelineInfo.pStages = &Infos.FragShaderStage;
+			PipelineInfo.pMultisampleState = &Infos.Multisampling;
+			PipelineInfo.pDepthStencilState = &Infos.DepthStencil;
+			PipelineInfo.layout = Layout;
+			PipelineInfo.renderPass = RenderPass;
+		} break;
+		case PipelineLibraryPart_FragmentOutput:
+		{
+			PipelineInfo.pMultisampleState = &Infos.Multisampling;
+			PipelineInfo.pColorBlendState = &Infos.ColourBlend;
+			PipelineInfo.renderPass = RenderPass;
+		} break;
+		default:
+		{
+			Assert(false);
+		} break;
+	}
+
+	VkPipeline Result = VK_NULL_HANDLE;
+	if (vkCreateGraphicsPipelines(Device, Cache, 1, &PipelineInfo, HostCallbacks(HostObject_Pipeline), &Result) != VK_SUCCESS)
+	{
+		fprintf(stderr, "Failed to create pipeline library part %u\n", Part);
+		Assert(false);
+	}
+	return Result;
+}
+
+// Without Optimise this is the fast link, which is meant to be cheap enough to do whenever; Optimise does the proper
+// link-time optimisation and takes about as long as a monolithic pipeline would
+static VkPipeline LinkPipelineLibraries(VkDevice Device, VkPipelineCache Cache, VkPipelineLayout Layout,
+										const VkPipeline* Parts, b32 Optimise)
+{
+	VkPipelineLibraryCreateInfoKHR LibraryInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR,
+		.libraryCount = PipelineLibraryPart_Count,
+		.pLibraries = Parts,
+	};
+	VkGraphicsPipelineCreateInfo PipelineInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+		.pNext = &LibraryInfo,
+		.flags = Optimise ? (VkPipelineCreateFlags)VK_PIPELINE_CREATE_LINK_TIME_OPTIMIZATION_BIT_EXT : 0,
+		.layout = Layout,
+	};
+	VkPipeline Result = VK_NULL_HANDLE;
+	if (vkCreateGraphicsPipelines(Device, Cache, 1, &PipelineInfo, HostCallbacks(HostObject_Pipeline), &Result) != VK_SUCCESS)
+	{
+		fprintf(stderr, "Failed to link pipeline libraries\n");
+		Assert(false);
+	}
+	return Result;
+}
+
+// NOTE: Pipeline registry. Pipelines are looked up by a hash of their pipeline_state; anything we haven't seen before gets
+// compiled as a job, and the renderer draws with a fallback (or skips the draw) until it's ready, so a new permutation
+// never stalls a frame. With pipeline libraries, "compiled" means fast-linked, and the optimised link follows on as
+// another job and gets swapped in when it's done.
+static constexpr u32 MAX_PIPELINES = 256; // Power of two, it's an open-addressed table
+static constexpr u32 MAX_PIPELINE_LIBRARY_PARTS = 64; // Of each kind
+static constexpr u32 INVALID_PIPELINE = 0xFFFFFFFF;
+
+enum pipeline_status
+{
+	PipelineStatus_Empty,
+	PipelineStatus_Compiling,
+	PipelineStatus_Ready,
+};
+
+struct pipeline_entry
+{
+	u64 Hash;
+	pipeline_state State;
+	std::atomic<u32> Status;
+	std::atomic<VkPipeline> Handle; // Only safe to use once Status is Ready. Changes when the optimised link lands.
+	VkPipeline FastLinkedHandle; // Replaced by the optimised one, but command buffers in flight may still use it
+	VkPipeline Parts[PipelineLibraryPart_Count];
+	f64 CompileSeconds; // Until it was usable
+	f64 OptimiseSeconds;
+	job_counter Compiled;
+	job_counter Optimised;
+};
+
+struct pipeline_library_entry
+{
+	pipeline_state Key; // See GetPipelineLibraryPartKey
+	VkPipeline Handle;
+	job_counter Built;
+};
+
+struct pipeline_registry
+{
+	VkDevice Device;
+	VkPipelineCache Cache;
+	VkRenderPass RenderPass; // VK_NULL_HANDLE with dynamic rendering
+	rendering_formats Formats;
+	VkPipelineLayout Layout; // Shared, every pipeline takes the same descriptor sets
+	VkShaderModule VertShaderModule;
+	VkShaderModule FragShaderModule;
+	b32 UsePipelineLibraries;
+
+	std::mutex Mutex; // Only for adding entries, GetPipeline doesn't take it
+	pipeline_entry Entries[MAX_PIPELINES];
+	u32 NumEntries;
+	pipeline_library_entry LibraryParts[PipelineLibraryPart_Count][MAX_PIPELINE_LIBRARY_PARTS];
+	u32 NumLibraryParts[PipelineLibraryPart_Count];
+	std::atomic<u32> NumReady;
+	std::atomic<u32> Version; // Goes up whenever any pipeline handle changes, so recorded command buffers know they're stale
+};
+
+static pipeline_registry s_Pipelines;
+
+// FNV-1a
+static u64 HashPipelineState(const pipeline_state* State)
+{
+	u64 Result = 14695981039346656037ull;
+	const u8* Bytes = (const u8*)State;
+	for (size_t i = 0; i < sizeof(pipeline_state); i++)
+	{
+		Result = (Result ^ Bytes[i]) * 1099511628211ull;
+	}
+	return Result;
+}
+
+// Takes ownership of the shader modules
+static void InitPipelineRegistry(VkDevice Device, VkPipelineCache Cache, VkRenderPass RenderPass, rendering_formats Formats,
+								 VkDescriptorSetLayout DescSetLayout, VkShaderModule VertShaderModule, VkShaderModule FragShaderModule,
+								 b32 UsePipelineLibraries)
+{
+	pipeline_registry* Registry = &s_Pipelines;
+	Registry->UsePipelineLibraries = UsePipelineLibraries;
+	Registry->Device = Device;
+	Registry->Cache = Cache;
+	Registry->RenderPass = RenderPass;
+	Registry->Formats = Formats;
+	Registry->Layout = CreatePipelineLayout(Device, DescSetLayout);
+	Registry->VertShaderModule = VertShaderModule;
+	Registry->FragShaderModule = FragShaderModule;
+}
+
+// Finds the part State needs, building it if nobody has yet. If someone else is building it, waits for them.
+static VkPipeline GetPipelineLibraryPart(pipeline_library_part Part, const pipeline_state* State)
+{
+	pipeline_registry* Registry = &s_Pipelines;
+	pipeline_state Key = GetPipelineLibraryPartKey(Part, State);
+
+	pipeline_library_entry* Entry = nullptr;
+	b32 NeedsBuilding = false;
+	{
+		std::lock_guard<std::mutex> Lock(Registry->Mutex);
+		for (u32 i = 0; i < Registry->NumLibraryParts[Part] && !Entry; i++)
+		{
+			if (memcmp(&Registry->LibraryParts[Part][i].Key, &Key, sizeof(pipeline_state)) == 0)
+			{
+				Entry = Registry->LibraryParts[Part] + i;
+			}
+		}
+		if (!Entry)
+		{
+			if (Registry->NumLibraryParts[Part] == MAX_PIPELINE_LIBRARY_PARTS)
+			{
+				fprintf(stderr, "Out of pipeline library parts, bump MAX_PIPELINE_LIBRARY_PARTS\n");
+				Assert(false);
+			}
+			Entry = Registry->LibraryParts[Part] + Registry->NumLibraryParts[Part]++;
+			Entry->Key = Key;
+			Entry->Built.Remaining.store(1, std::memory_order_relaxed);
+			NeedsBuilding = true;
+		}
+	}
+
+	if (NeedsBuilding)
+	{
+		Entry->Handle = CreatePipelineLibraryPart(Registry->Device, Registry->Cache, Registry->RenderPass, &Registry->Formats,
+												  Registry->Layout, Part, &Key, Registry->VertShaderModule, Registry->FragShaderModule);
+		Entry->Built.Remaining.store(0, std::memory_order_release);
+	}
+	else
+	{
+		WaitForCounter(&Entry->Built);
+	}
+	return Entry->Handle;
+}
+
+// job_func, UserData is the pipeline_entry
+static void OptimisePipelineJob(void* UserData, u32 Index)
+{
+	pipeline_registry* Registry = &s_Pipelines;
+	pipeline_entry* Entry = (pipeline_entry*)UserData;
+	std::chrono::time_point Start = std::chrono::high_resolution_clock::now();
+	VkPipeline Optimised = LinkPipelineLibraries(Registry->Device, Registry->Cache, Registry->Layout, Entry->Parts, true);
+	Entry->OptimiseSeconds = std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - Start).count();
+	Entry->FastLinkedHandle = Entry->Handle.exchange(Optimised, std::memory_order_acq_rel);
+	Registry->Version.fetch_add(1, std::memory_order_release);
+}
+
+// job_func, UserData is the pipeline_entry
+static void CompilePipelineJob(void* UserData, u32 Index)
+{
+	pipeline_registry* Registry = &s_Pipelines;
+	pipeline_entry* Entry = (pipeline_entry*)UserData;
+	std::chrono::time_point Start = std::chrono::high_resolution_clock::now();
+	if (Registry->UsePipelineLibraries)
+	{
+		for (u32 Part = 0; Part < PipelineLibraryPart_Count; Part++)
+		{
+			Entry->Parts[Part] = GetPipelineLibraryPart((pipeline_library_part)Part, &Entry->State);
+		}
+		Entry->Handle.store(LinkPipelineLibraries(Registry->Device, Registry->Cache, Registry->Layout, Entry->Parts, false),
+							std::memory_order_relaxed);
+	}
+	else
+	{
+		Entry->Handle.store(CreateGraphicsPipeline(Registry->Device, Registry->Cache, Registry->RenderPass, &Registry->Formats,
+												   Registry->Layout, &Entry->State, Registry->VertShaderModule, Registry->FragShaderModule),
+							std::memory_order_relaxed);
+	}
+	Entry->CompileSeconds = std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - Start).count();
+	Entry->Status.store(PipelineStatus_Ready, std::memory_order_release);
+	Registry->NumReady.fetch_add(1, std::memory_order_release);
+	Registry->Version.fetch_add(1, std::memory_order_release);
+
+	if (Registry->UsePipelineLibraries)
+	{
+		KickJob(OptimisePipelineJob, Entry, &Entry->Optimised);
+	}
+}
+
+// Never blocks on compilation: returns straight away with an index for GetPipeline, kicking off a compile job if this
+// is a state we haven't asked for before
+static u32 RequestPipeline(const pipeline_state* State)
+{
+	pipeline_registry* Registry = &s_Pipelines;
+	u64 Hash = HashPipelineState(State);
+
+	u32 Result = INVALID_PIPELINE;
+	pipeline_entry* NewEntry = nullptr;
+	{
+		std::lock_guard<std::mutex> Lock(Registry->Mutex);
+		for (u32 Probe = 0; Probe < MAX_PIPELINES; Probe++)
+		{
+			u32 Index = (u32)(Hash + Probe) & (MAX_PIPELINES - 1);
+			pipeline_entry* Entry = Registry->Entries + Index;
+			if (Entry->Status.load(std::memory_order_relaxed) == PipelineStatus_Empty)
+			{
+				// Claimed as Compiling, so nobody else kicks off a second compile for it once we let go of the lock
+				Entry->Hash = Hash;
+				Entry->State = *State;
+				Entry->Status.store(PipelineStatus_Compiling, std::memory_order_relaxed);
+				Registry->NumEntries++;
+				NewEntry = Entry;
+				Result = Index;
+				break;
+			}
+			else if (Entry->Hash == Hash && memcmp(&Entry->State, State, sizeof(pipeline_state)) == 0)
+			{
+				Result = Index;
+				break;
+			}
+		}
+	}
+	// NOTE: Outside the lock - KickJob runs the job right here if this thread's deque is full, and the compile takes
+	// the registry lock itself (for the library parts), besides holding up every other RequestPipeline while it runs
+	if (NewEntry)
+	{
+		KickJob(CompilePipelineJob, NewEntry, &NewEntry->Compiled);
+	}
+	if (Result == INVALID_PIPELINE)
+	{
+		fprintf(stderr, "Pipeline registry's full, bump MAX_PIPELINES\n");
+		Assert(false);
+	}
+	return Result;
+}
+
+// VK_NULL_HANDLE if it's still compiling
+static VkPipeline GetPipeline(u32 Index)
+{
+	VkPipeline Result = VK_NULL_HANDLE;
+	if (Index != INVALID_PIPELINE)
+	{
+		pipeline_entry* Entry = s_Pipelines.Entries + Index;
+		if (Entry->Status.load(std::memory_order_acquire) == PipelineStatus_Ready)
+		{
+			Result = Entry->Handle.load(std::memory_order_acquire);
+		}
+	}
+	return Result;
+}
+
+// Only for things that really can't go on without it, like the fallback pipeline at startup
+static void WaitForPipeline(u32 Index)
+{
+	WaitForCounter(&s_Pipelines.Entries[Index].Compiled);
+}
+
+static void PrintPipelineStats()
+{
+	pipeline_registry* Registry = &s_Pipelines;
+	f64 TotalSeconds = 0.0;
+	f64 MaxSeconds = 0.0;
+	f64 TotalOptimiseSeconds = 0.0;
+	u32 NumOptimised = 0;
+	for (u32 i = 0; i < MAX_PIPELINES; i++)
+	{
+		pipeline_entry* Entry = Registry->Entries + i;
+		if (Entry->Status.load(std::memory_order_acquire) == PipelineStatus_Ready)
+		{
+			TotalSeconds += Entry->CompileSeconds;
+			if (Entry->CompileSeconds > MaxSeconds)
+			{
+				MaxSeconds = Entry->CompileSeconds;
+			}
+			if (Entry->Optimised.Remaining.load(std::memory_order_acquire) == 0 && Entry->FastLinkedHandle)
+			{
+				TotalOptimiseSeconds += Entry->OptimiseSeconds;
+				NumOptimised++;
+			}
+		}
+	}
+	u32 NumReady = Registry->NumReady;
+	printf("Pipelines (%s): %u usable (of %u requested), %.2f ms average until usable, %.2f ms worst\n",
+		   Registry->UsePipelineLibraries ? "libraries" : "monolithic", NumReady, Registry->NumEntries,
+		   NumReady ? TotalSeconds * 1000.0 / NumReady : 0.0, MaxSeconds * 1000.0);
+	if (Registry->UsePipelineLibraries)
+	{
+		printf("\t%u optimised links, %.2f ms average. Library parts: %u vertex input, %u pre-rasterisation, %u fragment shader, %u fragment output\n",
+			   NumOptimised, NumOptimised ? TotalOptimiseSeconds * 1000.0 / NumOptimised : 0.0,
+			   Registry->NumLibraryParts[PipelineLibraryPart_VertexInput], Registry->NumLibraryParts[PipelineLibraryPart_PreRasterisation],
+			   Registry->NumLibraryParts[PipelineLibraryPart_FragmentShader], Registry->NumLibraryParts[PipelineLibraryPart_FragmentOutput]);
+	}
+}
+
+// Waits for anything still compiling, so call it before shutting the job system down
+static void DestroyPipelineRegistry()
+{
+	pipeline_registry* Registry = &s_Pipelines;
+	for (u32 i = 0; i < MAX_PIPELINES; i++)
+	{
+		pipeline_entry* Entry = Registry->Entries + i;
+		if (Entry->Status.load(std::memory_order_relaxed) != PipelineStatus_Empty)
+		{
+			WaitForCounter(&Entry->Compiled);
+			WaitForCounter(&Entry->Optimised);
+			vkDestroyPipeline(Registry->Device, Entry->Handle, HostCallbacks(HostObject_Pipeline));
+			vkDestroyPipeline(Registry->Device, Entry->FastLinkedHandle, HostCallbacks(HostObject_Pipeline));
+		}
+	}
+	for (u32 Part = 0; Part < PipelineLibraryPart_Count; Part++)
+	{
+		for (u32 i = 0; i < Registry->NumLibraryParts[Part]; i++)
+		{
+			vkDestroyPipeline(Registry->Device, Registry->LibraryParts[Part][i].Handle, HostCallbacks(HostObject_Pipeline));
+		}
+	}
+	vkDestroyPipelineLayout(Registry->Device, Registry->Layout, HostCallbacks(HostObject_PipelineLayout));
+	vkDestroyShaderModule(Registry->Device, Registry->VertShaderModule, HostCallbacks(HostObject_ShaderModule));
+	vkDestroyShaderModule(Registry->Device, Registry->FragShaderModule, HostCallbacks(HostObject_ShaderModule));
+}
+
+static VkCommandPool CreateCommandPool(VkDevice Device, u32 QueueFamilyIndex, VkCommandPoolCreateFlags Flags)
+{
+	VkCommandPoolCreateInfo PoolInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+		.flags = Flags,
+		.queueFamilyIndex = QueueFamilyIndex,
+	};
+	VkCommandPool Result = VK_NULL_HANDLE;
+	if (vkCreateCommandPool(Device, &PoolInfo, HostCallbacks(HostObject_CommandPool), &Result) != VK_SUCCESS)
+	{
+		fprintf(stderr, "Failed to create command pool homies\n");
+		Assert(false);
+	}
+	return Result;
+}
+
+// TODO: How is this different from the number of Swapchain image views??
+// NOTE: Upper bound only - how many frames actually get queued up is picked at runtime (see frame_scheduler)
+static constexpr u32 MAX_FRAMES_IN_FLIGHT = 4;
+
+static VkCommandBuffer* CreateCommandBuffers(memory_arena* Arena, VkDevice Device, VkCommandPool CommandPool, u32 Count)
+{
+	VkCommandBufferAllocateInfo AllocInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+		.commandPool = CommandPool,
+		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+		.commandBufferCount = Count,
+	};
+	VkCommandBuffer* Result = PushArray(Arena, VkCommandBuffer, Count);
+	// TODO: Does this just allocate GPU memory (in some opaque way), hence why we're not passing a pAllocator?
+	if (vkAllocateCommandBuffers(Device, &AllocInfo, Result) != VK_SUCCESS)
+	{
+		fprintf(stderr, "Failed to allocate command buffers my dudes\n");
+		Assert(false);
+	}
+	return Result;
+}
+
+// NOTE: Pool for short-lived command buffers (uploads, one-off jobs). Command buffers are never freed back to Vulkan -
+// once whoever's using one knows the GPU is done with it (fence, timeline value, whatever), it goes back on the free
+// list and gets reused, so in steady state getting a command buffer costs nothing. Command pools aren't thread-safe,
+// so this isn't either: make one per thread that records.
+static constexpr u32 MAX_TRANSIENT_COMMAND_BUFFERS = 64;
+
+struct transient_command_pool
+{
+	VkDevice Device;
+	VkCommandPool Handle;
+	VkCommandBuffer Free[MAX_TRANSIENT_COMMAND_BUFFERS];
+	u32 NumFree;
+	u32 NumAllocated;
+#if _DEBUG
+	std::thread::id OwnerThread;
+#endif
+};
+
+static transient_command_pool CreateTransientCommandPool(VkDevice Device, u32 QueueFamilyIndex)
+{
+	transient_command_pool Result = {};
+	Result.Device = Device;
+	// NOTE: RESET_COMMAND_BUFFER so vkBeginCommandBuffer can implicitly reset a recycled one
+	Result.Handle = CreateCommandPool(Device, QueueFamilyIndex,
+									  VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+#if _DEBUG
+	Result.OwnerThread = std::this_thread::get_id();
+#endif
+	return Result;
+}
+
+// Hands back a command buffer that's ready to record into (already begun, one-time submit)
+static VkCommandBuffer BeginTransientCommandBuffer(transient_command_pool* Pool)
+{
+#if _DEBUG
+	Assert(Pool->OwnerThread == std::this_thread::get_id());
+#endif
+	VkCommandBuffer Result = VK_NULL_HANDLE;
+	if (Pool->NumFree)
+	{
+		Result = Pool->Free[--Pool->NumFree];
+	}
+	else
+	{
+		VkCommandBufferAllocateInfo AllocInfo
+		{
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+			.commandPool = Pool->Handle,
+			.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+			.commandBufferCount = 1,
+		};
+		if (vkAllocateCommandBuffers(Pool->Device, &AllocInfo, &Result) == VK_SUCCESS)
+		{
+			Pool->NumAllocated++;
+		}
+		else
+		{
+			fprintf(stderr, "Failed to allocate transient command buffer\n");
+			Assert(false);
+		}
+	}
+
+	VkCommandBufferBeginInfo BeginInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+	};
+	vkBeginCommandBuffer(Result, &BeginInfo);
+	return Result;
+}
+
+// Only once the GPU's finished with it!
+static void RecycleTransientCommandBuffer(transient_command_pool* Pool, VkCommandBuffer CommandBuffer)
+{
+#if _DEBUG
+	Assert(Pool->OwnerThread == std::this_thread::get_id());
+#endif
+	if (Pool->NumFree < MAX_TRANSIENT_COMMAND_BUFFERS)
+	{
+		Pool->Free[Pool->NumFree++] = CommandBuffer;
+	}
+	else
+	{
+		vkFreeCommandBuffers(Pool->Device, Pool->Handle, 1, &CommandBuffer);
+		Pool->NumAllocated--;
+	}
+}
+
+// Frees every command buffer the pool ever made, so nothing can still be in flight
+static void DestroyTransientCommandPool(transient_command_pool* Pool)
+{
+	vkDestroyCommandPool(Pool->Device, Pool->Handle, HostCallbacks(HostObject_CommandPool));
+	*Pool = {};
+}
+
+struct vulkan_buffer
+{
+	VkBuffer Handle;
+	gpu_allocation Allocation;
+};
+
+static vulkan_buffer CreateBuffer(gpu_allocator* Allocator,
+								  VkDeviceSize Size, 
+								  VkBufferUsageFlags UsageFlags, 
+								  VkMemoryPropertyFlags PropertyFlags)
+{
+	VkDevice Device = Allocator->Device;
+	VkBufferCreateInfo BufferInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+		.size = Size,
+		.usage = UsageFlags,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE
+	};
+	// NOTE: Anything that gets written on the transfer queue and read on the graphics queue is shared between the two
+	// families, so we don't have to do queue family ownership transfers
+	if ((UsageFlags & VK_BUFFER_USAGE_TRANSFER_DST_BIT) && Allocator->NumQueueFamilies > 1)
+	{
+		BufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		BufferInfo.queueFamilyIndexCount = Allocator->NumQueueFamilies;
+		BufferInfo.pQueueFamilyIndices = Allocator->QueueFamilies;
+	}
+
+	vulkan_buffer Result = {};
+	if (vkCreateBuffer(Device, &BufferInfo, HostCallbacks(HostObject_Buffer), &Result.Handle) == VK_SUCCESS)
+	{
+		VkMemoryRequirements MemRequirements;
+		vkGetBufferMemoryRequirements(Device, Result.Handle, &MemRequirements);
+
+		Result.Allocation = AllocateGpuMemory(Allocator, MemRequirements, PropertyFlags, GpuResource_Linear);
+		if (Result.Allocation.Memory)
+		{
+			vkBindBufferMemory(Device, Result.Handle, Result.Allocation.Memory, Result.Allocation.Offset);
+		}
+		else
+		{
+			fprintf(stderr, "Failed to allocate buffer memory.\n");
+			Assert(false);
+		}
+	}
+	else
+	{
+		fprintf(stderr, "Failed to create buffer.\n");
+		Assert(false);
+	}
+	return Result;
+}
+
+static void DestroyBuffer(gpu_allocator* Allocator, vulkan_buffer* Buffer)
+{
+	vkDestroyBuffer(Allocator->Device, Buffer->Handle, HostCallbacks(HostObject_Buffer));
+	FreeGpuMemory(Allocator, &Buffer->Allocation);
+	*Buffer = {};
+}
+
+static void CopyBuffer(VkCommandBuffer CommandBuffer, 
+					   VkBuffer SrcBuffer, VkDeviceSize SrcOffset, 
+					   VkBuffer DestBuffer, VkDeviceSize DestOffset, 
+					   VkDeviceSize Size)
+{
+	VkBufferCopy CopyRegion
+	{
+		.srcOffset = SrcOffset,
+		.dstOffset = DestOffset,
+		.size = Size
+	};
+	vkCmdCopyBuffer(CommandBuffer, SrcBuffer, DestBuffer, 1, &CopyRegion);
+}
+
+static void CopyBufferToImage(VkCommandBuffer CommandBuffer, VkBuffer Buffer, VkDeviceSize BufferOffset, VkImage Image, u32 Width, u32 Height)
+{
+	VkBufferImageCopy Region
+	{
+		.bufferOffset = BufferOffset,
+		.bufferRowLength = 0,
+		.bufferImageHeight = 0,
+		.imageSubresource
+		{
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.mipLevel = 0,
+			.baseArrayLayer = 0,
+			.layerCount = 1,
+		},
+		.imageExtent
+		{
+			.width = Width,
+			.height = Height,
+			.depth = 1,
+		},
+	};
+	vkCmdCopyBufferToImage(CommandBuffer, Buffer, Image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &Region);
+}
+
+// NOTE: Upload engine. Copies get batched up into one command buffer, which goes to the transfer queue (or the graphics
+// queue, if there's no dedicated transfer family) and signals a timeline semaphore when it's done. Every upload hands
+// back a ticket - the timeline value of the batch it went into - which can be polled instead of stalling on
+// vkQueueWaitIdle. The graphics queue waits on the same semaphore for anything it's about to draw with.
+// Each batch has a single staging buffer that uploads get bump-allocated out of, so the cost of a batch is one
+// staging allocation and one submit no matter how many assets are in it. If the staging buffer fills up, the batch
+// gets submitted and a new one started (tickets handed out before that still refer to the right batch).
+typedef u64 upload_ticket;
+
+static constexpr u32 MAX_UPLOAD_BATCHES = 16;
+static constexpr VkDeviceSize UPLOAD_STAGING_SIZE = 8 * 1024 * 1024; // Default, batches go bigger if they need to
+// NOTE: Enough for any texel size we'd upload, and for optimalBufferCopyOffsetAlignment on everything I've seen
+static constexpr VkDeviceSize UPLOAD_STAGING_ALIGNMENT = 16;
+
+struct upload_batch
+{
+	VkCommandBuffer CommandBuffer;
+	barrier_batch Barriers; // Post-copy transitions pile up in here and all go out together at submit
+	vulkan_buffer Staging;
+	VkDeviceSize StagingSize;
+	VkDeviceSize StagingUsed;
+	upload_ticket Ticket;
+};
+
+struct upload_engine
+{
+	VkDevice Device;
+	gpu_allocator* Allocator;
+	VkQueue Queue;
+	transient_command_pool CommandPool;
+	VkSemaphore Timeline;
+	upload_ticket LastSubmitted;
+
+	b32 IsRecording;
+	upload_batch Recording;
+	upload_batch InFlight[MAX_UPLOAD_BATCHES];
+	u32 NumInFlight;
+};
+
+static upload_engine CreateUploadEngine(VkDevice Device, gpu_allocator* Allocator, u32 QueueFamilyIndex)
+{
+	upload_engine Result = {};
+	Result.Device = Device;
+	Result.Allocator = Allocator;
+	vkGetDeviceQueue(Device, QueueFamilyIndex, 0, &Result.Queue);
+	Result.CommandPool = CreateTransientCommandPool(Device, QueueFamilyIndex);
+
+	VkSemaphoreTypeCreateInfo TimelineInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+		.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+		.initialValue = 0,
+	};
+	VkSemaphoreCreateInfo SemaphoreInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+		.pNext = &TimelineInfo,
+	};
+	if (vkCreateSemaphore(Device, &SemaphoreInfo, HostCallbacks(HostObject_Semaphore), &Result.Timeline) != VK_SUCCESS)
+	{
+		fprintf(stderr, "Failed to create upload timeline semaphore\n");
+		Assert(false);
+	}
+	return Result;
+}
+
+static b32 IsUploadComplete(upload_engine* Engine, upload_ticket Ticket)
+{
+	u64 Value = 0;
+	vkGetSemaphoreCounterValue(Engine->Device, Engine->Timeline, &Value);
+	b32 Result = Value >= Ticket;
+	return Result;
+}
+
+static void WaitForUpload(upload_engine* Engine, upload_ticket Ticket)
+{
+	VkSemaphoreWaitInfo WaitInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+		.semaphoreCount = 1,
+		.pSemaphores = &Engine->Timeline,
+		.pValues = &Ticket,
+	};
+	vkWaitSemaphores(Engine->Device, &WaitInfo, UINT64_MAX);
+}
+
+// Frees staging memory and command buffers for every batch the GPU has finished with. Never blocks.
+static void CollectUploads(upload_engine* Engine)
+{
+	u64 CompletedValue = 0;
+	vkGetSemaphoreCounterValue(Engine->Device, Engine->Timeline, &CompletedValue);
+
+	u32 i = 0;
+	while (i < Engine->NumInFlight)
+	{
+		upload_batch* Batch = Engine->InFlight + i;
+		if (Batch->Ticket <= CompletedValue)
+		{
+			DestroyBuffer(Engine->Allocator, &Batch->Staging);
+			RecycleTransientCommandBuffer(&Engine->CommandPool, Batch->CommandBuffer);
+			*Batch = Engine->InFlight[--Engine->NumInFlight];
+		}
+		else
+		{
+			i++;
+		}
+	}
+}
+
+// Kicks off everything recorded since the last submit. Returns the ticket for the lot.
+static upload_ticket SubmitUploads(upload_engine* Engine)
+{
+	if (Engine->IsRecording)
+	{
+		if (Engine->NumInFlight == MAX_UPLOAD_BATCHES)
+		{
+			// Shouldn't really happen unless someone's submitting tiny batches in a tight loop
+			WaitForUpload(Engine, Engine->LastSubmitted - MAX_UPLOAD_BATCHES + 1);
+			CollectUploads(Engine);
+		}
+
+		upload_batch* Batch = &Engine->Recording;
+		FlushBarriers(&Batch->Barriers);
+		vkEndCommandBuffer(Batch->CommandBuffer);
+		Batch->Ticket = Engine->LastSubmitted + 1;
+
+		VkTimelineSemaphoreSubmitInfo TimelineInfo
+		{
+			.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+			.signalSemaphoreValueCount = 1,
+			.pSignalSemaphoreValues = &Batch->Ticket,
+		};
+		VkSubmitInfo SubmitInfo
+		{
+			.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+			.pNext = &TimelineInfo,
+			.commandBufferCount = 1,
+			.pCommandBuffers = &Batch->CommandBuffer,
+			.signalSemaphoreCount = 1,
+			.pSignalSemaphores = &Engine->Timeline,
+		};
+		if (vkQueueSubmit(Engine->Queue, 1, &SubmitInfo, VK_NULL_HANDLE) == VK_SUCCESS)
+		{
+			Engine->LastSubmitted = Batch->Ticket;
+			Engine->InFlight[Engine->NumInFlight++] = *Batch;
+		}
+		else
+		{
+			fprintf(stderr, "Failed to submit upload batch\n");
+			Assert(false);
+		}
+		Engine->Recording = {};
+		Engine->IsRecording = false;
+	}
+	return Engine->LastSubmitted;
+}
+
+// Starts recording a new batch with room for (at least) StagingBytes. Optional - the upload functions start one on
+// demand - but if you know up front how much you're about to upload, this makes sure it all goes in one submit.
+static void BeginUploadBatch(upload_engine* Engine, VkDeviceSize StagingBytes)
+{
+	SubmitUploads(Engine);
+
+	upload_batch* Batch = &Engine->Recording;
+	*Batch = {};
+	Batch->CommandBuffer = BeginTransientCommandBuffer(&Engine->CommandPool);
+	Batch->Barriers = BeginBarrierBatch(Batch->CommandBuffer);
+
+	Batch->StagingSize = StagingBytes > UPLOAD_STAGING_SIZE ? StagingBytes : UPLOAD_STAGING_SIZE;
+	Batch->Staging = CreateBuffer(Engine->Allocator, Batch->StagingSize,
+								  VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+								  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	Engine->IsRecording = true;
+}
+
+// Copies Data into the current batch's staging buffer (starting a new batch if it doesn't fit), and returns where it
+// ended up
+static VkDeviceSize PushStagingData(upload_engine* Engine, const void* Data, VkDeviceSize Size)
+{
+	upload_batch* Batch = &Engine->Recording;
+	VkDeviceSize Result = AlignUp(Batch->StagingUsed, UPLOAD_STAGING_ALIGNMENT);
+	if (!Engine->IsRecording || Result + Size > Batch->StagingSize)
+	{
+		BeginUploadBatch(Engine, Size);
+		Result = 0;
+	}
+	// NOTE: Host-visible blocks are persistently mapped by the allocator, so no vkMapMemory here
+	memcpy((u8*)Batch->Staging.Allocation.Mapped + Result, Data, Size);
+	Batch->StagingUsed = Result + Size;
+	return Result;
+}
+
+static upload_ticket UploadToBuffer(upload_engine* Engine, VkBuffer DestBuffer, VkDeviceSize DestOffset, const void* Data, VkDeviceSize Size)
+{
+	VkDeviceSize StagingOffset = PushStagingData(Engine, Data, Size);
+	CopyBuffer(Engine->Recording.CommandBuffer, Engine->Recording.Staging.Handle, StagingOffset, DestBuffer, DestOffset, Size);
+	return Engine->LastSubmitted + 1;
+}
+
+// Leaves the image in SHADER_READ_ONLY_OPTIMAL
+static upload_ticket UploadToImage(upload_engine* Engine, image* Image, u32 Width, u32 Height, const void* Data, VkDeviceSize Size)
+{
+	VkDeviceSize StagingOffset = PushStagingData(Engine, Data, Size);
+	upload_batch* Batch = &Engine->Recording;
+	RequireImage(&Batch->Barriers, Image, ImageUsage_TransferDst, true);
+	FlushBarriers(&Batch->Barriers);
+	CopyBufferToImage(Batch->CommandBuffer, Batch->Staging.Handle, StagingOffset, Image->Image, Width, Height);
+	RequireImage(&Batch->Barriers, Image, ImageUsage_UploadedForSampling, false);
+	return Engine->LastSubmitted + 1;
+}
+
+static void DestroyUploadEngine(upload_engine* Engine)
+{
+	SubmitUploads(Engine);
+	WaitForUpload(Engine, Engine->LastSubmitted);
+	CollectUploads(Engine);
+	Assert(Engine->NumInFlight == 0);
+
+	vkDestroySemaphore(Engine->Device, Engine->Timeline, HostCallbacks(HostObject_Semaphore));
+	DestroyTransientCommandPool(&Engine->CommandPool);
+}
+
+static constexpr u32 MAX_DRAWS = 65536;
+
+struct uniform_ring
+{
+	vulkan_buffer Buffer;
+	u8* Mapped;
+	VkDeviceSize Alignment; // minUniformBufferOffsetAlignment
+	VkDeviceSize RegionSize;
+	VkDeviceSize RegionStart;
+	VkDeviceSize Head; // Relative to RegionStart
+};
+
+static uniform_ring CreateUniformRing(gpu_allocator* Allocator, VkPhysicalDevice PhysicalDevice, VkDeviceSize BytesPerFrame, u32 NumFrames)
+{
+	VkPhysicalDeviceProperties Props;
+	vkGetPhysicalDeviceProperties(PhysicalDevice, &Props);
+
+	uniform_ring Result = {};
+	Result.Alignment = Props.limits.minUniformBufferOffsetAlignment;
+	Result.RegionSize = AlignUp(BytesPerFrame, Result.Alignment);
+	Result.Buffer = CreateBuffer(Allocator, Result.RegionSize * NumFrames,
+								 VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+								 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	Result.Mapped = (u8*)Result.Buffer.Allocation.Mapped;
+	return Result;
+}
+
+// Only safe once the GPU is done with whatever this frame slot was used for last time around
+static void BeginUniformFrame(uniform_ring* Ring, u32 FrameIndex)
+{
+	Ring->RegionStart = Ring->RegionSize * FrameIndex;
+	Ring->Head = 0;
+}
+
+static void* PushUniforms(uniform_ring* Ring, VkDeviceSize Size, u32* OutDynamicOffset)
+{
+	void* Result = nullptr;
+	VkDeviceSize Offset = AlignUp(Ring->Head, Ring->Alignment);
+	if (Offset + Size <= Ring->RegionSize)
+	{
+		Ring->Head = Offset + Size;
+		*OutDynamicOffset = (u32)(Ring->RegionStart + Offset);
+		Result = Ring->Mapped + Ring->RegionStart + Offset;
+	}
+	else
+	{
+		fprintf(stderr, "Uniform ring is full, dropping draw\n");
+	}
+	return Result;
+}
+
+static VkDescriptorPool CreateDescriptorPool(VkDevice Device)
+{
+	VkDescriptorPoolSize PoolSizeUbo
+	{
+		.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+		.descriptorCount = 1,
+	};
+	VkDescriptorPoolSize PoolSizeSampler
+	{
+		.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+		.descriptorCount = 1,
+	};
+	VkDescriptorPoolSize PoolSizes[] = { PoolSizeUbo, PoolSizeSampler };
+
+	VkDescriptorPoolCreateInfo PoolInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+		.maxSets = 1,
+		.poolSizeCount = ArrayCount(PoolSizes),
+		.pPoolSizes = PoolSizes,
+	};
+
+	VkDescriptorPool Result = VK_NULL_HANDLE;
+	if (vkCreateDescriptorPool(Device, &PoolInfo, HostCallbacks(HostObject_DescriptorPool), &Result) != VK_SUCCESS)
+	{
+		fprintf(stderr, "Failed to create descriptor pool bro\n");
+		Assert(false);
+	}
+	return Result;
+}
+
+// NOTE: Separate from CreateDescriptorSet because streamed textures get a new image view every time they come back
+// into VRAM. Only safe when no frame in flight is using the set.
+static void WriteTextureDescriptor(VkDevice Device, VkDescriptorSet DescSet, VkImageView TextureImageView, VkSampler TextureSampler)
+{
+	VkDescriptorImageInfo ImageInfo
+	{
+		.sampler = TextureSampler,
+		.imageView = TextureImageView,
+		.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+	};
+	VkWriteDescriptorSet DescWriteSampler
+	{
+		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+		.dstSet = DescSet,
+		.dstBinding = 1,
+		.dstArrayElement = 0,
+		.descriptorCount = 1,
+		.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+		.pImageInfo = &ImageInfo,
+	};
+	vkUpdateDescriptorSets(Device, 1, &DescWriteSampler, 0, nullptr);
+}
+
+// NOTE: Just the one set - the uniform ring is a single buffer, and which frame's region we read from is picked by the
+// dynamic offset at bind time
+static VkDescriptorSet CreateDescriptorSet(VkDevice Device, 
+										   VkDescriptorSetLayout DescSetLayout, 
+										   VkDescriptorPool DescPool, 
+										   uniform_ring* UniformRing,
+										   VkImageView TextureImageView,
+										   VkSampler TextureSampler)
+{
+	VkDescriptorSetAllocateInfo AllocInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+		.descriptorPool = DescPool,
+		.descriptorSetCount = 1,
+		.pSetLayouts = &DescSetLayout,
+	};
+
+	VkDescriptorSet Result = VK_NULL_HANDLE;
+	if (vkAllocateDescriptorSets(Device, &AllocInfo, &Result) == VK_SUCCESS)
+	{
+		VkDescriptorBufferInfo BufferInfo
+		{
+			.buffer = UniformRing->Buffer.Handle,
+			.offset = 0,
+			.range = sizeof(uniform_buffer_object),
+		};
+		VkWriteDescriptorSet DescWriteUbo
+		{
+			.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+			.dstSet = Result,
+			.dstBinding = 0,
+			.dstArrayElement = 0,
+			.descriptorCount = 1,
+			.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+			.pBufferInfo = &BufferInfo,
+		};
+		vkUpdateDescriptorSets(Device, 1, &DescWriteUbo, 0, nullptr);
+		WriteTextureDescriptor(Device, Result, TextureImageView, TextureSampler);
+	}
+	else
+	{
+		fprintf(stderr, "Failed to allocate descriptor sets\n");
+		Assert(false);
+	}
+	return Result;
+}
+
+struct image_spec
+{
+	u32 Width;
+	u32 Height;
+	VkFormat Format;
+	VkImageTiling Tiling;
+	VkImageUsageFlags UsageFlags;
+	VkMemoryPropertyFlags MemPropFlags;
+	VkImageAspectFlags AspectFlags;
+};
+
+static image CreateImage(gpu_allocator* Allocator, image_spec Spec)
+{
+	VkDevice Device = Allocator->Device;
+	image Result = {};
+	VkImageCreateInfo ImageInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+		.imageType = VK_IMAGE_TYPE_2D,
+		.format = Spec.Format,
+		.extent = { .width = Spec.Width, .height = Spec.Height, .depth = 1 },
+		.mipLevels = 1,
+		.arrayLayers = 1,
+		.samples = VK_SAMPLE_COUNT_1_BIT,
+		.tiling = Spec.Tiling,
+		.usage = Spec.UsageFlags,
+		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED, // TODO: Wtf does this actually mean
+	};
+	if ((Spec.UsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT) && Allocator->NumQueueFamilies > 1)
+	{
+		ImageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		ImageInfo.queueFamilyIndexCount = Allocator->NumQueueFamilies;
+		ImageInfo.pQueueFamilyIndices = Allocator->QueueFamilies;
+	}
+	if (vkCreateImage(Device, &ImageInfo, HostCallbacks(HostObject_Image), &Result.Image) == VK_SUCCESS)
+	{
+		VkMemoryRequirements MemReqs;
+		vkGetImageMemoryRequirements(Device, Result.Image, &MemReqs);
+
+		gpu_resource_kind Kind = Spec.Tiling == VK_IMAGE_TILING_LINEAR ? GpuResource_Linear : GpuResource_Optimal;
+		Result.Allocation = AllocateGpuMemory(Allocator, MemReqs, Spec.MemPropFlags, Kind);
+		if (Result.Allocation.Memory)
+		{
+			vkBindImageMemory(Device, Result.Image, Result.Allocation.Memory, Result.Allocation.Offset);
+
+			Result.ImageView = CreateImageView(Device, Result.Image, Spec.Format, Spec.AspectFlags);
+			Result.Aspect = Spec.AspectFlags;
+		}
+		else
+		{
+			fprintf(stderr, "Sorry couldn't allocate image/texture memory mate\n");
+			Assert(false);
+		}
+	}
+	else
+	{
+		fprintf(stderr, "Failed to create image\n");
+		Assert(false);
+	}
+	return Result;
+}
+
+static void DestroyImage(gpu_allocator* Allocator, image* Image)
+{
+	vkDestroyImageView(Allocator->Device, Image->ImageView, HostCallbacks(HostObject_ImageView));
+	vkDestroyImage(Allocator->Device, Image->Image, HostCallbacks(HostObject_Image));
+	FreeGpuMemory(Allocator, &Image->Allocation);
+	*Image = {};
+}
+
+static image CreateDepthBuffer(gpu_allocator* Allocator, VkPhysicalDevice PhysicalDevice, swap_chain* Swapchain)
+{
+	VkFormat DepthFormat = FindDepthFormat(PhysicalDevice);
+	
+	image_spec Spec
+	{
+		.Width = Swapchain->Extents.width,
+		.Height = Swapchain->Extents.height,
+		.Format = DepthFormat,
+		.Tiling = VK_IMAGE_TILING_OPTIMAL,
+		.UsageFlags = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+		.MemPropFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		.AspectFlags = VK_IMAGE_ASPECT_DEPTH_BIT,
+	};
+	image Result = CreateImage(Allocator, Spec);
+	// NOTE: Without separateDepthStencilLayouts, barriers on a combined depth/stencil format have to cover both aspects
+	if (DepthFormat != VK_FORMAT_D32_SFLOAT)
+	{
+		Result.Aspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+	}
+
+	return Result;
+}
+
+static constexpr VkExtent2D HEADLESS_EXTENTS = { 1280, 720 };
+
+// Stands in for the swapchain when there's no window: a ring of plain colour images, one per frame in flight, so a
+// frame's image is always free again by the time BeginFrame has waited for its slot
+static swap_chain CreateOffscreenSwapchain(memory_arena* Arena, gpu_allocator* Allocator, VkExtent2D Extents, u32 NumImages)
+{
+	swap_chain Result = {};
+	Result.NumImages = NumImages;
+	// Guaranteed to work as a colour attachment everywhere, no surface to ask about anything else
+	Result.Format = VK_FORMAT_R8G8B8A8_UNORM;
+	Result.Extents = Extents;
+	Result.Usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	Result.Images = PushArray(Arena, VkImage, NumImages);
+	Result.ImageViews = PushArray(Arena, VkImageView, NumImages);
+	Result.ImageStates = PushArray(Arena, image_state, NumImages);
+	Result.OffscreenImages = PushArray(Arena, image, NumImages);
+	for (u32 i = 0; i < NumImages; i++)
+	{
+		image_spec Spec
+		{
+			.Width = Extents.width,
+			.Height = Extents.height,
+			.Format = Result.Format,
+			.Tiling = VK_IMAGE_TILING_OPTIMAL,
+			.UsageFlags = Result.Usage,
+			.MemPropFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			.AspectFlags = VK_IMAGE_ASPECT_COLOR_BIT,
+		};
+		Result.OffscreenImages[i] = CreateImage(Allocator, Spec);
+		Result.Images[i] = Result.OffscreenImages[i].Image;
+		Result.ImageViews[i] = Result.OffscreenImages[i].ImageView;
+		Result.ImageStates[i] = {};
+	}
+	return Result;
+}
+
+// NOTE: Streamable resources - textures and meshes that keep a CPU-side copy of their contents, so they can be thrown
+// out of VRAM when we go over budget and brought back the next time something draws with them. Resident ones live on
+// an LRU list (most recently used at the head), and eviction works backwards from the tail, skipping anything that a
+// frame in flight (or a pending upload) might still be reading.
+enum streamable_kind : u32
+{
+	Streamable_Buffer,
+	Streamable_Texture,
+};
+
+struct streamable
+{
+	streamable_kind Kind;
+	vulkan_buffer Buffer; // Streamable_Buffer
+	image Texture;        // Streamable_Texture
+	VkBufferUsageFlags BufferUsage;
+	u32 Width;
+	u32 Height;
+
+	void* SourceData; // Ours - freed along with the streamable
+	VkDeviceSize SourceSize;
+
+	b32 IsResident;
+	u64 LastUsedFrame;
+	upload_ticket ReadyTicket;
+	streamable* Prev;
+	streamable* Next;
+};
+
+struct residency_manager
+{
+	gpu_allocator* Allocator;
+	upload_engine* Uploads;
+	b32 DirectUploads; // Write buffers straight into mapped VRAM instead of going through the upload engine
+	streamable* MostRecent;
+	streamable* LeastRecent;
+	u64 FrameNumber; // Number of frames submitted so far
+	u32 FramesInFlight;
+	u32 NumEvictions;
+	VkDeviceSize EvictedBytes;
+};
+
+static void UnlinkStreamable(residency_manager* Residency, streamable* Streamable)
+{
+	if (Streamable->Prev)
+	{
+		Streamable->Prev->Next = Streamable->Next;
+	}
+	else
+	{
+		Residency->MostRecent = Streamable->Next;
+	}
+	if (Streamable->Next)
+	{
+		Streamable->Next->Prev = Streamable->Prev;
+	}
+	else
+	{
+		Residency->LeastRecent = Streamable->Prev;
+	}
+	Streamable->Prev = nullptr;
+	Streamable->Next = nullptr;
+}
+
+static void PushMostRecent(residency_manager* Residency, streamable* Streamable)
+{
+	Streamable->Next = Residency->MostRecent;
+	if (Residency->MostRecent)
+	{
+		Residency->MostRecent->Prev = Streamable;
+	}
+	else
+	{
+		Residency->LeastRecent = Streamable;
+	}
+	Residency->MostRecent = Streamable;
+}
+
+static gpu_allocation* GetStreamableAllocation(streamable* Streamable)
+{
+	gpu_allocation* Result = Streamable->Kind == Streamable_Texture ? &Streamable->Texture.Allocation : &Streamable->Buffer.Allocation;
+	return Result;
+}
+
+static VkDeviceSize ReleaseStreamable(residency_manager* Residency, streamable* Streamable)
+{
+	Assert(Streamable->IsResident);
+	VkDeviceSize Result = GetStreamableAllocation(Streamable)->Size;
+	UnlinkStreamable(Residency, Streamable);
+	if (Streamable->Kind == Streamable_Texture)
+	{
+		DestroyImage(Residency->Allocator, &Streamable->Texture);
+	}
+	else
+	{
+		DestroyBuffer(Residency->Allocator, &Streamable->Buffer);
+	}
+	Streamable->IsResident = false;
+	return Result;
+}
+
+static VkDeviceSize EvictStreamable(residency_manager* Residency, streamable* Streamable)
+{
+	VkDeviceSize Result = ReleaseStreamable(Residency, Streamable);
+	Residency->NumEvictions++;
+	Residency->EvictedBytes += Result;
+	return Result;
+}
+
+// Plugged into the allocator as its gpu_evict_func
+static VkDeviceSize EvictLeastRecentlyUsed(void* UserData, u32 HeapIndex, VkDeviceSize BytesNeeded)
+{
+	residency_manager* Residency = (residency_manager*)UserData;
+	gpu_allocator* Allocator = Residency->Allocator;
+
+	VkDeviceSize Result = 0;
+	streamable* Streamable = Residency->LeastRecent;
+	while (Streamable && Result < BytesNeeded)
+	{
+		streamable* Prev = Streamable->Prev;
+		u32 MemoryTypeIndex = GetStreamableAllocation(Streamable)->MemoryTypeIndex;
+		// NOTE: Frame N is known to be finished by the time we're recording frame N + FramesInFlight
+		if (Allocator->MemoryProperties.memoryTypes[MemoryTypeIndex].heapIndex == HeapIndex &&
+			Streamable->LastUsedFrame + Residency->FramesInFlight <= Residency->FrameNumber &&
+			IsUploadComplete(Residency->Uploads, Streamable->ReadyTicket))
 		{
-			Result = Format;
-			break;
+			Result += EvictStreamable(Residency, Streamable);
 		}
+		Streamable = Prev;
 	}
-	if (Result == VK_FORMAT_UNDEFINED)
+	return Result;
+}
+
+// NOTE: Out-param rather than returning by value, since the allocator hangs on to a pointer to it
+static void InitResidencyManager(residency_manager* Residency, gpu_allocator* Allocator, upload_engine* Uploads, 
+								 u32 FramesInFlight, b32 AllowDirectUploads)
+{
+	*Residency = {};
+	Residency->Allocator = Allocator;
+	Residency->Uploads = Uploads;
+	Residency->FramesInFlight = FramesInFlight;
+	Residency->DirectUploads = AllowDirectUploads && Allocator->HasUnifiedMemory;
+	Allocator->Evict = EvictLeastRecentlyUsed;
+	Allocator->EvictUserData = Residency;
+}
+
+static void MakeResident(residency_manager* Residency, streamable* Streamable)
+{
+	if (Streamable->Kind == Streamable_Texture)
 	{
-		fprintf(stderr, "Sorry couldn't find supported format\n");
-		Assert(false);
+		image_spec Spec
+		{
+			.Width = Streamable->Width,
+			.Height = Streamable->Height,
+			.Format = VK_FORMAT_R8G8B8A8_SRGB,
+			.Tiling = VK_IMAGE_TILING_OPTIMAL,
+			.UsageFlags = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+			.MemPropFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			.AspectFlags = VK_IMAGE_ASPECT_COLOR_BIT,
+		};
+		Streamable->Texture = CreateImage(Residency->Allocator, Spec);
+		Streamable->ReadyTicket = UploadToImage(Residency->Uploads, &Streamable->Texture, Streamable->Width, Streamable->Height,
+												Streamable->SourceData, Streamable->SourceSize);
+	}
+	else if (Residency->DirectUploads)
+	{
+		// NOTE: Nothing to wait for - the memory's coherent, and the next queue submit makes the writes visible to the GPU
+		Streamable->Buffer = CreateBuffer(Residency->Allocator,
+										  Streamable->SourceSize,
+										  Streamable->BufferUsage,
+										  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		memcpy(Streamable->Buffer.Allocation.Mapped, Streamable->SourceData, Streamable->SourceSize);
+		Streamable->ReadyTicket = 0;
+	}
+	else
+	{
+		Streamable->Buffer = CreateBuffer(Residency->Allocator,
+										  Streamable->SourceSize,
+										  VK_BUFFER_USAGE_TRANSFER_DST_BIT | Streamable->BufferUsage,
+										  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+		Streamable->ReadyTicket = UploadToBuffer(Residency->Uploads, Streamable->Buffer.Handle, 0,
+												 Streamable->SourceData, Streamable->SourceSize);
+	}
+	Streamable->IsResident = true;
+	Streamable->LastUsedFrame = Residency->FrameNumber;
+	PushMostRecent(Residency, Streamable);
+}
+
+// Call before recording anything that uses the streamable. Brings it back into VRAM if it got evicted (returns true
+// if so - anything holding on to the old handles, like descriptor sets, needs updating), and bumps it to the front of
+// the LRU list. The frame's submit has to wait on the upload timeline for ReadyTicket.
+static b32 UseStreamable(residency_manager* Residency, streamable* Streamable)
+{
+	b32 Result = false;
+	if (Streamable->IsResident)
+	{
+		UnlinkStreamable(Residency, Streamable);
+		PushMostRecent(Residency, Streamable);
+		Streamable->LastUsedFrame = Residency->FrameNumber;
+	}
+	else
+	{
+		MakeResident(Residency, Streamable);
+		Result = true;
 	}
 	return Result;
 }
 
-static VkFormat FindDepthFormat(VkPhysicalDevice PhysicalDevice)
+static streamable* CreateStreamableBuffer(residency_manager* Residency, VkBufferUsageFlags Usage, const void* Data, VkDeviceSize Size)
 {
-	VkFormat CandidateFormats[] = { VK_FORMAT_D32_SFLOAT, VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT };
-	VkFormat Result = FindSupportedFormat(CandidateFormats, ArrayCount(CandidateFormats),
-										  VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT, PhysicalDevice);
+	streamable* Result = (streamable*)AllocateMemory(sizeof(streamable));
+	Result->Kind = Streamable_Buffer;
+	Result->BufferUsage = Usage;
+	Result->SourceData = AllocateMemory(Size);
+	Result->SourceSize = Size;
+	memcpy(Result->SourceData, Data, Size);
+	MakeResident(Residency, Result);
 	return Result;
 }
 
-static VkRenderPass CreateRenderPass(VkDevice Device, VkPhysicalDevice PhysicalDevice, swap_chain* Swapchain)
+struct decoded_image
 {
-	VkAttachmentDescription ColourAttachment
+	const char* FileName;
+	stbi_uc* Pixels; // RGBA8, from stbi_load
+	u32 Width;
+	u32 Height;
+};
+
+// job_func, UserData is a decoded_image with FileName filled in. Safe to run on any thread.
+static void DecodeImageJob(void* UserData, u32 Index)
+{
+	decoded_image* Image = (decoded_image*)UserData;
+	u32 Stage = BeginStartupStage(Image->FileName);
+	int TexWidth, TexHeight, NumChannels;
+	Image->Pixels = stbi_load(Image->FileName, &TexWidth, &TexHeight, &NumChannels, STBI_rgb_alpha);
+	if (Image->Pixels)
 	{
-		.format = Swapchain->Format,
-		.samples = VK_SAMPLE_COUNT_1_BIT,
-		.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-		.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-		.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-		.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
-		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-		.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-	};
-	VkAttachmentReference ColourAttachmentRef
+		Image->Width = (u32)TexWidth;
+		Image->Height = (u32)TexHeight;
+	}
+	else
 	{
-		.attachment = 0, // NOTE: This is the index of 'layout(location = 0)' in the fragment shader
-		.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+		fprintf(stderr, "Couldn't load that texture image '%s', bro\n", Image->FileName);
+		Assert(false);
+	}
+	EndStartupStage(Stage);
+}
+
+// Takes ownership of the pixels
+static streamable* CreateStreamableTexture(residency_manager* Residency, decoded_image* Image)
+{
+	streamable* Result = (streamable*)AllocateMemory(sizeof(streamable));
+	Result->Kind = Streamable_Texture;
+	Result->Width = Image->Width;
+	Result->Height = Image->Height;
+	Result->SourceData = Image->Pixels;
+	Result->SourceSize = (VkDeviceSize)Image->Width * Image->Height * 4;
+	MakeResident(Residency, Result);
+	return Result;
+}
+
+static void DestroyStreamable(residency_manager* Residency, streamable* Streamable)
+{
+	if (Streamable->IsResident)
+	{
+		ReleaseStreamable(Residency, Streamable);
+	}
+	if (Streamable->Kind == Streamable_Texture)
+	{
+		stbi_image_free(Streamable->SourceData);
+	}
+	else
+	{
+		FreeMemory(Streamable->SourceData);
+	}
+	FreeMemory(Streamable);
+}
+
+// Call once a frame, after waiting on the frame's fence. Picks up budget changes (other apps grabbing VRAM, say) and
+// throws out whatever it takes to get back under.
+static void BeginResidencyFrame(residency_manager* Residency)
+{
+	gpu_allocator* Allocator = Residency->Allocator;
+	UpdateGpuBudget(Allocator);
+	for (u32 i = 0; i < Allocator->MemoryProperties.memoryHeapCount; i++)
+	{
+		VkDeviceSize Usage = GetGpuHeapUsage(Allocator, i);
+		VkDeviceSize Budget = Allocator->HeapBudgets[i].Budget;
+		if (Usage > Budget)
+		{
+			EvictLeastRecentlyUsed(Residency, i, Usage - Budget);
+		}
+	}
+}
+
+static VkSampler CreateTextureSampler(VkDevice Device, VkPhysicalDevice PhysicalDevice)
+{
+	VkPhysicalDeviceProperties Props = {};
+	vkGetPhysicalDeviceProperties(PhysicalDevice, &Props);
+
+	VkSamplerCreateInfo SamplerInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+		.magFilter = VK_FILTER_LINEAR,
+		.minFilter = VK_FILTER_LINEAR,
+		.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+		.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+		.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+		.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+		.mipLodBias = 0.0f,
+		.anisotropyEnable = VK_TRUE,
+		.maxAnisotropy = Props.limits.maxSamplerAnisotropy,
+		.compareEnable = VK_FALSE,
+		.compareOp = VK_COMPARE_OP_ALWAYS,
+		.minLod = 0.0f,
+		.maxLod = 0.0f,
+		.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK,
+		.unnormalizedCoordinates = VK_FALSE,
 	};
 
-	VkAttachmentDescription DepthAttachment
+	VkSampler Result = VK_NULL_HANDLE;
+	if (vkCreateSampler(Device, &SamplerInfo, HostCallbacks(HostObject_Sampler), &Result) != VK_SUCCESS)
 	{
-		.format = FindDepthFormat(PhysicalDevice),
-		.samples = VK_SAMPLE_COUNT_1_BIT,
-		.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
-		.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-		.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
-		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-		.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+		fprintf(stderr, "Failed to create that there sampler, my friend\n");
+		Assert(false);
+	}
+	return Result;
+}
+
+
+// NOTE: Frame pacing. One timeline semaphore, bumped once per submitted frame: frame N (counting from 1) signals N.
+// Before recording frame N we wait for frame N - FramesInFlight, which is the last one that used this frame's slot
+// (command buffer, uniform region, acquire semaphore). FramesInFlight trades latency for throughput - 1 means the CPU
+// never gets ahead of the GPU, more lets it queue up work at the cost of input lag - so it's a runtime setting.
+// Acquire/present still need binary semaphores (swapchains don't do timelines), one pair per slot.
+struct frame_scheduler
+{
+	VkDevice Device;
+	VkSemaphore Timeline;
+	u32 FramesInFlight;
+	u64 FramesSubmitted;
+	u32 CurrentSlot;
+
+	VkCommandBuffer* CommandBuffers;
+	VkSemaphore ImageAvailable[MAX_FRAMES_IN_FLIGHT];
+	VkSemaphore RenderFinished[MAX_FRAMES_IN_FLIGHT];
+
+	// How long the CPU sat waiting on the GPU in BeginFrame. Lots of waiting means we're GPU bound (or FramesInFlight
+	// is too low to cover the GPU's latency); none at all with a deep queue means frames are sitting around going stale.
+	f64 LastWaitSeconds;
+	f64 TotalWaitSeconds;
+	f64 MaxWaitSeconds;
+	u64 NumFramesWaited; // Frames where the GPU wasn't already done
+};
+
+static frame_scheduler CreateFrameScheduler(memory_arena* Arena, VkDevice Device, VkCommandPool CommandPool, u32 FramesInFlight)
+{
+	Assert(FramesInFlight >= 1 && FramesInFlight <= MAX_FRAMES_IN_FLIGHT);
+	frame_scheduler Result = {};
+	Result.Device = Device;
+	Result.FramesInFlight = FramesInFlight;
+	Result.CommandBuffers = CreateCommandBuffers(Arena, Device, CommandPool, FramesInFlight);
+
+	VkSemaphoreTypeCreateInfo TimelineInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+		.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+		.initialValue = 0,
 	};
-	VkAttachmentReference DepthAttachmentRef
+	VkSemaphoreCreateInfo TimelineSemaphoreInfo
 	{
-		.attachment = 1,
-		.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+		.pNext = &TimelineInfo,
 	};
-
-	VkSubpassDescription Subpass
+	VkSemaphoreCreateInfo SemaphoreInfo
 	{
-		.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
-		.colorAttachmentCount = 1,
-		.pColorAttachments = &ColourAttachmentRef,
-		.pDepthStencilAttachment = &DepthAttachmentRef,
+		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
 	};
+	if (vkCreateSemaphore(Device, &TimelineSemaphoreInfo, HostCallbacks(HostObject_Semaphore), &Result.Timeline) != VK_SUCCESS)
+	{
+		fprintf(stderr, "Failed to create the frame timeline semaphore\n");
+		Assert(false);
+	}
+	for (u32 i = 0; i < FramesInFlight; i++)
+	{
+		if (vkCreateSemaphore(Device, &SemaphoreInfo, HostCallbacks(HostObject_Semaphore), Result.ImageAvailable + i) != VK_SUCCESS ||
+			vkCreateSemaphore(Device, &SemaphoreInfo, HostCallbacks(HostObject_Semaphore), Result.RenderFinished + i) != VK_SUCCESS)
+		{
+			fprintf(stderr, "Failed to create them semaphores mate\n");
+			Assert(false);
+		}
+	}
+	return Result;
+}
+
+// Blocks until frame FrameValue has finished on the GPU, and counts the time spent doing it against this frame
+static void WaitForFrame(frame_scheduler* Scheduler, u64 FrameValue)
+{
+	u64 CompletedValue = 0;
+	vkGetSemaphoreCounterValue(Scheduler->Device, Scheduler->Timeline, &CompletedValue);
+	if (CompletedValue < FrameValue)
+	{
+		std::chrono::time_point WaitStart = std::chrono::high_resolution_clock::now();
+		VkSemaphoreWaitInfo WaitInfo
+		{
+			.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+			.semaphoreCount = 1,
+			.pSemaphores = &Scheduler->Timeline,
+			.pValues = &FrameValue,
+		};
+		vkWaitSemaphores(Scheduler->Device, &WaitInfo, UINT64_MAX);
+		std::chrono::time_point WaitEnd = std::chrono::high_resolution_clock::now();
+
+		f64 WaitSeconds = std::chrono::duration<f64>(WaitEnd - WaitStart).count();
+		if (Scheduler->LastWaitSeconds == 0.0)
+		{
+			Scheduler->NumFramesWaited++;
+		}
+		Scheduler->LastWaitSeconds += WaitSeconds;
+		Scheduler->TotalWaitSeconds += WaitSeconds;
+		if (Scheduler->LastWaitSeconds > Scheduler->MaxWaitSeconds)
+		{
+			Scheduler->MaxWaitSeconds = Scheduler->LastWaitSeconds;
+		}
+	}
+}
+
+// Blocks until the frame slot we're about to reuse is free. Returns the slot.
+static u32 BeginFrame(frame_scheduler* Scheduler)
+{
+	Scheduler->CurrentSlot = (u32)(Scheduler->FramesSubmitted % Scheduler->FramesInFlight);
+	Scheduler->LastWaitSeconds = 0.0;
+	if (Scheduler->FramesSubmitted >= Scheduler->FramesInFlight)
+	{
+		WaitForFrame(Scheduler, Scheduler->FramesSubmitted + 1 - Scheduler->FramesInFlight);
+	}
+	return Scheduler->CurrentSlot;
+}
+
+static VkCommandBuffer GetFrameCommandBuffer(frame_scheduler* Scheduler)
+{
+	VkCommandBuffer Result = Scheduler->CommandBuffers[Scheduler->CurrentSlot];
+	return Result;
+}
+
+// Timeline value the frame currently being recorded will signal
+static u64 GetCurrentFrameValue(frame_scheduler* Scheduler)
+{
+	u64 Result = Scheduler->FramesSubmitted + 1;
+	return Result;
+}
+
+// Everything up to and including this frame has finished on the GPU
+static u64 GetCompletedFrameValue(frame_scheduler* Scheduler)
+{
+	u64 Result = 0;
+	vkGetSemaphoreCounterValue(Scheduler->Device, Scheduler->Timeline, &Result);
+	return Result;
+}
+
+static void PrintFrameSchedulerStats(frame_scheduler* Scheduler)
+{
+	u64 NumFrames = Scheduler->FramesSubmitted ? Scheduler->FramesSubmitted : 1;
+	printf("Frame scheduler (%u frames in flight): %llu frames, CPU waited on the GPU in %llu of them - %.2f ms total, "
+		   "%.3f ms/frame on average, %.3f ms worst\n",
+		   Scheduler->FramesInFlight, (unsigned long long)Scheduler->FramesSubmitted, (unsigned long long)Scheduler->NumFramesWaited,
+		   Scheduler->TotalWaitSeconds * 1000.0, Scheduler->TotalWaitSeconds * 1000.0 / NumFrames, Scheduler->MaxWaitSeconds * 1000.0);
+}
+
+// Command buffers go when their pool does
+static void DestroyFrameScheduler(frame_scheduler* Scheduler)
+{
+	for (u32 i = 0; i < Scheduler->FramesInFlight; i++)
+	{
+		vkDestroySemaphore(Scheduler->Device, Scheduler->ImageAvailable[i], HostCallbacks(HostObject_Semaphore));
+		vkDestroySemaphore(Scheduler->Device, Scheduler->RenderFinished[i], HostCallbacks(HostObject_Semaphore));
+	}
+	vkDestroySemaphore(Scheduler->Device, Scheduler->Timeline, HostCallbacks(HostObject_Semaphore));
+}
+
+// NOTE: Deferred deletion. Things the GPU might still be using go in here tagged with the last frame that could have
+// used them, and get destroyed once the frame timeline passes that value, so nothing has to wait for the device to
+// go idle.
+static constexpr u32 MAX_DEFERRED_DELETIONS = 128;
+static constexpr u32 MAX_RETIRED_SWAPCHAINS = 8;
+
+enum deferred_deletion_kind
+{
+	DeferredDeletion_ImageView,
+	DeferredDeletion_Framebuffer,
+	DeferredDeletion_Image,
+};
 
-	// TODO: I don't understand this at all... what's going on here??
-	VkSubpassDependency Dependency
+struct deferred_deletion
+{
+	u64 FrameValue;
+	deferred_deletion_kind Kind;
+	union
 	{
-		.srcSubpass = VK_SUBPASS_EXTERNAL,
-		.dstSubpass = 0,
-		.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
-		.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT,
-		.srcAccessMask = 0,
-		.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+		VkImageView ImageView;
+		VkFramebuffer Framebuffer;
+		image Image;
 	};
+};
+
+struct deletion_queue
+{
+	VkDevice Device;
+	gpu_allocator* Allocator;
+	frame_scheduler* Frames;
+	deferred_deletion Entries[MAX_DEFERRED_DELETIONS]; // Ring buffer, in FrameValue order
+	u32 First;
+	u32 Num;
+	u64 NumDeleted;
+	// Retired swapchains don't go by the frame timeline, see RetireSwapchain
+	VkSwapchainKHR RetiredSwapchains[MAX_RETIRED_SWAPCHAINS];
+	u32 NumRetiredSwapchains;
+};
+
+static deletion_queue CreateDeletionQueue(VkDevice Device, gpu_allocator* Allocator, frame_scheduler* Frames)
+{
+	deletion_queue Result = {};
+	Result.Device = Device;
+	Result.Allocator = Allocator;
+	Result.Frames = Frames;
+	return Result;
+}
+
+static void DeleteNow(deletion_queue* Queue, deferred_deletion* Deletion)
+{
+	switch (Deletion->Kind)
+	{
+		case DeferredDeletion_ImageView:
+		{
+			vkDestroyImageView(Queue->Device, Deletion->ImageView, HostCallbacks(HostObject_ImageView));
+		} break;
+		case DeferredDeletion_Framebuffer:
+		{
+			vkDestroyFramebuffer(Queue->Device, Deletion->Framebuffer, HostCallbacks(HostObject_Framebuffer));
+		} break;
+		case DeferredDeletion_Image:
+		{
+			DestroyImage(Queue->Allocator, &Deletion->Image);
+		} break;
+		default:
+		{
+			Assert(false);
+		} break;
+	}
+	Queue->NumDeleted++;
+}
 
-	VkAttachmentDescription Attachments[] = { ColourAttachment, DepthAttachment };
-	VkRenderPassCreateInfo RenderPassInfo
+// Destroys everything whose frames have finished. Called once a frame.
+static void CollectDeletions(deletion_queue* Queue)
+{
+	if (Queue->Num)
 	{
-		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
-		.attachmentCount = ArrayCount(Attachments),
-		.pAttachments = Attachments,
-		.subpassCount = 1,
-		.pSubpasses = &Subpass,
-		.dependencyCount = 1,
-		.pDependencies = &Dependency,
-	};
+		u64 CompletedValue = GetCompletedFrameValue(Queue->Frames);
+		while (Queue->Num && Queue->Entries[Queue->First].FrameValue <= CompletedValue)
+		{
+			DeleteNow(Queue, Queue->Entries + Queue->First);
+			Queue->First = (Queue->First + 1) % MAX_DEFERRED_DELETIONS;
+			Queue->Num--;
+		}
+	}
+}
 
-	VkRenderPass Result = VK_NULL_HANDLE;
-	if (vkCreateRenderPass(Device, &RenderPassInfo, nullptr, &Result) != VK_SUCCESS) // pAllocator
+static void DeferDeletion(deletion_queue* Queue, deferred_deletion Deletion)
+{
+	if (Queue->Num == MAX_DEFERRED_DELETIONS)
 	{
-		fprintf(stderr, "Couldn't make that render pass, my dude\n");
-		Assert(false);
+		// Shouldn't really happen - something's being retired every frame. Wait for the oldest rather than fall over.
+		fprintf(stderr, "WARNING: Deletion queue's full, waiting on the GPU\n");
+		WaitForFrame(Queue->Frames, Queue->Entries[Queue->First].FrameValue);
+		CollectDeletions(Queue);
 	}
-	return Result;
+	Queue->Entries[(Queue->First + Queue->Num) % MAX_DEFERRED_DELETIONS] = Deletion;
+	Queue->Num++;
 }
 
-static VkDescriptorSetLayout CreateDescriptorSetLayout(VkDevice Device)
+// Call once the current swapchain has had a present complete (swap_chain::HasCompletedPresent) - every present to the
+// swapchains it replaced went in before that one, so the presentation engine's done with all of them
+static void CollectRetiredSwapchains(deletion_queue* Queue)
 {
-	VkDescriptorSetLayoutBinding UboLayoutBinding
-	{
-		.binding = 0,
-		.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-		.descriptorCount = 1,
-		.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-	};
-	VkDescriptorSetLayoutBinding SamplerLayoutBinding
+	for (u32 i = 0; i < Queue->NumRetiredSwapchains; i++)
 	{
-		.binding = 1,
-		.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-		.descriptorCount = 1,
-		.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
-	};
-	VkDescriptorSetLayoutBinding Bindings[] = { UboLayoutBinding, SamplerLayoutBinding };
+		vkDestroySwapchainKHR(Queue->Device, Queue->RetiredSwapchains[i], HostCallbacks(HostObject_Swapchain));
+		Queue->NumDeleted++;
+	}
+	Queue->NumRetiredSwapchains = 0;
+}
 
-	VkDescriptorSetLayoutCreateInfo LayoutInfo
+static void DeferSwapchainDeletion(deletion_queue* Queue, VkSwapchainKHR Swapchain)
+{
+	if (Queue->NumRetiredSwapchains == MAX_RETIRED_SWAPCHAINS)
 	{
-		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-		.bindingCount = ArrayCount(Bindings),
-		.pBindings = Bindings,
-	};
+		// NOTE: Getting recreated faster than a single present completes (frantic resizing, say). Idling the device at
+		// least gets every present queued - it's the best we can do here, and by now the oldest is long gone from the screen.
+		fprintf(stderr, "WARNING: Too many retired swapchains waiting on presents, waiting on the GPU\n");
+		vkDeviceWaitIdle(Queue->Device);
+		CollectRetiredSwapchains(Queue);
+	}
+	Queue->RetiredSwapchains[Queue->NumRetiredSwapchains++] = Swapchain;
+}
 
-	VkDescriptorSetLayout Result = VK_NULL_HANDLE;
-	if (vkCreateDescriptorSetLayout(Device, &LayoutInfo, nullptr, &Result) != VK_SUCCESS) // pAllocator
+// Only once the device is idle
+static void FlushDeletions(deletion_queue* Queue)
+{
+	while (Queue->Num)
 	{
-		fprintf(stderr, "Failed to create desc set layout\n");
-		Assert(false);
+		DeleteNow(Queue, Queue->Entries + Queue->First);
+		Queue->First = (Queue->First + 1) % MAX_DEFERRED_DELETIONS;
+		Queue->Num--;
 	}
-	return Result;
+	CollectRetiredSwapchains(Queue);
 }
 
-struct vulkan_pipeline
+// NOTE: Recorded command buffer cache. Nothing in the frame's command stream actually changes from frame to frame -
+// per-frame data lives in the uniform ring, at offsets that come out the same every time - so in this mode there's
+// one command buffer per swapchain image, recorded once and resubmitted until something that's baked into it changes
+// (swapchain recreated, a scene resource reloaded, the draw list changed), at which point the version gets bumped and
+// each image's command buffer is re-recorded the next time that image comes round.
+// A cached command buffer can't be re-recorded (or resubmitted) while it's still executing, and its uniform region
+// can't be rewritten either, so before using image i we wait for the last frame that drew to it.
+static constexpr u32 MAX_CACHED_SWAPCHAIN_IMAGES = 8;
+
+struct command_cache
 {
-	VkPipeline Handle;
-	VkPipelineLayout Layout;
+	b32 Enabled;
+	u64 Version; // Bumped whenever something that's baked into the command buffers changes
+	VkCommandBuffer CommandBuffers[MAX_CACHED_SWAPCHAIN_IMAGES];
+	u64 RecordedVersion[MAX_CACHED_SWAPCHAIN_IMAGES];
+	u64 LastFrameUsed[MAX_CACHED_SWAPCHAIN_IMAGES]; // Frame timeline value
+	u64 NumRecordings;
 };
 
-static vulkan_pipeline CreateGraphicsPipeline(VkDevice Device, swap_chain* Swapchain, VkRenderPass RenderPass, VkDescriptorSetLayout DescSetLayout)
+static command_cache CreateCommandCache(VkDevice Device, VkCommandPool CommandPool, b32 Enabled)
 {
-	file_buffer VertShaderCode = LoadFile("shaders/vert.spv");
-	file_buffer FragShaderCode = LoadFile("shaders/frag.spv");
-
-	VkShaderModule VertShaderModule = CreateShaderModule(Device, VertShaderCode);
-	VkShaderModule FragShaderModule = CreateShaderModule(Device, FragShaderCode);
-	free(VertShaderCode.Contents);
-	free(FragShaderCode.Contents);
-
-	VkPipelineShaderStageCreateInfo VertShaderStageInfo
-	{
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-		.stage = VK_SHADER_STAGE_VERTEX_BIT,
-		.module = VertShaderModule,
-		.pName = "main",
-	};
-	VkPipelineShaderStageCreateInfo FragShaderStageInfo
+	command_cache Result = {};
+	Result.Enabled = Enabled;
+	Result.Version = 1;
+	if (Enabled)
 	{
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-		.stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-		.module = FragShaderModule,
-		.pName = "main",
-	};
-	VkPipelineShaderStageCreateInfo ShaderStages[] = { VertShaderStageInfo, FragShaderStageInfo };
-
-	static constexpr VkDynamicState DYNAMIC_STATES[] =  { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+		VkCommandBufferAllocateInfo AllocInfo
+		{
+			.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+			.commandPool = CommandPool,
+			.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+			.commandBufferCount = MAX_CACHED_SWAPCHAIN_IMAGES,
+		};
+		if (vkAllocateCommandBuffers(Device, &AllocInfo, Result.CommandBuffers) != VK_SUCCESS)
+		{
+			fprintf(stderr, "Failed to allocate cached command buffers\n");
+			Assert(false);
+		}
+	}
+	return Result;
+}
 
-	VkPipelineDynamicStateCreateInfo DynamicState
-	{
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
-		.dynamicStateCount = ArrayCount(DYNAMIC_STATES),
-		.pDynamicStates = DYNAMIC_STATES,
-	};
+static void MarkCommandCacheDirty(command_cache* Cache)
+{
+	Cache->Version++;
+}
 
-	VkVertexInputBindingDescription BindingDesc = vertex::GetBindingDescription();
-	vertex::attr_desc AttrDesc = vertex::GetAttributeDescriptions();
+// NOTE: Parallel recording. The draw list gets split into one chunk per worker, and each chunk is a job that records
+// into its own secondary command buffer, which the frame's primary then runs with vkCmdExecuteCommands. Every chunk
+// has its own command pool per frame slot (pools can't be touched from two threads at once, and whichever worker picks
+// up chunk i is the only one touching pool i), and resets the whole pool at the start of the frame - by then
+// BeginFrame has made sure the GPU is done with whatever was in it.
+// Not worth it for a handful of draws, since each secondary re-binds all its state.
+static constexpr u32 PARALLEL_RECORD_MIN_DRAWS_PER_WORKER = 256;
 
-	VkPipelineVertexInputStateCreateInfo VertextInputInfo
-	{
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-		.vertexBindingDescriptionCount = 1,
-		.pVertexBindingDescriptions = &BindingDesc,
-		.vertexAttributeDescriptionCount = AttrDesc.Size,
-		.pVertexAttributeDescriptions = AttrDesc.Data,
-	};
+struct parallel_recorder
+{
+	VkDevice Device;
+	u32 NumWorkers;
+	u32 NumSlots;
+	VkCommandPool Pools[MAX_FRAMES_IN_FLIGHT][MAX_WORKERS];
+	VkCommandBuffer Secondaries[MAX_FRAMES_IN_FLIGHT][MAX_WORKERS];
+};
 
-	VkPipelineInputAssemblyStateCreateInfo InputAssembly
+static parallel_recorder CreateParallelRecorder(VkDevice Device, u32 QueueFamilyIndex, u32 NumWorkers, u32 NumSlots)
+{
+	parallel_recorder Result = {};
+	Result.Device = Device;
+	Result.NumWorkers = NumWorkers;
+	Result.NumSlots = NumSlots;
+	for (u32 Slot = 0; Slot < NumSlots; Slot++)
 	{
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
-		.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
-	};
+		for (u32 Worker = 0; Worker < NumWorkers; Worker++)
+		{
+			Result.Pools[Slot][Worker] = CreateCommandPool(Device, QueueFamilyIndex, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+			VkCommandBufferAllocateInfo AllocInfo
+			{
+				.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+				.commandPool = Result.Pools[Slot][Worker],
+				.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+				.commandBufferCount = 1,
+			};
+			if (vkAllocateCommandBuffers(Device, &AllocInfo, &Result.Secondaries[Slot][Worker]) != VK_SUCCESS)
+			{
+				fprintf(stderr, "Failed to allocate secondary command buffers\n");
+				Assert(false);
+			}
+		}
+	}
+	return Result;
+}
 
-	VkViewport Viewport
-	{
-		.x = 0.0f,
-		.y = 0.0f,
-		.width = (f32)Swapchain->Extents.width,
-		.height = (f32)Swapchain->Extents.height,
-		.minDepth = 0.0f,
-		.maxDepth = 1.0f,
-	};
-	VkRect2D Scissor
+static void DestroyParallelRecorder(parallel_recorder* Recorder)
+{
+	for (u32 Slot = 0; Slot < Recorder->NumSlots; Slot++)
 	{
-		.offset = { .x = 0, .y = 0 },
-		.extent = Swapchain->Extents,
-	};
+		for (u32 Worker = 0; Worker < Recorder->NumWorkers; Worker++)
+		{
+			vkDestroyCommandPool(Recorder->Device, Recorder->Pools[Slot][Worker], HostCallbacks(HostObject_CommandPool));
+		}
+	}
+}
 
-	VkPipelineViewportStateCreateInfo ViewportState
-	{
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
-		.viewportCount = 1,
-		.scissorCount = 1,
-	};
+// How long presents take to go through, per present mode, so they can be compared after flipping between them
+struct present_stats
+{
+	u64 NumPresents;
+	f64 AcquireSeconds; // Blocked in vkAcquireNextImageKHR
+	f64 AcquireToPresentSeconds; // From getting the image to handing it back
+	f64 MaxAcquireToPresentSeconds;
+	u64 NumDisplayed; // Only ones we saw hit the screen, so only with VK_KHR_present_wait
+	f64 PresentToDisplaySeconds;
+	f64 MaxPresentToDisplaySeconds;
+};
 
-	VkPipelineRasterizationStateCreateInfo Rasteriser
-	{
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
-		.polygonMode = VK_POLYGON_MODE_FILL,
-		.cullMode = VK_CULL_MODE_BACK_BIT,
-		.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE, // Temp change because of y-coord flip in proj. matrix??
-		.lineWidth = 1.0f, // TODO: I'm not drawing any lines, do I need this??
-	};
+static constexpr u32 MAX_PENDING_PRESENTS = 16;
 
-	VkPipelineMultisampleStateCreateInfo Multisampling
-	{
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
-		.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
-		.sampleShadingEnable = VK_FALSE,
-		.minSampleShading = 1.0f,
-	};
+struct pending_present
+{
+	u64 PresentId;
+	present_policy PresentPolicy;
+	std::chrono::high_resolution_clock::time_point PresentedAt;
+};
 
-	// TODO: This sets basic bitch alpha blending - is this actually what we want?
-	VkPipelineColorBlendAttachmentState ColourBlendAttachment
-	{
-		.blendEnable = VK_TRUE,
-		.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
-		.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
-		.colorBlendOp = VK_BLEND_OP_ADD,
-		.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
-		.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO, // TODO: Is this right?? We're not taking the dest alpha into account at all??
-		.alphaBlendOp = VK_BLEND_OP_ADD,
-		.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
-	};
+// NOTE: vkWaitForPresentKHR needs the swapchain externally synchronised, same as presenting does, so rather than blocking
+// another thread on it we poll with a zero timeout from the frame loop. That means present-to-display is only as fine
+// grained as our frame rate - it's an upper bound, and it's off by at most a frame.
+struct present_timer
+{
+	PFN_vkWaitForPresentKHR WaitForPresent; // Null if we don't have VK_KHR_present_wait
+	u64 NextPresentId;
+	pending_present Pending[MAX_PENDING_PRESENTS];
+	u32 FirstPending;
+	u32 NumPending;
+	u64 NumLost; // Fell out of the ring or went down with a swapchain before we saw them displayed
+	present_stats Stats[PresentPolicy_Count];
+};
 
-	VkPipelineDepthStencilStateCreateInfo DepthStencil
+static present_timer CreatePresentTimer(VkDevice Device, b32 HasPresentWait)
+{
+	present_timer Result = {};
+	// Present IDs have to go up for each present to a swapchain, and 0 means no ID, so just count up from 1 forever
+	Result.NextPresentId = 1;
+	if (HasPresentWait)
 	{
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
-		.depthTestEnable = VK_TRUE,
-		.depthWriteEnable = VK_TRUE,
-		.depthCompareOp = VK_COMPARE_OP_LESS,
-		.depthBoundsTestEnable = VK_FALSE,
-		.stencilTestEnable = VK_FALSE,
-	};
+		Result.WaitForPresent = (PFN_vkWaitForPresentKHR)vkGetDeviceProcAddr(Device, "vkWaitForPresentKHR");
+	}
+	return Result;
+}
 
-	VkPipelineColorBlendStateCreateInfo GlobalColourBlend
+// Returns true if any present has been displayed since last time
+static b32 PollPresents(present_timer* Timer, VkDevice Device, VkSwapchainKHR Swapchain)
+{
+	b32 Result = false;
+	std::chrono::time_point Now = std::chrono::high_resolution_clock::now();
+	while (Timer->NumPending)
 	{
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
-		.logicOpEnable = VK_FALSE,
-		.attachmentCount = 1,
-		.pAttachments = &ColourBlendAttachment,
-	};
+		pending_present* Present = Timer->Pending + Timer->FirstPending;
+		VkResult CallResult = Timer->WaitForPresent(Device, Swapchain, Present->PresentId, 0);
+		if (CallResult == VK_TIMEOUT)
+		{
+			// They complete in order, so nothing after this one is up yet either
+			break;
+		}
+		if (CallResult == VK_SUCCESS)
+		{
+			present_stats* Stats = Timer->Stats + Present->PresentPolicy;
+			f64 Seconds = std::chrono::duration<f64>(Now - Present->PresentedAt).count();
+			Stats->NumDisplayed++;
+			Stats->PresentToDisplaySeconds += Seconds;
+			Result = true;
+			if (Seconds > Stats->MaxPresentToDisplaySeconds)
+			{
+				Stats->MaxPresentToDisplaySeconds = Seconds;
+			}
+		}
+		else
+		{
+			// Out of date or the surface went away - either way it's never getting displayed
+			Timer->NumLost++;
+		}
+		Timer->FirstPending = (Timer->FirstPending + 1) % MAX_PENDING_PRESENTS;
+		Timer->NumPending--;
+	}
+	return Result;
+}
 
-	VkPipelineLayoutCreateInfo LayoutCreateInfo
+// Returns the ID to chain onto the present, or 0 if we're not tracking them
+static u64 TrackPresent(present_timer* Timer, present_policy PresentPolicy,
+						std::chrono::high_resolution_clock::time_point AcquiredAt,
+						std::chrono::high_resolution_clock::time_point PresentedAt,
+						f64 AcquireSeconds)
+{
+	present_stats* Stats = Timer->Stats + PresentPolicy;
+	f64 Seconds = std::chrono::duration<f64>(PresentedAt - AcquiredAt).count();
+	Stats->NumPresents++;
+	Stats->AcquireSeconds += AcquireSeconds;
+	Stats->AcquireToPresentSeconds += Seconds;
+	if (Seconds > Stats->MaxAcquireToPresentSeconds)
 	{
-		.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-		.setLayoutCount = 1,
-		.pSetLayouts = &DescSetLayout,
-	};
+		Stats->MaxAcquireToPresentSeconds = Seconds;
+	}
 
-	vulkan_pipeline Result = {};
-	if (vkCreatePipelineLayout(Device, &LayoutCreateInfo, nullptr, &Result.Layout) == VK_SUCCESS) // pAllocator
+	u64 Result = 0;
+	if (Timer->WaitForPresent)
 	{
-		VkGraphicsPipelineCreateInfo PipelineInfo
+		if (Timer->NumPending == MAX_PENDING_PRESENTS)
 		{
-			.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-			.stageCount = 2,
-			.pStages = ShaderStages,
-			.pVertexInputState = &VertextInputInfo,
-			.pInputAssemblyState = &InputAssembly,
-			.pViewportState = &ViewportState,
-			.pRasterizationState = &Rasteriser,
-			.pMultisampleState = &Multisampling,
-			.pDepthStencilState = &DepthStencil,
-			.pColorBlendState = &GlobalColourBlend,
-			.pDynamicState = &DynamicState,
-			.layout = Result.Layout,
-			.renderPass = RenderPass,
-			.subpass = 0,
+			Timer->FirstPending = (Timer->FirstPending + 1) % MAX_PENDING_PRESENTS;
+			Timer->NumPending--;
+			Timer->NumLost++;
+		}
+		Result = Timer->NextPresentId++;
+		Timer->Pending[(Timer->FirstPending + Timer->NumPending) % MAX_PENDING_PRESENTS] =
+		{
+			.PresentId = Result,
+			.PresentPolicy = PresentPolicy,
+			.PresentedAt = PresentedAt,
 		};
-		if (vkCreateGraphicsPipelines(Device, VK_NULL_HANDLE, 1, &PipelineInfo, nullptr, &Result.Handle) != VK_SUCCESS) // pAllocator
+		Timer->NumPending++;
+	}
+	return Result;
+}
+
+// The old swapchain's presents can't be waited on through the new one, so whatever's still pending is lost
+static void ForgetPendingPresents(present_timer* Timer)
+{
+	Timer->NumLost += Timer->NumPending;
+	Timer->FirstPending = 0;
+	Timer->NumPending = 0;
+}
+
+static void PrintPresentStats(present_timer* Timer)
+{
+	for (u32 i = 0; i < PresentPolicy_Count; i++)
+	{
+		present_stats* Stats = Timer->Stats + i;
+		if (Stats->NumPresents)
 		{
-			fprintf(stderr, "Failed to create graphics pipeline\n");
-			Assert(false);
+			printf("Present mode %s: %llu presents, %.2f ms blocked acquiring, %.2f ms acquire to present (%.2f max)",
+				   PRESENT_POLICY_NAMES[i], (unsigned long long)Stats->NumPresents,
+				   Stats->AcquireSeconds * 1000.0 / Stats->NumPresents,
+				   Stats->AcquireToPresentSeconds * 1000.0 / Stats->NumPresents,
+				   Stats->MaxAcquireToPresentSeconds * 1000.0);
+			if (Stats->NumDisplayed)
+			{
+				printf(", %.2f ms present to display (%.2f max)\n",
+					   Stats->PresentToDisplaySeconds * 1000.0 / Stats->NumDisplayed, Stats->MaxPresentToDisplaySeconds * 1000.0);
+			}
+			else
+			{
+				printf("\n");
+			}
 		}
 	}
+	if (Timer->WaitForPresent)
+	{
+		printf("Lost track of %llu presents\n", (unsigned long long)Timer->NumLost);
+	}
 	else
 	{
-		fprintf(stderr, "Couldn't create that pipeline layout\n");
-		Assert(false);
+		printf("No VK_KHR_present_wait, so no present to display times\n");
 	}
+}
+
+// NOTE: Frame capture, for offline rendering. Each captured frame gets a small extra command buffer, submitted right
+// after the frame's own, that copies the finished colour image into one of a ring of persistently mapped readback
+// buffers. The frame loop only ever checks the frame timeline to see which copies are done (it never waits on one)
+// and hands those over to the encoder thread, which writes them out and puts the buffer back in the ring. If the
+// encoder falls behind and the ring fills up, frames get dropped (and counted) rather than stalling the frame loop -
+// except headless, where it's an offline render and every frame has to make it, so RunHeadless waits for a free buffer
+// before each frame (see WaitForFreeReadback) and DrawFrame itself still never waits.
+static constexpr u32 MAX_READBACKS = 8;
+static constexpr size_t CAPTURE_ROW_ARENA_SIZE = 256 * 1024; // One converted row at a time, so up to ~64k pixels wide
+
+enum capture_format
+{
+	CaptureFormat_Raw, // Tightly packed RGBA8, no header
+	CaptureFormat_Ppm,
+	CaptureFormat_Png, // Uncompressed (stored deflate blocks) - as fast to write as the raw one, and opens anywhere
+
+	CaptureFormat_Count
+};
+
+static constexpr const char* CAPTURE_FORMAT_NAMES[CaptureFormat_Count] =
+{
+	"raw",
+	"ppm",
+	"png",
+};
+
+enum readback_status : u32
+{
+	Readback_Free,
+	Readback_Copying, // Submitted, GPU's not done with it yet
+	Readback_Encoding, // Queued up for (or being written out by) the encoder thread
+};
+
+struct readback
+{
+	vulkan_buffer Buffer;
+	VkDeviceSize Size; // What the buffer was created for, the allocation's usually bigger
+	b32 Coherent; // Otherwise it needs invalidating before the encoder reads it
+	std::atomic<u32> Status;
+	u64 FrameValue; // Done once the frame timeline gets here
+	u64 FrameNumber;
+	VkExtent2D Extents;
+	b32 Bgra; // Swapchain images usually are, every format we write is RGB(A)
+};
+
+struct frame_capture
+{
+	b32 Enabled;
+	const char* Prefix; // Files go to <Prefix>_<frame number>.<format>
+	capture_format Format;
+	gpu_allocator* Allocator;
+	VkCommandBuffer* CommandBuffers; // One per frame in flight, just for the copy
+	readback Readbacks[MAX_READBACKS];
+	u32 NextReadback; // They get used (and finish) in order, so this is also the oldest one
+	u64 NumDropped;
+	u64 NumStalls;
+	f64 StallSeconds;
+
+	std::thread Thread;
+	std::mutex Mutex;
+	std::condition_variable WakeUp;
+	std::condition_variable ReadbackFreed; // Only waited on by WaitForFreeReadback
+	u32 Queue[MAX_READBACKS]; // Readbacks waiting on the encoder, oldest first
+	u32 FirstQueued;
+	u32 NumQueued;
+	b32 ShuttingDown;
+
+	// Only touched by the encoder thread (and read back after it's joined)
+	memory_arena RowArena;
+	u32 CrcTables[8][256]; // Slice-by-8
+	u64 NumWritten;
+	u64 BytesWritten;
+	f64 EncodeSeconds;
+};
 
-	vkDestroyShaderModule(Device, VertShaderModule, nullptr); // pAllocator
-	vkDestroyShaderModule(Device, FragShaderModule, nullptr); // pAllocator
+static frame_capture s_Capture;
 
+static b32 IsCapturableFormat(VkFormat Format)
+{
+	b32 Result = Format == VK_FORMAT_R8G8B8A8_UNORM || Format == VK_FORMAT_R8G8B8A8_SRGB ||
+				 Format == VK_FORMAT_B8G8R8A8_UNORM || Format == VK_FORMAT_B8G8R8A8_SRGB;
 	return Result;
 }
 
-static VkCommandPool CreateCommandPool(VkDevice Device, u32 QueueFamilyIndex)
+static b32 CanCaptureSwapchain(swap_chain* Swapchain)
 {
-	VkCommandPoolCreateInfo PoolInfo
+	b32 Result = (Swapchain->Usage & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) && IsCapturableFormat(Swapchain->Format);
+	return Result;
+}
+
+static u32 LoadLittleEndian(const u8* Source)
+{
+	u32 Result = Source[0] | (Source[1] << 8) | (Source[2] << 16) | ((u32)Source[3] << 24);
+	return Result;
+}
+
+// NOTE: Eight bytes a step, Tables[k] being the CRC of a byte followed by k zero bytes. Whole images go through
+// here, the one-byte-at-a-time version was most of the encode time.
+static u32 UpdateCrc(const u32 (*Tables)[256], u32 Crc, const u8* Data, size_t Size)
+{
+	while (Size >= 8)
 	{
-		.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-		.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
-		.queueFamilyIndex = QueueFamilyIndex,
-	};
-	VkCommandPool Result = VK_NULL_HANDLE;
-	if (vkCreateCommandPool(Device, &PoolInfo, nullptr, &Result) != VK_SUCCESS) // pAllocator
+		u32 Lo = Crc ^ LoadLittleEndian(Data);
+		u32 Hi = LoadLittleEndian(Data + 4);
+		Crc = Tables[7][Lo & 0xFF] ^ Tables[6][(Lo >> 8) & 0xFF] ^ Tables[5][(Lo >> 16) & 0xFF] ^ Tables[4][Lo >> 24] ^
+			  Tables[3][Hi & 0xFF] ^ Tables[2][(Hi >> 8) & 0xFF] ^ Tables[1][(Hi >> 16) & 0xFF] ^ Tables[0][Hi >> 24];
+		Data += 8;
+		Size -= 8;
+	}
+	for (size_t i = 0; i < Size; i++)
 	{
-		fprintf(stderr, "Failed to create command pool homies\n");
-		Assert(false);
+		Crc = Tables[0][(Crc ^ Data[i]) & 0xFF] ^ (Crc >> 8);
 	}
-	return Result;
+	return Crc;
 }
 
-// TODO: How is this different from the number of Swapchain image views??
-static constexpr u32 MAX_FRAMES_IN_FLIGHT = 2;
+// Most bytes we can sum before the second half could overflow 32 bits, so the modulos only happen once per that many
+static constexpr u32 ADLER_MAX_RUN = 5552;
+
+static void UpdateAdler(u32* Adler1, u32* Adler2, const u8* Data, size_t Size)
+{
+	u32 A = *Adler1;
+	u32 B = *Adler2;
+	while (Size)
+	{
+		size_t Run = Size < ADLER_MAX_RUN ? Size : ADLER_MAX_RUN;
+		for (size_t i = 0; i < Run; i++)
+		{
+			A += Data[i];
+			B += A;
+		}
+		A %= 65521;
+		B %= 65521;
+		Data += Run;
+		Size -= Run;
+	}
+	*Adler1 = A;
+	*Adler2 = B;
+}
+
+// NOTE: Everything in a PNG goes out as a chunk, with its CRC running over the type and the data
+struct png_writer
+{
+	FILE* File;
+	const u32 (*CrcTables)[256];
+	u32 Crc;
+	u32 Adler1; // Adler-32 of the uncompressed data, in two halves
+	u32 Adler2;
+	u64 RawLeft; // Uncompressed bytes still to come
+	u32 BlockLeft; // In the current stored block
+};
+
+static void PutBigEndian(u8* Dest, u32 Value)
+{
+	Dest[0] = (u8)(Value >> 24);
+	Dest[1] = (u8)(Value >> 16);
+	Dest[2] = (u8)(Value >> 8);
+	Dest[3] = (u8)Value;
+}
+
+static void PngWrite(png_writer* Png, const void* Data, size_t Size)
+{
+	fwrite(Data, 1, Size, Png->File);
+	Png->Crc = UpdateCrc(Png->CrcTables, Png->Crc, (const u8*)Data, Size);
+}
+
+static void PngBeginChunk(png_writer* Png, const char* Type, u32 Size)
+{
+	u8 Length[4];
+	PutBigEndian(Length, Size);
+	fwrite(Length, 1, sizeof(Length), Png->File);
+	Png->Crc = 0xFFFFFFFF;
+	PngWrite(Png, Type, 4);
+}
+
+static void PngEndChunk(png_writer* Png)
+{
+	u8 Crc[4];
+	PutBigEndian(Crc, Png->Crc ^ 0xFFFFFFFF);
+	fwrite(Crc, 1, sizeof(Crc), Png->File);
+}
 
-static VkCommandBuffer* CreateCommandBuffers(VkDevice Device, VkCommandPool CommandPool)
+// Splits the image data into stored (uncompressed) deflate blocks as it goes - they can't be bigger than 64K
+static void PngWriteImageData(png_writer* Png, const u8* Data, u32 Size)
 {
-	VkCommandBufferAllocateInfo AllocInfo
-	{
-		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-		.commandPool = CommandPool,
-		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-		.commandBufferCount = MAX_FRAMES_IN_FLIGHT,
-	};
-	VkCommandBuffer* Result = AllocArray(VkCommandBuffer, MAX_FRAMES_IN_FLIGHT);
-	// TODO: Does this just allocate GPU memory (in some opaque way), hence why we're not passing a pAllocator?
-	if (vkAllocateCommandBuffers(Device, &AllocInfo, Result) != VK_SUCCESS)
+	while (Size)
 	{
-		fprintf(stderr, "Failed to allocate command buffers my dudes\n");
-		Assert(false);
+		if (Png->BlockLeft == 0)
+		{
+			u32 BlockSize = Png->RawLeft < 0xFFFF ? (u32)Png->RawLeft : 0xFFFF;
+			u8 Header[5] =
+			{
+				(u8)(Png->RawLeft == BlockSize), // Is it the last block
+				(u8)BlockSize, (u8)(BlockSize >> 8),
+				(u8)~BlockSize, (u8)(~BlockSize >> 8),
+			};
+			PngWrite(Png, Header, sizeof(Header));
+			Png->BlockLeft = BlockSize;
+		}
+		u32 Bytes = Size < Png->BlockLeft ? Size : Png->BlockLeft;
+		PngWrite(Png, Data, Bytes);
+		UpdateAdler(&Png->Adler1, &Png->Adler2, Data, Bytes);
+		Png->BlockLeft -= Bytes;
+		Png->RawLeft -= Bytes;
+		Data += Bytes;
+		Size -= Bytes;
 	}
-	return Result;
 }
 
-struct vulkan_buffer
-{
-	VkBuffer Handle;
-	VkDeviceMemory Memory;
-};
-
-static vulkan_buffer CreateBuffer(VkDevice Device, 
-								  VkPhysicalDevice PhysicalDevice, 
-								  VkDeviceSize Size, 
-								  VkBufferUsageFlags UsageFlags, 
-								  VkMemoryPropertyFlags PropertyFlags)
+// Pixels are RGBA8 (or BGRA8), tightly packed. Returns the number of bytes written, 0 if it failed.
+static u64 WriteCapture(frame_capture* Capture, const char* FileName, const u8* Pixels, VkExtent2D Extents, b32 Bgra)
 {
-	VkBufferCreateInfo BufferInfo
+	u64 Result = 0;
+	FILE* File = fopen(FileName, "wb");
+	if (!File)
 	{
-		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-		.size = Size,
-		.usage = UsageFlags,
-		.sharingMode = VK_SHARING_MODE_EXCLUSIVE
-	};
+		fprintf(stderr, "Couldn't open '%s' to write the capture to\n", FileName);
+		return Result;
+	}
 
-	vulkan_buffer Result = {};
-	if (vkCreateBuffer(Device, &BufferInfo, nullptr, &Result.Handle) == VK_SUCCESS) // pAllocator
+	temp_memory Temp = BeginTempMemory(&Capture->RowArena);
+	// Room for a filter byte in front, for PNGs
+	u8* Row = PushArray(&Capture->RowArena, u8, Extents.width * 4 + 1);
+	u32 Channels = Capture->Format == CaptureFormat_Raw ? 4 : 3;
+	u32 RowSize = Extents.width * Channels;
+
+	png_writer Png = {};
+	if (Capture->Format == CaptureFormat_Ppm)
 	{
-		VkMemoryRequirements MemRequirements;
-		vkGetBufferMemoryRequirements(Device, Result.Handle, &MemRequirements);
+		fprintf(File, "P6\n%u %u\n255\n", Extents.width, Extents.height);
+	}
+	else if (Capture->Format == CaptureFormat_Png)
+	{
+		static constexpr u8 PNG_SIGNATURE[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+		fwrite(PNG_SIGNATURE, 1, sizeof(PNG_SIGNATURE), File);
+		Png = { .File = File, .CrcTables = Capture->CrcTables, .Adler1 = 1, .Adler2 = 0 };
+
+		u8 Header[13] = {};
+		PutBigEndian(Header, Extents.width);
+		PutBigEndian(Header + 4, Extents.height);
+		Header[8] = 8; // Bits per channel
+		Header[9] = 2; // RGB
+		PngBeginChunk(&Png, "IHDR", sizeof(Header));
+		PngWrite(&Png, Header, sizeof(Header));
+		PngEndChunk(&Png);
+
+		// Every row gets a filter byte (0, no filter), then the whole lot goes in stored blocks between the zlib header
+		// (no compression, no dictionary) and the Adler-32 - so we know exactly how big the one IDAT chunk is up front
+		Png.RawLeft = (u64)Extents.height * (RowSize + 1);
+		u64 NumBlocks = (Png.RawLeft + 0xFFFE) / 0xFFFF;
+		u64 IdatSize = 2 + NumBlocks * 5 + Png.RawLeft + 4;
+		PngBeginChunk(&Png, "IDAT", (u32)IdatSize);
+		u8 ZlibHeader[2] = { 0x78, 0x01 };
+		PngWrite(&Png, ZlibHeader, sizeof(ZlibHeader));
+	}
 
-		u32 MemoryIndex = FindMemoryType(MemRequirements.memoryTypeBits,
-										 PropertyFlags,
-										 PhysicalDevice);
-		VkMemoryAllocateInfo AllocInfo
+	for (u32 y = 0; y < Extents.height; y++)
+	{
+		const u8* Source = Pixels + (size_t)y * Extents.width * 4;
+		u8* Dest = Row + 1;
+		for (u32 x = 0; x < Extents.width; x++)
 		{
-			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-			.allocationSize = MemRequirements.size,
-			.memoryTypeIndex = MemoryIndex,
-		};
-
-		if (vkAllocateMemory(Device, &AllocInfo, nullptr, &Result.Memory) == VK_SUCCESS) // pAllocator
+			Dest[0] = Source[Bgra ? 2 : 0];
+			Dest[1] = Source[1];
+			Dest[2] = Source[Bgra ? 0 : 2];
+			if (Channels == 4)
+			{
+				Dest[3] = Source[3];
+			}
+			Source += 4;
+			Dest += Channels;
+		}
+		if (Capture->Format == CaptureFormat_Png)
 		{
-			vkBindBufferMemory(Device, Result.Handle, Result.Memory, 0);
+			Row[0] = 0;
+			PngWriteImageData(&Png, Row, RowSize + 1);
 		}
 		else
 		{
-			fprintf(stderr, "Failed to allocate buffer memory.\n");
-			Assert(false);
+			fwrite(Row + 1, 1, RowSize, File);
 		}
 	}
-	else
+
+	if (Capture->Format == CaptureFormat_Png)
 	{
-		fprintf(stderr, "Failed to create buffer.\n");
-		Assert(false);
+		u8 Adler[4];
+		PutBigEndian(Adler, (Png.Adler2 << 16) | Png.Adler1);
+		PngWrite(&Png, Adler, sizeof(Adler));
+		PngEndChunk(&Png);
+		PngBeginChunk(&Png, "IEND", 0);
+		PngEndChunk(&Png);
+	}
+	EndTempMemory(Temp);
+
+	Result = ftell(File);
+	if (ferror(File))
+	{
+		fprintf(stderr, "Failed writing the capture to '%s'\n", FileName);
+		Result = 0;
 	}
+	fclose(File);
 	return Result;
 }
 
-static VkCommandBuffer BeginOneOffCommand(VkCommandPool CommandPool, VkDevice Device)
+static void CaptureThreadProc()
 {
-	VkCommandBufferAllocateInfo AllocInfo
+	frame_capture* Capture = &s_Capture;
+	for (;;)
 	{
-		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-		.commandPool = CommandPool,
-		.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-		.commandBufferCount = 1,
-	};
-
-	VkCommandBuffer CommandBuffer = VK_NULL_HANDLE;
-	vkAllocateCommandBuffers(Device, &AllocInfo, &CommandBuffer);
+		readback* Readback = nullptr;
+		{
+			std::unique_lock<std::mutex> Lock(Capture->Mutex);
+			while (Capture->NumQueued == 0 && !Capture->ShuttingDown)
+			{
+				Capture->WakeUp.wait(Lock);
+			}
+			// NOTE: Shutting down still drains the queue first
+			if (Capture->NumQueued == 0)
+			{
+				break;
+			}
+			Readback = Capture->Readbacks + Capture->Queue[Capture->FirstQueued];
+			Capture->FirstQueued = (Capture->FirstQueued + 1) % MAX_READBACKS;
+			Capture->NumQueued--;
+		}
 
-	VkCommandBufferBeginInfo BeginInfo
-	{
-		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
-	};
-	vkBeginCommandBuffer(CommandBuffer, &BeginInfo);
-	return CommandBuffer;
+		std::chrono::time_point Start = std::chrono::high_resolution_clock::now();
+		char FileName[1024];
+		snprintf(FileName, sizeof(FileName), "%s_%06llu.%s", Capture->Prefix, (unsigned long long)Readback->FrameNumber,
+				 CAPTURE_FORMAT_NAMES[Capture->Format]);
+		u64 Bytes = WriteCapture(Capture, FileName, (const u8*)Readback->Buffer.Allocation.Mapped, Readback->Extents, Readback->Bgra);
+		if (Bytes)
+		{
+			Capture->NumWritten++;
+			Capture->BytesWritten += Bytes;
+		}
+		Capture->EncodeSeconds += std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - Start).count();
+		{
+			// Under the lock, or the frame loop could miss the wake-up between checking and waiting
+			std::lock_guard<std::mutex> Lock(Capture->Mutex);
+			Readback->Status.store(Readback_Free, std::memory_order_release);
+		}
+		Capture->ReadbackFreed.notify_one();
+	}
 }
 
-static void EndOneOffCommand(VkCommandBuffer CommandBuffer, VkQueue GraphicsQueue, VkCommandPool CommandPool, VkDevice Device)
+static void InitFrameCapture(memory_arena* Arena, VkDevice Device, gpu_allocator* Allocator, VkCommandPool CommandPool,
+							 u32 FramesInFlight, const char* Prefix, capture_format Format)
 {
-	vkEndCommandBuffer(CommandBuffer);
-
-	VkSubmitInfo SubmitInfo
+	frame_capture* Capture = &s_Capture;
+	Capture->Enabled = true;
+	Capture->Prefix = Prefix;
+	Capture->Format = Format;
+	Capture->Allocator = Allocator;
+	Capture->CommandBuffers = CreateCommandBuffers(Arena, Device, CommandPool, FramesInFlight);
+	Capture->RowArena = CreateArena("Capture rows", CAPTURE_ROW_ARENA_SIZE);
+	for (u32 i = 0; i < 256; i++)
 	{
-		.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-		.commandBufferCount = 1,
-		.pCommandBuffers = &CommandBuffer,
-	};
-	vkQueueSubmit(GraphicsQueue, 1, &SubmitInfo, VK_NULL_HANDLE);
-	vkQueueWaitIdle(GraphicsQueue);
-
-	vkFreeCommandBuffers(Device, CommandPool, 1, &CommandBuffer);
+		u32 Crc = i;
+		for (u32 Bit = 0; Bit < 8; Bit++)
+		{
+			Crc = (Crc & 1) ? 0xEDB88320 ^ (Crc >> 1) : Crc >> 1;
+		}
+		Capture->CrcTables[0][i] = Crc;
+	}
+	for (u32 i = 0; i < 256; i++)
+	{
+		for (u32 Slice = 1; Slice < ArrayCount(Capture->CrcTables); Slice++)
+		{
+			u32 Previous = Capture->CrcTables[Slice - 1][i];
+			Capture->CrcTables[Slice][i] = Capture->CrcTables[0][Previous & 0xFF] ^ (Previous >> 8);
+		}
+	}
+	Capture->Thread = std::thread(CaptureThreadProc);
 }
 
-static void CopyBuffer(VkBuffer SrcBuffer, VkBuffer DestBuffer, VkDeviceSize Size, VkDevice Device, VkCommandPool CommandPool, VkQueue GraphicsQueue)
+// Hands every readback the GPU's finished with over to the encoder. Never waits.
+static void CollectReadbacks(u64 CompletedFrameValue)
 {
-	VkCommandBuffer CommandBuffer = BeginOneOffCommand(CommandPool, Device);
-
-	VkBufferCopy CopyRegion
+	frame_capture* Capture = &s_Capture;
+	u32 NumReady = 0;
+	for (u32 i = 0; i < MAX_READBACKS; i++)
 	{
-		.size = Size
-	};
-	vkCmdCopyBuffer(CommandBuffer, SrcBuffer, DestBuffer, 1, &CopyRegion);
-	
-	EndOneOffCommand(CommandBuffer, GraphicsQueue, CommandPool, Device);
+		u32 Index = (Capture->NextReadback + i) % MAX_READBACKS;
+		readback* Readback = Capture->Readbacks + Index;
+		if (Readback->Status.load(std::memory_order_acquire) == Readback_Copying && Readback->FrameValue <= CompletedFrameValue)
+		{
+			if (!Readback->Coherent)
+			{
+				VkMappedMemoryRange Range
+				{
+					.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+					.memory = Readback->Buffer.Allocation.Memory,
+					// Buddy nodes are at least 256 bytes, sized and aligned to a power of two, so always a multiple of nonCoherentAtomSize
+					.offset = Readback->Buffer.Allocation.Offset,
+					.size = Readback->Buffer.Allocation.Block ? Readback->Buffer.Allocation.Size : VK_WHOLE_SIZE,
+				};
+				vkInvalidateMappedMemoryRanges(Capture->Allocator->Device, 1, &Range);
+			}
+			Readback->Status.store(Readback_Encoding, std::memory_order_relaxed);
+			std::lock_guard<std::mutex> Lock(Capture->Mutex);
+			Capture->Queue[(Capture->FirstQueued + Capture->NumQueued) % MAX_READBACKS] = Index;
+			Capture->NumQueued++;
+			NumReady++;
+		}
+	}
+	if (NumReady)
+	{
+		Capture->WakeUp.notify_one();
+	}
 }
 
-static vulkan_buffer CreateVertexBuffer(VkDevice Device, VkPhysicalDevice PhysicalDevice, VkCommandPool CommandPool, VkQueue GraphicsQueue)
+// For headless, so no frame gets dropped: blocks until the readback the next frame will copy into is free again. Call
+// it between frames, never from DrawFrame.
+static void WaitForFreeReadback(frame_scheduler* Frames)
 {
-	VkDeviceSize BufferSize = sizeof(s_Vertices);
-	vulkan_buffer StagingBuffer = CreateBuffer(Device, 
-											   PhysicalDevice,
-											   BufferSize,
-											   VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-											   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-	void* UserBuffer;
-	vkMapMemory(Device, StagingBuffer.Memory, 0, BufferSize, 0, &UserBuffer);
-	memcpy(UserBuffer, s_Vertices, BufferSize);
-	vkUnmapMemory(Device, StagingBuffer.Memory);
-
-	vulkan_buffer Result = CreateBuffer(Device, 
-										PhysicalDevice, 
-										BufferSize, 
-										VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, 
-										VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	CopyBuffer(StagingBuffer.Handle, Result.Handle, BufferSize, Device, CommandPool, GraphicsQueue);
-	
-	vkDestroyBuffer(Device, StagingBuffer.Handle, nullptr); // pAllocator
-	vkFreeMemory(Device, StagingBuffer.Memory, nullptr); // pAllocator
-
-	return Result;
+	frame_capture* Capture = &s_Capture;
+	readback* Readback = Capture->Readbacks + Capture->NextReadback;
+	if (Readback->Status.load(std::memory_order_acquire) != Readback_Free)
+	{
+		// It's the oldest one, so once its copy's done and it's been handed over, it's next in line for the encoder
+		std::chrono::time_point StallStart = std::chrono::high_resolution_clock::now();
+		if (Readback->Status.load(std::memory_order_acquire) == Readback_Copying)
+		{
+			WaitForFrame(Frames, Readback->FrameValue);
+			CollectReadbacks(GetCompletedFrameValue(Frames));
+		}
+		std::unique_lock<std::mutex> Lock(Capture->Mutex);
+		while (Readback->Status.load(std::memory_order_acquire) != Readback_Free)
+		{
+			Capture->ReadbackFreed.wait(Lock);
+		}
+		Capture->NumStalls++;
+		Capture->StallSeconds += std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - StallStart).count();
+	}
 }
 
-static vulkan_buffer CreateIndexBuffer(VkDevice Device, VkPhysicalDevice PhysicalDevice, VkCommandPool CommandPool, VkQueue GraphicsQueue)
+// Records the copy of this frame's image into the next readback buffer, to be submitted after the frame's own command
+// buffer. Returns VK_NULL_HANDLE (and drops the frame) if the encoder hasn't given us a buffer back yet.
+static VkCommandBuffer RecordCapture(swap_chain* Swapchain, u32 ImageIndex, u32 Slot, u64 FrameValue, u64 FrameNumber)
 {
-	VkDeviceSize BufferSize = sizeof(s_Indices);
-	vulkan_buffer StagingBuffer = CreateBuffer(Device, 
-											   PhysicalDevice,
-											   BufferSize,
-											   VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-											   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-	void* UserBuffer;
-	vkMapMemory(Device, StagingBuffer.Memory, 0, BufferSize, 0, &UserBuffer);
-	memcpy(UserBuffer, s_Indices, BufferSize);
-	vkUnmapMemory(Device, StagingBuffer.Memory);
-
-	vulkan_buffer Result = CreateBuffer(Device, 
-										PhysicalDevice, 
-										BufferSize, 
-										VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, 
-										VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	CopyBuffer(StagingBuffer.Handle, Result.Handle, BufferSize, Device, CommandPool, GraphicsQueue);
-	
-	vkDestroyBuffer(Device, StagingBuffer.Handle, nullptr); // pAllocator
-	vkFreeMemory(Device, StagingBuffer.Memory, nullptr); // pAllocator
-
-	return Result;
-}
+	frame_capture* Capture = &s_Capture;
+	readback* Readback = Capture->Readbacks + Capture->NextReadback;
+	if (Readback->Status.load(std::memory_order_acquire) != Readback_Free)
+	{
+		Capture->NumDropped++;
+		return VK_NULL_HANDLE;
+	}
 
-static vulkan_buffer* CreateUniformBuffers(VkDevice Device, VkPhysicalDevice PhysicalDevice, void*** UniformBufferPtrs)
-{
-	VkDeviceSize BufferSize = sizeof(uniform_buffer_object);
-	vulkan_buffer* Result = AllocArray(vulkan_buffer, MAX_FRAMES_IN_FLIGHT);
-	*UniformBufferPtrs = AllocArray(void*, MAX_FRAMES_IN_FLIGHT);
-	for (u32 i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	VkDeviceSize Size = (VkDeviceSize)Swapchain->Extents.width * Swapchain->Extents.height * 4;
+	if (Readback->Size < Size)
 	{
-		vulkan_buffer* Buffer = Result + i;
-		void** UserPtr = (*UniformBufferPtrs) + i;
-		*Buffer = CreateBuffer(Device, PhysicalDevice, BufferSize, 
-							   VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, 
-							   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-		vkMapMemory(Device, Buffer->Memory, 0, BufferSize, 0, UserPtr);
+		// NOTE: Only happens the first time round the ring, and when the swapchain grows. The encoder's done with it
+		// and so is the GPU (it's Free), so it can go straight away.
+		if (Readback->Buffer.Handle)
+		{
+			DestroyBuffer(Capture->Allocator, &Readback->Buffer);
+		}
+		// Cached, or reading it back on the CPU crawls - but not every device has that in host-visible memory
+		VkMemoryPropertyFlags Cached = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+		VkMemoryPropertyFlags Flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		for (u32 i = 0; i < Capture->Allocator->MemoryProperties.memoryTypeCount; i++)
+		{
+			if ((Capture->Allocator->MemoryProperties.memoryTypes[i].propertyFlags & Cached) == Cached)
+			{
+				Flags = Cached;
+				break;
+			}
+		}
+		Readback->Buffer = CreateBuffer(Capture->Allocator, Size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, Flags);
+		Readback->Size = Size;
+		u32 MemoryType = Readback->Buffer.Allocation.MemoryTypeIndex;
+		Readback->Coherent = Capture->Allocator->MemoryProperties.memoryTypes[MemoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
 	}
-	return Result;
-}
 
-static VkDescriptorPool CreateDescriptorPool(VkDevice Device)
-{
-	VkDescriptorPoolSize PoolSizeUbo
+	VkCommandBuffer Result = Capture->CommandBuffers[Slot];
+	vkResetCommandBuffer(Result, 0);
+	VkCommandBufferBeginInfo BeginInfo
 	{
-		.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-		.descriptorCount = MAX_FRAMES_IN_FLIGHT,
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
 	};
-	VkDescriptorPoolSize PoolSizeSampler
+	if (vkBeginCommandBuffer(Result, &BeginInfo) == VK_SUCCESS)
 	{
-		.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-		.descriptorCount = MAX_FRAMES_IN_FLIGHT,
-	};
-	VkDescriptorPoolSize PoolSizes[] = { PoolSizeUbo, PoolSizeSampler };
+		// NOTE: Don't trust the tracked state - a cached command buffer doesn't re-record it. The frame left the image
+		// ready to present (or as a colour attachment, offscreen), and presenting's empty stage mask leans on the
+		// render-finished semaphore, which we're ahead of - so wait on the colour writes ourselves.
+		image_usage FinalUsage = Swapchain->OffscreenImages ? ImageUsage_ColourAttachment : ImageUsage_Present;
+		image_state* State = Swapchain->ImageStates + ImageIndex;
+		*State = { IMAGE_USAGE_STATES[FinalUsage].Layout, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT };
+		barrier_batch Barriers = BeginBarrierBatch(Result);
+		RequireImageState(&Barriers, Swapchain->Images[ImageIndex], VK_IMAGE_ASPECT_COLOR_BIT, State, ImageUsage_TransferSrc, false);
+		FlushBarriers(&Barriers);
+
+		VkBufferImageCopy Region
+		{
+			.bufferOffset = 0,
+			.bufferRowLength = 0, // Tightly packed
+			.bufferImageHeight = 0,
+			.imageSubresource = { .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT, .mipLevel = 0, .baseArrayLayer = 0, .layerCount = 1 },
+			.imageOffset = { 0, 0, 0 },
+			.imageExtent = { Swapchain->Extents.width, Swapchain->Extents.height, 1 },
+		};
+		vkCmdCopyImageToBuffer(Result, Swapchain->Images[ImageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, Readback->Buffer.Handle, 1, &Region);
 
-	VkDescriptorPoolCreateInfo PoolInfo
-	{
-		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-		.maxSets = MAX_FRAMES_IN_FLIGHT,
-		.poolSizeCount = ArrayCount(PoolSizes),
-		.pPoolSizes = PoolSizes,
-	};
+		// The timeline wait on the host doesn't make the copy visible to it by itself
+		VkMemoryBarrier2 HostBarrier
+		{
+			.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+			.srcStageMask = VK_PIPELINE_STAGE_2_COPY_BIT,
+			.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+			.dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT,
+			.dstAccessMask = VK_ACCESS_2_HOST_READ_BIT,
+		};
+		VkDependencyInfo DependencyInfo
+		{
+			.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+			.memoryBarrierCount = 1,
+			.pMemoryBarriers = &HostBarrier,
+		};
+		vkCmdPipelineBarrier2(Result, &DependencyInfo);
 
-	VkDescriptorPool Result = VK_NULL_HANDLE;
-	if (vkCreateDescriptorPool(Device, &PoolInfo, nullptr, &Result) != VK_SUCCESS)
+		// And back to how the frame left it
+		RequireImageState(&Barriers, Swapchain->Images[ImageIndex], VK_IMAGE_ASPECT_COLOR_BIT, State, FinalUsage, false);
+		FlushBarriers(&Barriers);
+
+		if (vkEndCommandBuffer(Result) != VK_SUCCESS)
+		{
+			fprintf(stderr, "Failed to record the capture command buffer\n");
+			Assert(false);
+		}
+	}
+	else
 	{
-		fprintf(stderr, "Failed to create descriptor pool bro\n");
+		fprintf(stderr, "Couldn't begin the capture command buffer\n");
 		Assert(false);
 	}
+
+	Readback->FrameValue = FrameValue;
+	Readback->FrameNumber = FrameNumber;
+	Readback->Extents = Swapchain->Extents;
+	Readback->Bgra = Swapchain->Format == VK_FORMAT_B8G8R8A8_UNORM || Swapchain->Format == VK_FORMAT_B8G8R8A8_SRGB;
+	Readback->Status.store(Readback_Copying, std::memory_order_relaxed);
+	Capture->NextReadback = (Capture->NextReadback + 1) % MAX_READBACKS;
 	return Result;
 }
 
-static VkDescriptorSet* CreateDescriptorSets(VkDevice Device, 
-											 VkDescriptorSetLayout DescSetLayout, 
-											 VkDescriptorPool DescPool, 
-											 vulkan_buffer* UniformBuffers,
-											 VkImageView TextureImageView,
-											 VkSampler TextureSampler)
+// NOTE: Call with the device idle, so every copy that was submitted gets written out
+static void ShutdownFrameCapture()
 {
-	VkDescriptorSetLayout Layouts[MAX_FRAMES_IN_FLIGHT];
-	for (u32 i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+	frame_capture* Capture = &s_Capture;
+	if (Capture->Enabled)
 	{
-		Layouts[i] = DescSetLayout;
+		CollectReadbacks(UINT64_MAX);
+		{
+			std::lock_guard<std::mutex> Lock(Capture->Mutex);
+			Capture->ShuttingDown = true;
+		}
+		Capture->WakeUp.notify_all();
+		Capture->Thread.join();
+
+		printf("Captured %llu frames to '%s_*.%s' (%.2f MB), %.2f ms/frame encoding, dropped %llu\n",
+			   (unsigned long long)Capture->NumWritten, Capture->Prefix, CAPTURE_FORMAT_NAMES[Capture->Format],
+			   Capture->BytesWritten / (1024.0 * 1024.0),
+			   Capture->NumWritten ? Capture->EncodeSeconds * 1000.0 / Capture->NumWritten : 0.0, (unsigned long long)Capture->NumDropped);
+		if (Capture->NumStalls)
+		{
+			printf("Headless waited on the encoder %llu times, %.2f ms in total\n", (unsigned long long)Capture->NumStalls,
+				   Capture->StallSeconds * 1000.0);
+		}
+		for (u32 i = 0; i < MAX_READBACKS; i++)
+		{
+			if (Capture->Readbacks[i].Buffer.Handle)
+			{
+				DestroyBuffer(Capture->Allocator, &Capture->Readbacks[i].Buffer);
+			}
+		}
+		DestroyArena(&Capture->RowArena);
+		Capture->Enabled = false;
 	}
+}
 
-	VkDescriptorSetAllocateInfo AllocInfo
-	{
-		.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
-		.descriptorPool = DescPool,
-		.descriptorSetCount = MAX_FRAMES_IN_FLIGHT,
-		.pSetLayouts = Layouts,
-	};
+static constexpr f64 MINIMISED_TICK_SECONDS = 0.1; // How often the simulation ticks while minimised, if it does
+
+// Whatever got passed on the command line
+struct app_config
+{
+	VkDeviceSize VramCeiling; // --vram-ceiling-mb, 0 means just go with what the driver says
+	b32 NoDirectUploads; // --no-direct-upload, always go through staging even on unified memory
+	u32 FramesInFlight; // --frames-in-flight, 1 to MAX_FRAMES_IN_FLIGHT
+	b32 CacheCommandBuffers; // --cache-command-buffers, record once per swapchain image and reuse
+	u32 NumWorkers; // --workers, for the job system (main thread included). 1 does everything on the main thread.
+	u32 NumDraws; // --draws
+	b32 BenchmarkPipelineCache; // --benchmark-pipeline-cache, time pipeline creation with a cold and a warm cache at startup
+	b32 NoPipelineLibrary; // --no-pipeline-library, always build monolithic pipelines
+	b32 UseRenderPass; // --render-pass, VkRenderPass and VkFramebuffers instead of dynamic rendering
+	b32 TickWhileMinimised; // --tick-while-minimised, keep the simulation going (but not drawing) while minimised
+	present_policy PresentPolicy; // --present-mode fifo|fifo-relaxed|mailbox|immediate, defaults to mailbox
+	u32 HeadlessFrames; // --headless N, no window - render N frames offscreen, print the timings and quit
+	const char* CapturePrefix; // --capture PREFIX, write every frame out to PREFIX_<frame number>.<format>
+	capture_format CaptureFormat; // --capture-format raw|ppm|png, defaults to png
+};
 
-	VkDescriptorSet* Result = AllocArray(VkDescriptorSet, MAX_FRAMES_IN_FLIGHT);
-	if (vkAllocateDescriptorSets(Device, &AllocInfo, Result) == VK_SUCCESS)
+static app_config ParseCommandLine(int ArgCount, char** Args)
+{
+	app_config Result = {};
+	Result.FramesInFlight = 2;
+	Result.NumWorkers = Clamp(std::thread::hardware_concurrency(), 1, MAX_WORKERS);
+	Result.NumDraws = 1;
+	Result.PresentPolicy = PresentPolicy_Mailbox;
+	Result.CaptureFormat = CaptureFormat_Png;
+	for (int i = 1; i < ArgCount; i++)
 	{
-		for (u32 i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+		if (strcmp(Args[i], "--vram-ceiling-mb") == 0 && i + 1 < ArgCount)
+		{
+			Result.VramCeiling = (VkDeviceSize)strtoull(Args[++i], nullptr, 10) * 1024 * 1024;
+		}
+		else if (strcmp(Args[i], "--no-direct-upload") == 0)
+		{
+			Result.NoDirectUploads = true;
+		}
+		else if (strcmp(Args[i], "--cache-command-buffers") == 0)
+		{
+			Result.CacheCommandBuffers = true;
+		}
+		else if (strcmp(Args[i], "--workers") == 0 && i + 1 < ArgCount)
+		{
+			Result.NumWorkers = Clamp((u32)strtoul(Args[++i], nullptr, 10), 1, MAX_WORKERS);
+		}
+		else if (strcmp(Args[i], "--draws") == 0 && i + 1 < ArgCount)
+		{
+			Result.NumDraws = Clamp((u32)strtoul(Args[++i], nullptr, 10), 1, MAX_DRAWS);
+		}
+		else if (strcmp(Args[i], "--present-mode") == 0 && i + 1 < ArgCount)
 		{
-			VkDescriptorBufferInfo BufferInfo
+			const char* Name = Args[++i];
+			u32 Policy = 0;
+			while (Policy < PresentPolicy_Count && strcmp(Name, PRESENT_POLICY_NAMES[Policy]) != 0)
 			{
-				.buffer = UniformBuffers[i].Handle,
-				.offset = 0,
-				.range = sizeof(uniform_buffer_object),
-			};
-			VkDescriptorImageInfo ImageInfo
+				Policy++;
+			}
+			if (Policy < PresentPolicy_Count)
 			{
-				.sampler = TextureSampler,
-				.imageView = TextureImageView,
-				.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-			};
-
-			VkWriteDescriptorSet DescWriteUbo
+				Result.PresentPolicy = (present_policy)Policy;
+			}
+			else
 			{
-				.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-				.dstSet = Result[i],
-				.dstBinding = 0,
-				.dstArrayElement = 0,
-				.descriptorCount = 1,
-				.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-				.pBufferInfo = &BufferInfo,
-			};
-			VkWriteDescriptorSet DescWriteSampler
-			{
-				.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-				.dstSet = Result[i],
-				.dstBinding = 1,
-				.dstArrayElement = 0,
-				.descriptorCount = 1,
-				.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-				.pImageInfo = &ImageInfo,
-			};
-
-			VkWriteDescriptorSet DescWrites[] = { DescWriteUbo, DescWriteSampler };
-			vkUpdateDescriptorSets(Device, ArrayCount(DescWrites), DescWrites, 0, nullptr);
+				fprintf(stderr, "Don't know present mode '%s', sticking with %s\n", Name, PRESENT_POLICY_NAMES[Result.PresentPolicy]);
+			}
+		}
+		else if (strcmp(Args[i], "--headless") == 0 && i + 1 < ArgCount)
+		{
+			Result.HeadlessFrames = (u32)strtoul(Args[++i], nullptr, 10);
+		}
+		else if (strcmp(Args[i], "--capture") == 0 && i + 1 < ArgCount)
+		{
+			Result.CapturePrefix = Args[++i];
+		}
+		else if (strcmp(Args[i], "--capture-format") == 0 && i + 1 < ArgCount)
+		{
+			const char* Name = Args[++i];
+			u32 Format = 0;
+			while (Format < CaptureFormat_Count && strcmp(Name, CAPTURE_FORMAT_NAMES[Format]) != 0)
+			{
+				Format++;
+			}
+			if (Format < CaptureFormat_Count)
+			{
+				Result.CaptureFormat = (capture_format)Format;
+			}
+			else
+			{
+				fprintf(stderr, "Don't know capture format '%s', sticking with %s\n", Name, CAPTURE_FORMAT_NAMES[Result.CaptureFormat]);
+			}
+		}
+		else if (strcmp(Args[i], "--tick-while-minimised") == 0)
+		{
+			Result.TickWhileMinimised = true;
+		}
+		else if (strcmp(Args[i], "--render-pass") == 0)
+		{
+			Result.UseRenderPass = true;
+		}
+		else if (strcmp(Args[i], "--no-pipeline-library") == 0)
+		{
+			Result.NoPipelineLibrary = true;
+		}
+		else if (strcmp(Args[i], "--benchmark-pipeline-cache") == 0)
+		{
+			Result.BenchmarkPipelineCache = true;
+		}
+		else if (strcmp(Args[i], "--frames-in-flight") == 0 && i + 1 < ArgCount)
+		{
+			Result.FramesInFlight = Clamp((u32)strtoul(Args[++i], nullptr, 10), 1, MAX_FRAMES_IN_FLIGHT);
+		}
+		else
+		{
+			fprintf(stderr, "Ignoring unknown argument '%s'\n", Args[i]);
 		}
-	}
-	else
-	{
-		Result = nullptr;
-		fprintf(stderr, "Failed to allocate descriptor sets\n");
-		Assert(false);
 	}
 	return Result;
 }
 
-static void TransitionImageLayout(VkImage Image, VkFormat Format, VkImageLayout OldLayout, VkImageLayout NewLayout, 
-								  VkCommandPool CommandPool, VkQueue GraphicsQueue, VkDevice Device)
+struct draw_item
 {
-	VkCommandBuffer CommandBuffer = BeginOneOffCommand(CommandPool, Device);
+	glm::vec3 Position;
+	u32 Pipeline; // In the pipeline registry
+	u32 UniformOffset; // Dynamic offset into the uniform ring, refreshed every frame
+};
 
-	VkImageMemoryBarrier Barrier
-	{
-		.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
-		.oldLayout = OldLayout,
-		.newLayout = NewLayout,
-		.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-		.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-		.image = Image,
-		.subresourceRange
-		{
-			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-			.baseMipLevel = 0,
-			.levelCount = 1,
-			.baseArrayLayer = 0,
-			.layerCount = 1,
-		},
-	};
+struct vulkan_stuff
+{
+	memory_arena PermanentArena;
+	memory_arena SwapchainArena; // Reset every time the swapchain gets recreated
+	memory_arena FrameArena;     // Reset at the start of every frame
 
-	VkPipelineStageFlags SourceStage = 0;
-	VkPipelineStageFlags DestStage = 0;
-	if (OldLayout == VK_IMAGE_LAYOUT_UNDEFINED && NewLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
-	{
-		Barrier.srcAccessMask = 0;
-		Barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	VkInstance Instance;
+	VkDevice Device; // the logical device, obvs.
+	VkSurfaceKHR Surface;
+	VkQueue GraphicsQueue;
+	VkRenderPass RenderPass; // Only with --render-pass, otherwise we use dynamic rendering and this is VK_NULL_HANDLE
+	rendering_formats RenderingFormats;
+	VkCommandPool CommandPool;
+	frame_scheduler Frames;
+	deletion_queue Deletions;
+	command_cache CommandCache;
+	parallel_recorder Recorder;
+	swap_chain Swapchain;
+	VkDescriptorSetLayout DescSetLayout;
+	VkPipelineCache PipelineCache; // Every pipeline gets created through this one
+	u32 FallbackPipeline; // Always ready, draws use it while their own pipeline compiles
+	u32 PipelinesVersion; // As of the last frame, cached command buffers are stale once it changes
+	physical_device_deets PhysicalDevice;
+	gpu_allocator GpuAllocator;
+	upload_engine Uploads;
+	residency_manager Residency;
+	upload_ticket SceneUploadTicket; // Frames wait on this (GPU-side) before touching the scene's buffers/textures
+
+	streamable* VertexBuffer;
+	streamable* IndexBuffer;
+	uniform_ring UniformRing;
+	draw_item* DrawItems;
+	u32 NumDrawItems;
+
+	streamable* Texture;
+	VkSampler TextureSampler;
 
-		SourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-		DestStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-	}
-	else if (OldLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && NewLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
-	{
-		Barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		Barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	image DepthImage;
 
-		SourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-		DestStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-	}
-	else
-	{
-		fprintf(stderr, "We've got an unsupported layout transition here my dudes\n");
-		Assert(false);
-	}
+	VkDescriptorPool DescPool;
+	VkDescriptorSet DescSet;
 
-	vkCmdPipelineBarrier(CommandBuffer,
-						 SourceStage, DestStage,
-						 0,
-						 0, nullptr,
-						 0, nullptr,
-						 1, &Barrier);
+	b32 PendingFramebufferResize;
+	b32 Minimised;
+	present_policy PresentPolicy; // What we want, Swapchain.PresentPolicy has what we've got
+	VkImageUsageFlags SwapchainUsage; // Likewise, Swapchain.Usage has what we've got
+	present_timer PresentTimer;
+	f64 SimulationSeconds; // Only moves while we're drawing, unless --tick-while-minimised
+	u32 SwapchainRecreations;
+	f64 SwapchainRecreationSeconds;
+};
 
-	EndOneOffCommand(CommandBuffer, GraphicsQueue, CommandPool, Device);
+static void OnWindowResized(GLFWwindow* Window, s32 Width, s32 Height)
+{
+	vulkan_stuff* VulkanStuff = (vulkan_stuff*)glfwGetWindowUserPointer(Window);
+	VulkanStuff->PendingFramebufferResize = true;
 }
 
-static void CopyBufferToImage(VkBuffer Buffer, VkImage Image, u32 Width, u32 Height, 
-							  VkCommandPool CommandPool, VkQueue GraphicsQueue, VkDevice Device)
+static void OnWindowIconified(GLFWwindow* Window, s32 Iconified)
 {
-	VkCommandBuffer CommandBuffer = BeginOneOffCommand(CommandPool, Device);
+	vulkan_stuff* VulkanStuff = (vulkan_stuff*)glfwGetWindowUserPointer(Window);
+	VulkanStuff->Minimised = Iconified;
+}
 
-	VkBufferImageCopy Region
+static void OnKey(GLFWwindow* Window, s32 Key, s32 ScanCode, s32 Action, s32 Mods)
+{
+	vulkan_stuff* VulkanStuff = (vulkan_stuff*)glfwGetWindowUserPointer(Window);
+	if (Key == GLFW_KEY_P && Action == GLFW_PRESS)
 	{
-		.bufferOffset = 0,
-		.bufferRowLength = 0,
-		.bufferImageHeight = 0,
-		.imageSubresource
-		{
-			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-			.mipLevel = 0,
-			.baseArrayLayer = 0,
-			.layerCount = 1,
-		},
-		.imageExtent
-		{
-			.width = Width,
-			.height = Height,
-			.depth = 1,
-		},
-	};
-	vkCmdCopyBufferToImage(CommandBuffer, Buffer, Image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &Region);
-
-	EndOneOffCommand(CommandBuffer, GraphicsQueue, CommandPool, Device);
+		// The present mode is baked into the swapchain, so changing it means making a new one
+		VulkanStuff->PresentPolicy = (present_policy)((VulkanStuff->PresentPolicy + 1) % PresentPolicy_Count);
+		VulkanStuff->PendingFramebufferResize = true;
+		printf("Switching present mode to %s\n", PRESENT_POLICY_NAMES[VulkanStuff->PresentPolicy]);
+	}
 }
 
-struct image_spec
+static GLFWwindow* InitWindow()
 {
-	u32 Width;
-	u32 Height;
-	VkFormat Format;
-	VkImageTiling Tiling;
-	VkImageUsageFlags UsageFlags;
-	VkMemoryPropertyFlags MemPropFlags;
-	VkImageAspectFlags AspectFlags;
-};
+	glfwInit();
+	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+	//glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+	GLFWwindow* Window = glfwCreateWindow(800, 600, "This is a window, mate", nullptr, nullptr);
+	glfwSetFramebufferSizeCallback(Window, OnWindowResized);
+	glfwSetWindowIconifyCallback(Window, OnWindowIconified);
+	glfwSetKeyCallback(Window, OnKey);
+	return Window;
+}
 
-static image CreateImage(VkDevice Device, VkPhysicalDevice PhysicalDevice, image_spec Spec)
+static void CleanUpSwapchain(VkDevice Device, gpu_allocator* Allocator, swap_chain* Swapchain, image* DepthImage)
 {
-	image Result = {};
-	VkImageCreateInfo ImageInfo
-	{
-		.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
-		.imageType = VK_IMAGE_TYPE_2D,
-		.format = Spec.Format,
-		.extent = { .width = Spec.Width, .height = Spec.Height, .depth = 1 },
-		.mipLevels = 1,
-		.arrayLayers = 1,
-		.samples = VK_SAMPLE_COUNT_1_BIT,
-		.tiling = Spec.Tiling,
-		.usage = Spec.UsageFlags,
-		.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-		.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED, // TODO: Wtf does this actually mean
-	};
-	if (vkCreateImage(Device, &ImageInfo, nullptr, &Result.Image) == VK_SUCCESS) // pAllocator
-	{
-		VkMemoryRequirements MemReqs;
-		vkGetImageMemoryRequirements(Device, Result.Image, &MemReqs);
+	DestroyImage(Allocator, DepthImage);
 
-		VkMemoryAllocateInfo AllocInfo
-		{
-			.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-			.allocationSize = MemReqs.size,
-			.memoryTypeIndex = FindMemoryType(MemReqs.memoryTypeBits, Spec.MemPropFlags, PhysicalDevice),
-		};
-		if (vkAllocateMemory(Device, &AllocInfo, nullptr, &Result.Memory) == VK_SUCCESS) // pAllocator
-		{
-			vkBindImageMemory(Device, Result.Image, Result.Memory, 0);
+	// No framebuffers with dynamic rendering
+	for (u32 i = 0; Swapchain->Framebuffers && i < Swapchain->NumImages; i++)
+	{
+		vkDestroyFramebuffer(Device, Swapchain->Framebuffers[i], HostCallbacks(HostObject_Framebuffer));
+	}
 
-			Result.ImageView = CreateImageView(Device, Result.Image, Spec.Format, Spec.AspectFlags);
-		}
-		else
+	if (Swapchain->OffscreenImages)
+	{
+		for (u32 i = 0; i < Swapchain->NumImages; i++)
 		{
-			fprintf(stderr, "Sorry couldn't allocate image/texture memory mate\n");
-			Assert(false);
+			DestroyImage(Allocator, Swapchain->OffscreenImages + i);
 		}
 	}
 	else
 	{
-		fprintf(stderr, "Failed to create image\n");
-		Assert(false);
+		for (u32 i = 0; i < Swapchain->NumImages; i++)
+		{
+			vkDestroyImageView(Device, Swapchain->ImageViews[i], HostCallbacks(HostObject_ImageView));
+		}
+		vkDestroySwapchainKHR(Device, Swapchain->Handle, HostCallbacks(HostObject_Swapchain));
 	}
-	return Result;
+	// NOTE: The arrays themselves live in the swapchain arena
 }
 
-static image CreateDepthBuffer(VkDevice Device, VkPhysicalDevice PhysicalDevice, swap_chain* Swapchain)
+// Like CleanUpSwapchain, but for when frames in flight might still be using it. The handles get copied out, so the
+// arrays in the swapchain arena are free to go straight away.
+static void RetireSwapchain(deletion_queue* Queue, swap_chain* Swapchain, image* DepthImage, u64 LastFrameValue)
 {
-	VkFormat DepthFormat = FindDepthFormat(PhysicalDevice);
-	
-	image_spec Spec
+	DeferDeletion(Queue, { .FrameValue = LastFrameValue, .Kind = DeferredDeletion_Image, .Image = *DepthImage });
+	*DepthImage = {};
+	for (u32 i = 0; Swapchain->Framebuffers && i < Swapchain->NumImages; i++)
 	{
-		.Width = Swapchain->Extents.width,
-		.Height = Swapchain->Extents.height,
-		.Format = DepthFormat,
-		.Tiling = VK_IMAGE_TILING_OPTIMAL,
-		.UsageFlags = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-		.MemPropFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		.AspectFlags = VK_IMAGE_ASPECT_DEPTH_BIT,
-	};
-	image Result = CreateImage(Device, PhysicalDevice, Spec);
-
-	return Result;
+		DeferDeletion(Queue, { .FrameValue = LastFrameValue, .Kind = DeferredDeletion_Framebuffer, .Framebuffer = Swapchain->Framebuffers[i] });
+	}
+	for (u32 i = 0; i < Swapchain->NumImages; i++)
+	{
+		DeferDeletion(Queue, { .FrameValue = LastFrameValue, .Kind = DeferredDeletion_ImageView, .ImageView = Swapchain->ImageViews[i] });
+	}
+	// NOTE: The last frame rendering to it finishing only means its present got queued, not that the presentation
+	// engine's done with the images. So the swapchain itself waits for a present to its replacement to complete
+	// instead - DrawFrame works that out, from present waits if we've got them and from images coming back otherwise.
+	DeferSwapchainDeletion(Queue, Swapchain->Handle);
 }
 
-static image CreateTexture(VkDevice Device, VkPhysicalDevice PhysicalDevice, VkCommandPool CommandPool, VkQueue GraphicsQueue)
+// TODO: Getting some ugly artefacts here: Framebuffer actually does not resize until user has 'let go' of the mouse drag;
+// while dragging everything looks messed up. May be an issue with GLFW event polling - when I move to doing native Win32
+// this should be fixed. Possibly relevant links:
+// - Reddit discussion: https://www.reddit.com/r/vulkan/comments/174yy9b/smooth_window_resize_help/
+// - vkCube source code: https://github.com/KhronosGroup/Vulkan-Tools/blob/main/cube/cube.c
+static void RecreateSwapchain(vulkan_stuff* VulkanStuff, GLFWwindow* Window)
 {
-	image Result = {};
+	s32 Width, Height;
+	glfwGetFramebufferSize(Window, &Width, &Height);
+	if (Width == 0 || Height == 0)
+	{
+		// Can't make a zero-sized swapchain. MainLoop stops drawing while we're like this, and recreates it when we're back.
+		VulkanStuff->PendingFramebufferResize = true;
+		return;
+	}
 
-	int TexWidth, TexHeight, NumChannels;
-	stbi_uc* Pixels = stbi_load("textures/texture.jpg", &TexWidth, &TexHeight, &NumChannels, STBI_rgb_alpha);
-	if (Pixels)
+	// NOTE: No waiting for the device to idle - frames in flight keep going with the old swapchain, which gets retired
+	// through the deletion queue once they're done with it
+#if _DEBUG
+	host_alloc_snapshot Snapshot = TakeHostAllocSnapshot();
+#endif
+	std::chrono::time_point Start = std::chrono::high_resolution_clock::now();
+
+	// TODO: Slightly piggy - we just need to retrieve the updated framebuffer size here...
+	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(VulkanStuff->PhysicalDevice.Handle,
+											  VulkanStuff->Surface,
+											  &VulkanStuff->PhysicalDevice.SwapChainDeets.Capabilities);
+	
+	swap_chain OldSwapchain = VulkanStuff->Swapchain;
+	ForgetPendingPresents(&VulkanStuff->PresentTimer);
+	RetireSwapchain(&VulkanStuff->Deletions, &OldSwapchain, &VulkanStuff->DepthImage, VulkanStuff->Frames.FramesSubmitted);
+	ResetArena(&VulkanStuff->SwapchainArena);
+
+	VulkanStuff->Swapchain = CreateSwapChain(&VulkanStuff->SwapchainArena, &VulkanStuff->PhysicalDevice, VulkanStuff->Device, Window,
+											 VulkanStuff->Surface, OldSwapchain.Handle, VulkanStuff->PresentPolicy,
+											 VulkanStuff->SwapchainUsage);
+	VulkanStuff->DepthImage = CreateDepthBuffer(&VulkanStuff->GpuAllocator, VulkanStuff->PhysicalDevice.Handle, &VulkanStuff->Swapchain);
+
+	if (VulkanStuff->RenderPass)
 	{
-		VkDeviceSize ImageSize = TexWidth * TexHeight * 4;
-		
-		vulkan_buffer StagingBuffer = CreateBuffer(Device, PhysicalDevice, ImageSize, 
-												   VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-												   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+		CreateFramebuffers(&VulkanStuff->SwapchainArena, &VulkanStuff->Swapchain, VulkanStuff->DepthImage, VulkanStuff->Device, VulkanStuff->RenderPass);
+	}
+	MarkCommandCacheDirty(&VulkanStuff->CommandCache);
+	if (VulkanStuff->CommandCache.Enabled && VulkanStuff->Swapchain.NumImages > MAX_CACHED_SWAPCHAIN_IMAGES)
+	{
+		fprintf(stderr, "Swapchain has %u images, too many to cache command buffers for\n", VulkanStuff->Swapchain.NumImages);
+		VulkanStuff->CommandCache.Enabled = false;
+	}
+	VulkanStuff->SwapchainRecreations++;
+	VulkanStuff->SwapchainRecreationSeconds += std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - Start).count();
+#if _DEBUG
+	PrintHostAllocsSince("swapchain recreation", &Snapshot);
+#endif
+}
 
-		void* Data;
-		vkMapMemory(Device, StagingBuffer.Memory, 0, ImageSize, 0, &Data);
-		memcpy(Data, Pixels, ImageSize);
-		vkUnmapMemory(Device, StagingBuffer.Memory);
-		stbi_image_free(Pixels);
+// Lays the draws out in a square grid on the XY plane, centred on the origin
+static void CreateScene(vulkan_stuff* VulkanStuff, u32 NumDraws)
+{
+	Assert(NumDraws <= MAX_DRAWS);
+	VulkanStuff->DrawItems = PushArray(&VulkanStuff->PermanentArena, draw_item, NumDraws);
+	VulkanStuff->NumDrawItems = NumDraws;
 
-		image_spec Spec
+	u32 GridSide = 1;
+	while (GridSide * GridSide < NumDraws)
+	{
+		GridSide++;
+	}
+	f32 Spacing = 1.5f;
+	f32 HalfExtent = 0.5f * Spacing * (f32)(GridSide - 1);
+	for (u32 i = 0; i < NumDraws; i++)
+	{
+		VulkanStuff->DrawItems[i] =
 		{
-			.Width = (u32)TexWidth,
-			.Height = (u32)TexHeight,
-			.Format = VK_FORMAT_R8G8B8A8_SRGB,
-			.Tiling = VK_IMAGE_TILING_OPTIMAL,
-			.UsageFlags = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-			.MemPropFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-			.AspectFlags = VK_IMAGE_ASPECT_COLOR_BIT,
+			.Position = { Spacing * (f32)(i % GridSide) - HalfExtent, Spacing * (f32)(i / GridSide) - HalfExtent, 0.0f },
 		};
-		Result = CreateImage(Device, PhysicalDevice, Spec);
+	}
+}
 
-		TransitionImageLayout(Result.Image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-							  CommandPool, GraphicsQueue, Device);
-		CopyBufferToImage(StagingBuffer.Handle, Result.Image, TexWidth, TexHeight, CommandPool, GraphicsQueue, Device);
-		TransitionImageLayout(Result.Image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-							  CommandPool, GraphicsQueue, Device);
+// A handful of state permutations standing in for materials, handed out round the grid. All but the first compile in
+// the background and pop in as they're ready.
+static void RequestScenePipelines(vulkan_stuff* VulkanStuff)
+{
+	pipeline_state States[] = { DEFAULT_PIPELINE_STATE, DEFAULT_PIPELINE_STATE, DEFAULT_PIPELINE_STATE, DEFAULT_PIPELINE_STATE };
+	States[1].AlphaBlend = false; // Opaque
+	States[2].CullMode = VK_CULL_MODE_NONE; // Two-sided
+	States[3].DepthWrite = false; // Transparent-style, tested but doesn't occlude
 
-		vkDestroyBuffer(Device, StagingBuffer.Handle, nullptr); // pAllocator
-		vkFreeMemory(Device, StagingBuffer.Memory, nullptr); // pAllocator
+	u32 Pipelines[ArrayCount(States)];
+	for (u32 i = 0; i < ArrayCount(States); i++)
+	{
+		Pipelines[i] = RequestPipeline(States + i);
 	}
-	else
+	for (u32 i = 0; i < VulkanStuff->NumDrawItems; i++)
 	{
-		fprintf(stderr, "Couldn't load that texture image, bro\n");
-		Assert(false);
+		VulkanStuff->DrawItems[i].Pipeline = Pipelines[i % ArrayCount(Pipelines)];
 	}
-	return Result;
 }
 
-static VkSampler CreateTextureSampler(VkDevice Device, VkPhysicalDevice PhysicalDevice)
+// NOTE: Startup is a little dependency graph. Anything that doesn't need the device - reading and decoding files - gets
+// kicked off as a job before we've even made the instance. Pipeline compilation waits on its shader files, then runs
+// as a job alongside the resource uploads. The main thread does the Vulkan object creation that has to happen in
+// order, and only waits on a job when it actually needs the result.
+//
+//   decode texture ----------------------------------------------------------------> texture upload -+
+//   read shaders ------------------------------+                                                     |
+//   instance -> device -> allocator/uploads -> swapchain/render pass -> depth/framebuffers -> buffers -> ... -> done
+//                                              +-> shader modules + fallback pipeline -----------------------^
+//
+// The rest of the scene's pipelines get requested at the end and compile while we're already drawing.
+static constexpr size_t SHADER_SOURCE_ARENA_SIZE = 256 * 1024;
+static constexpr size_t PIPELINE_CACHE_ARENA_SIZE = 16 * 1024 * 1024; // Reserve, the cache is usually a few hundred KB
+
+struct startup_file
 {
-	VkPhysicalDeviceProperties Props = {};
-	vkGetPhysicalDeviceProperties(PhysicalDevice, &Props);
+	const char* FileName;
+	b32 Optional; // Fine for it not to exist, we'll get an empty Contents
+	memory_arena Arena;
+	file_buffer Contents;
+};
 
-	VkSamplerCreateInfo SamplerInfo
+// job_func, UserData is an array of startup_files
+static void ReadStartupFileJob(void* UserData, u32 Index)
+{
+	startup_file* File = (startup_file*)UserData + Index;
+	u32 Stage = BeginStartupStage(File->FileName);
+	File->Contents = File->Optional ? TryLoadFile(&File->Arena, File->FileName) : LoadFile(&File->Arena, File->FileName);
+	EndStartupStage(Stage);
+}
+
+// NOTE: Most desktop drivers keep their own cache underneath ours, so "cold" here is only as cold as we can make it
+static void BenchmarkPipelineCache(VkPipelineCache LoadedCache)
+{
+	pipeline_registry* Registry = &s_Pipelines;
+	VkPipelineCacheCreateInfo ScratchCacheInfo
 	{
-		.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
-		.magFilter = VK_FILTER_LINEAR,
-		.minFilter = VK_FILTER_LINEAR,
-		.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
-		.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
-		.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
-		.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT,
-		.mipLodBias = 0.0f,
-		.anisotropyEnable = VK_TRUE,
-		.maxAnisotropy = Props.limits.maxSamplerAnisotropy,
-		.compareEnable = VK_FALSE,
-		.compareOp = VK_COMPARE_OP_ALWAYS,
-		.minLod = 0.0f,
-		.maxLod = 0.0f,
-		.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK,
-		.unnormalizedCoordinates = VK_FALSE,
+		.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+		.initialDataSize = 0,
+		.pInitialData = nullptr,
 	};
-
-	VkSampler Result = VK_NULL_HANDLE;
-	if (vkCreateSampler(Device, &SamplerInfo, nullptr, &Result) != VK_SUCCESS) // pAllocator
+	VkPipelineCache ScratchCache = VK_NULL_HANDLE;
+	if (vkCreatePipelineCache(Registry->Device, &ScratchCacheInfo, HostCallbacks(HostObject_PipelineCache), &ScratchCache) != VK_SUCCESS)
 	{
-		fprintf(stderr, "Failed to create that there sampler, my friend\n");
+		fprintf(stderr, "Couldn't create a scratch pipeline cache to benchmark with\n");
 		Assert(false);
 	}
-	return Result;
+	// Empty cache, the same cache again now it's got our pipeline in, then whatever we loaded from disk
+	VkPipelineCache Caches[] = { ScratchCache, ScratchCache, LoadedCache };
+	const char* CacheNames[] = { "cold", "warm", "from disk" };
+	for (u32 i = 0; i < ArrayCount(Caches); i++)
+	{
+		std::chrono::time_point Start = std::chrono::high_resolution_clock::now();
+		VkPipeline Pipeline = CreateGraphicsPipeline(Registry->Device, Caches[i], Registry->RenderPass, &Registry->Formats, Registry->Layout,
+													 &DEFAULT_PIPELINE_STATE, Registry->VertShaderModule, Registry->FragShaderModule);
+		std::chrono::time_point End = std::chrono::high_resolution_clock::now();
+		printf("Pipeline creation, %s cache: %.3f ms\n", CacheNames[i], std::chrono::duration<f64, std::milli>(End - Start).count());
+		vkDestroyPipeline(Registry->Device, Pipeline, HostCallbacks(HostObject_Pipeline));
+	}
+	vkDestroyPipelineCache(Registry->Device, ScratchCache, HostCallbacks(HostObject_PipelineCache));
 }
 
-
-struct vulkan_stuff
+struct pipeline_job
 {
-	VkInstance Instance;
-	VkDevice Device; // the logical device, obvs.
-	VkSurfaceKHR Surface;
-	VkQueue GraphicsQueue;
+	VkDevice Device;
 	VkRenderPass RenderPass;
-	VkCommandPool CommandPool;
-	VkCommandBuffer* CommandBuffers; // MAX_FRAMES_IN_FLIGHT of these
-	swap_chain Swapchain;
+	rendering_formats Formats;
 	VkDescriptorSetLayout DescSetLayout;
-	vulkan_pipeline Pipeline;
-	physical_device_deets PhysicalDevice;
-
-	VkSemaphore* ImageAvailableSemaphores;
-	VkSemaphore* RenderFinishedSempaphores;
-	VkFence* InFlightFences;
-
-	vulkan_buffer VertexBuffer;
-	vulkan_buffer IndexBuffer;
-	vulkan_buffer* UniformBuffers;
-	void** UniformBufferPtrs;
-
-	image Texture;
-	VkSampler TextureSampler;
+	VkPipelineCache Cache;
+	startup_file* Shaders; // Vertex, fragment
+	job_counter* ShadersRead;
+	b32 UsePipelineLibraries;
+	b32 Benchmark;
+	u32 FallbackPipeline;
+};
 
-	image DepthImage;
+// job_func. Sets up the pipeline registry once the shaders are in, then compiles the fallback pipeline - the only one
+// we wait for before the first frame.
+static void CreatePipelineJob(void* UserData, u32 Index)
+{
+	pipeline_job* Job = (pipeline_job*)UserData;
+	WaitForCounter(Job->ShadersRead);
 
-	VkDescriptorPool DescPool;
-	VkDescriptorSet* DescSets;
+	u32 Stage = BeginStartupStage("Shader modules");
+	InitPipelineRegistry(Job->Device, Job->Cache, Job->RenderPass, Job->Formats, Job->DescSetLayout,
+						 CreateShaderModule(Job->Device, Job->Shaders[0].Contents),
+						 CreateShaderModule(Job->Device, Job->Shaders[1].Contents), Job->UsePipelineLibraries);
+	EndStartupStage(Stage);
 
-	u32 CurrentFrame;
-	b32 PendingFramebufferResize;
-};
+	if (Job->Benchmark)
+	{
+		// NOTE: Goes first so the "from disk" run sees the cache exactly as it was loaded
+		u32 BenchmarkStage = BeginStartupStage("Pipeline cache benchmark");
+		BenchmarkPipelineCache(Job->Cache);
+		EndStartupStage(BenchmarkStage);
+	}
 
-static void OnWindowResized(GLFWwindow* Window, s32 Width, s32 Height)
-{
-	vulkan_stuff* VulkanStuff = (vulkan_stuff*)glfwGetWindowUserPointer(Window);
-	VulkanStuff->PendingFramebufferResize = true;
+	Stage = BeginStartupStage("Fallback pipeline");
+	Job->FallbackPipeline = RequestPipeline(&DEFAULT_PIPELINE_STATE);
+	WaitForPipeline(Job->FallbackPipeline);
+	EndStartupStage(Stage);
 }
 
-static GLFWwindow* InitWindow()
+// NOTE: Fills in VulkanStuff in place, rather than returning it, because the upload engine and residency manager keep
+// pointers into it
+static void InitVulkan(vulkan_stuff* VulkanStuff, GLFWwindow* Window, app_config* Config)
 {
-	glfwInit();
-	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-	//glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
-	GLFWwindow* Window = glfwCreateWindow(800, 600, "This is a window, mate", nullptr, nullptr);
-	glfwSetFramebufferSizeCallback(Window, OnWindowResized);
-	return Window;
-}
+	VulkanStuff->PermanentArena = CreateArena("Permanent", 1024 * 1024);
+	VulkanStuff->SwapchainArena = CreateArena("Swapchain", 64 * 1024);
+	VulkanStuff->FrameArena = CreateArena("Frame", 1024 * 1024);
+	// NOTE: Nothing's drawing yet, so the frame arena is free to use as scratch space for init
+	memory_arena* Scratch = &VulkanStuff->FrameArena;
+	InitHostAllocator();
+	InitJobSystem(Config->NumWorkers);
+
+	// File I/O and decoding don't need Vulkan at all, so get them going straight away
+	decoded_image TextureImage = { .FileName = "textures/texture.jpg" };
+	job_counter TextureDecoded = {};
+	KickJob(DecodeImageJob, &TextureImage, &TextureDecoded);
+
+	startup_file Shaders[] =
+	{
+		{ .FileName = "shaders/vert.spv", .Arena = CreateArena("Vertex shader source", SHADER_SOURCE_ARENA_SIZE) },
+		{ .FileName = "shaders/frag.spv", .Arena = CreateArena("Fragment shader source", SHADER_SOURCE_ARENA_SIZE) },
+	};
+	job_counter ShadersRead = {};
+	KickJobs(ReadStartupFileJob, Shaders, ArrayCount(Shaders), &ShadersRead);
 
-static void CreateSyncObjects(vulkan_stuff* OutVulkanStuff)
-{
-	VkSemaphoreCreateInfo SempahoreInfo
+	startup_file PipelineCacheFile =
 	{
-		.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+		.FileName = PIPELINE_CACHE_FILE_NAME,
+		.Optional = true,
+		.Arena = CreateArena("Pipeline cache file", PIPELINE_CACHE_ARENA_SIZE),
 	};
-	VkFenceCreateInfo FenceInfo
+	job_counter PipelineCacheRead = {};
+	KickJob(ReadStartupFileJob, &PipelineCacheFile, &PipelineCacheRead);
+
+	// NOTE: No window means headless - no surface, no swapchain, just offscreen images
+	u32 Stage = BeginStartupStage("Instance + surface");
+	VulkanStuff->Instance = CreateInstance(Scratch, !Window);
+	if (Window)
+	{
+		VulkanStuff->Surface = CreateSurface(VulkanStuff->Instance, Window);
+	}
+	EndStartupStage(Stage);
+
+	Stage = BeginStartupStage("Physical + logical device");
+	VulkanStuff->PhysicalDevice = PickPhysicalDevice(&VulkanStuff->PermanentArena, Scratch, VulkanStuff->Instance, VulkanStuff->Surface);
+	VulkanStuff->PhysicalDevice.HasPipelineLibrary &= !Config->NoPipelineLibrary;
+	printf("Pipelines: %s\n", VulkanStuff->PhysicalDevice.HasPipelineLibrary ? "fast-linked from libraries" : "monolithic");
+	VulkanStuff->Device = CreateLogicalDevice(VulkanStuff->PhysicalDevice);
+	vkGetDeviceQueue(VulkanStuff->Device, VulkanStuff->PhysicalDevice.QueueFamilyIndices.GraphicsFamily, 0, &VulkanStuff->GraphicsQueue);
+	VulkanStuff->PresentTimer = CreatePresentTimer(VulkanStuff->Device, VulkanStuff->PhysicalDevice.HasPresentWait);
+	EndStartupStage(Stage);
+
+	Stage = BeginStartupStage("Allocator + upload engine");
+	VulkanStuff->GpuAllocator = CreateGpuAllocator(VulkanStuff->Device, VulkanStuff->PhysicalDevice.Handle,
+												   &VulkanStuff->PhysicalDevice.MemoryProperties,
+												   VulkanStuff->PhysicalDevice.HasMemoryBudget,
+												   Config->VramCeiling,
+												   VulkanStuff->PhysicalDevice.QueueFamilyIndices.GraphicsFamily,
+												   VulkanStuff->PhysicalDevice.QueueFamilyIndices.TransferFamily);
+	VulkanStuff->Uploads = CreateUploadEngine(VulkanStuff->Device, &VulkanStuff->GpuAllocator, VulkanStuff->PhysicalDevice.QueueFamilyIndices.TransferFamily);
+	InitResidencyManager(&VulkanStuff->Residency, &VulkanStuff->GpuAllocator, &VulkanStuff->Uploads, Config->FramesInFlight, !Config->NoDirectUploads);
+	printf("Buffer uploads: %s\n", VulkanStuff->Residency.DirectUploads ? "direct to mapped VRAM" : "staged");
+	EndStartupStage(Stage);
+
+	Stage = BeginStartupStage("Swapchain + render pass");
+	VulkanStuff->PresentPolicy = Config->PresentPolicy;
+	// Captures get copied straight out of the swapchain images
+	VulkanStuff->SwapchainUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | (Config->CapturePrefix ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0);
+	if (Window)
+	{
+		VulkanStuff->Swapchain = CreateSwapChain(&VulkanStuff->SwapchainArena, &VulkanStuff->PhysicalDevice, VulkanStuff->Device, Window,
+												 VulkanStuff->Surface, VK_NULL_HANDLE, VulkanStuff->PresentPolicy,
+												 VulkanStuff->SwapchainUsage);
+		printf("Present mode: %s (P to switch)\n", PRESENT_POLICY_NAMES[VulkanStuff->Swapchain.PresentPolicy]);
+	}
+	else
 	{
-		.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-		.flags = VK_FENCE_CREATE_SIGNALED_BIT,
+		VulkanStuff->Swapchain = CreateOffscreenSwapchain(&VulkanStuff->SwapchainArena, &VulkanStuff->GpuAllocator, HEADLESS_EXTENTS,
+														  Config->FramesInFlight);
+		printf("Headless: %u offscreen %ux%u images\n", VulkanStuff->Swapchain.NumImages, HEADLESS_EXTENTS.width, HEADLESS_EXTENTS.height);
+	}
+	VulkanStuff->RenderingFormats = GetRenderingFormats(VulkanStuff->PhysicalDevice.Handle, &VulkanStuff->Swapchain);
+	if (Config->UseRenderPass)
+	{
+		VulkanStuff->RenderPass = CreateRenderPass(VulkanStuff->Device, VulkanStuff->PhysicalDevice.Handle, &VulkanStuff->Swapchain);
+	}
+	VulkanStuff->DescSetLayout = CreateDescriptorSetLayout(VulkanStuff->Device);
+	EndStartupStage(Stage);
+
+#if _DEBUG
+	host_alloc_snapshot PipelineSnapshot = TakeHostAllocSnapshot();
+#endif
+	Stage = BeginStartupStage("Pipeline cache");
+	WaitForCounter(&PipelineCacheRead);
+	VulkanStuff->PipelineCache = CreatePipelineCache(VulkanStuff->Device, VulkanStuff->PhysicalDevice.Handle, PipelineCacheFile.Contents);
+	printf("Pipeline cache: %s\n", IsPipelineCacheDataValid(VulkanStuff->PhysicalDevice.Handle, PipelineCacheFile.Contents) ?
+		   "loaded from disk" : PipelineCacheFile.Contents.Contents ? "stale, starting empty" : "none yet, starting empty");
+	UnloadFile(&PipelineCacheFile.Contents);
+	DestroyArena(&PipelineCacheFile.Arena);
+	EndStartupStage(Stage);
+
+	pipeline_job PipelineJob
+	{
+		.Device = VulkanStuff->Device,
+		.RenderPass = VulkanStuff->RenderPass,
+		.Formats = VulkanStuff->RenderingFormats,
+		.DescSetLayout = VulkanStuff->DescSetLayout,
+		.Cache = VulkanStuff->PipelineCache,
+		.Shaders = Shaders,
+		.ShadersRead = &ShadersRead,
+		.UsePipelineLibraries = VulkanStuff->PhysicalDevice.HasPipelineLibrary,
+		.Benchmark = Config->BenchmarkPipelineCache,
 	};
+	job_counter PipelineCreated = {};
+	KickJob(CreatePipelineJob, &PipelineJob, &PipelineCreated);
+
+	Stage = BeginStartupStage("Depth buffer (+ framebuffers)");
+	VulkanStuff->CommandPool = CreateCommandPool(VulkanStuff->Device, VulkanStuff->PhysicalDevice.QueueFamilyIndices.GraphicsFamily,
+												 VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+	VulkanStuff->DepthImage = CreateDepthBuffer(&VulkanStuff->GpuAllocator, VulkanStuff->PhysicalDevice.Handle, &VulkanStuff->Swapchain);
+	if (VulkanStuff->RenderPass)
+	{
+		CreateFramebuffers(&VulkanStuff->SwapchainArena, &VulkanStuff->Swapchain, VulkanStuff->DepthImage, VulkanStuff->Device, VulkanStuff->RenderPass);
+	}
+	if (Config->CapturePrefix)
+	{
+		if (CanCaptureSwapchain(&VulkanStuff->Swapchain))
+		{
+			InitFrameCapture(&VulkanStuff->PermanentArena, VulkanStuff->Device, &VulkanStuff->GpuAllocator, VulkanStuff->CommandPool,
+							 Config->FramesInFlight, Config->CapturePrefix, Config->CaptureFormat);
+			printf("Capturing frames to '%s_*.%s'\n", Config->CapturePrefix, CAPTURE_FORMAT_NAMES[Config->CaptureFormat]);
+		}
+		else
+		{
+			fprintf(stderr, "Can't copy out of the swapchain images (format %d), not capturing\n", VulkanStuff->Swapchain.Format);
+		}
+	}
+	EndStartupStage(Stage);
+
+	// NOTE: All the scene uploads below share one staging buffer and go out in the SubmitUploads at the end
+	Stage = BeginStartupStage("Scene uploads");
+	WaitForCounter(&TextureDecoded);
+	VulkanStuff->Texture = CreateStreamableTexture(&VulkanStuff->Residency, &TextureImage);
+	VulkanStuff->TextureSampler = CreateTextureSampler(VulkanStuff->Device, VulkanStuff->PhysicalDevice.Handle);
+	VulkanStuff->VertexBuffer = CreateStreamableBuffer(&VulkanStuff->Residency, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, s_Vertices, sizeof(s_Vertices));
+	VulkanStuff->IndexBuffer = CreateStreamableBuffer(&VulkanStuff->Residency, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, s_Indices, sizeof(s_Indices));
+	VulkanStuff->SceneUploadTicket = SubmitUploads(&VulkanStuff->Uploads);
+	EndStartupStage(Stage);
+
+	Stage = BeginStartupStage("Uniforms, descriptors + frame state");
+	// NOTE: 256 is the biggest minUniformBufferOffsetAlignment the spec allows, so this always fits all the draws
+	VulkanStuff->UniformRing = CreateUniformRing(&VulkanStuff->GpuAllocator, VulkanStuff->PhysicalDevice.Handle,
+												 Config->NumDraws * AlignUp(sizeof(uniform_buffer_object), 256),
+												 // Cached command buffers bake in a uniform region per swapchain image
+												 Config->CacheCommandBuffers ? MAX_CACHED_SWAPCHAIN_IMAGES : Config->FramesInFlight);
+	VulkanStuff->DescPool = CreateDescriptorPool(VulkanStuff->Device);
+	VulkanStuff->DescSet = CreateDescriptorSet(VulkanStuff->Device, VulkanStuff->DescSetLayout, VulkanStuff->DescPool, &VulkanStuff->UniformRing,
+											   VulkanStuff->Texture->Texture.ImageView, VulkanStuff->TextureSampler);
+	CreateScene(VulkanStuff, Config->NumDraws);
+	VulkanStuff->Frames = CreateFrameScheduler(&VulkanStuff->PermanentArena, VulkanStuff->Device, VulkanStuff->CommandPool, Config->FramesInFlight);
+	VulkanStuff->Deletions = CreateDeletionQueue(VulkanStuff->Device, &VulkanStuff->GpuAllocator, &VulkanStuff->Frames);
+	VulkanStuff->CommandCache = CreateCommandCache(VulkanStuff->Device, VulkanStuff->CommandPool, Config->CacheCommandBuffers);
+	VulkanStuff->Recorder = CreateParallelRecorder(VulkanStuff->Device, VulkanStuff->PhysicalDevice.QueueFamilyIndices.GraphicsFamily,
+												   GetNumWorkers(), Config->FramesInFlight);
+	if (VulkanStuff->CommandCache.Enabled && VulkanStuff->Swapchain.NumImages > MAX_CACHED_SWAPCHAIN_IMAGES)
+	{
+		fprintf(stderr, "Swapchain has %u images, too many to cache command buffers for\n", VulkanStuff->Swapchain.NumImages);
+		VulkanStuff->CommandCache.Enabled = false;
+	}
+	EndStartupStage(Stage);
+
+	Stage = BeginStartupStage("Waiting on fallback pipeline");
+	WaitForCounter(&PipelineCreated);
+	VulkanStuff->FallbackPipeline = PipelineJob.FallbackPipeline;
+	RequestScenePipelines(VulkanStuff);
+	for (u32 i = 0; i < ArrayCount(Shaders); i++)
+	{
+		UnloadFile(&Shaders[i].Contents);
+		DestroyArena(&Shaders[i].Arena);
+	}
+	EndStartupStage(Stage);
+#if _DEBUG
+	// NOTE: Other init work overlaps with the pipeline job, so this counts everything since it got kicked off
+	PrintHostAllocsSince("pipeline creation (and whatever ran alongside it)", &PipelineSnapshot);
+#endif
+
+	PrintStartupTimeline();
+}
+
+static constexpr u32 UNIFORM_UPDATE_BATCH_SIZE = 1024;
 
-	OutVulkanStuff->ImageAvailableSemaphores = AllocArray(VkSemaphore, MAX_FRAMES_IN_FLIGHT);
-	OutVulkanStuff->RenderFinishedSempaphores = AllocArray(VkSemaphore, MAX_FRAMES_IN_FLIGHT);
-	OutVulkanStuff->InFlightFences = AllocArray(VkFence, MAX_FRAMES_IN_FLIGHT);
+struct uniform_update_job
+{
+	draw_item* DrawItems;
+	u8* Mapped;
+	glm::mat4 Rotation;
+	glm::mat4 View;
+	glm::mat4 Proj;
+};
 
-	for (u32 i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+// parallel_for_func
+static void UpdateUniformsJob(void* UserData, u32 First, u32 OnePastLast)
+{
+	uniform_update_job* Job = (uniform_update_job*)UserData;
+	for (u32 i = First; i < OnePastLast; i++)
 	{
-		if (vkCreateSemaphore(OutVulkanStuff->Device, &SempahoreInfo, nullptr, OutVulkanStuff->ImageAvailableSemaphores + i) != VK_SUCCESS || // pAllocator
-			vkCreateSemaphore(OutVulkanStuff->Device, &SempahoreInfo, nullptr, OutVulkanStuff->RenderFinishedSempaphores + i) != VK_SUCCESS || // pAllocator
-			vkCreateFence(OutVulkanStuff->Device, &FenceInfo, nullptr, OutVulkanStuff->InFlightFences + i) != VK_SUCCESS) // pAllocator
-		{
-			fprintf(stderr, "Failed to create them semaphores and/or fences mate\n");
-			Assert(false);
-		}
+		draw_item* Draw = Job->DrawItems + i;
+		uniform_buffer_object* Ubo = (uniform_buffer_object*)(Job->Mapped + Draw->UniformOffset);
+		// NOTE: This is write-combined memory, so write it straight through and never read it back
+		Ubo->Model = glm::translate(glm::mat4(1.0f), Draw->Position) * Job->Rotation;
+		Ubo->View = Job->View;
+		Ubo->Proj = Job->Proj;
 	}
 }
 
-static void CleanUpSwapchain(VkDevice Device, swap_chain* Swapchain, image DepthImage)
+static void UpdateUniformBuffer(vulkan_stuff* VulkanStuff, u32 UniformRegion)
 {
-	vkDestroyImageView(Device, DepthImage.ImageView, nullptr); // pAllocator
-	vkDestroyImage(Device, DepthImage.Image, nullptr); // pAllocator
-	vkFreeMemory(Device, DepthImage.Memory, nullptr); // pAllocator
+	float TimePassed = (float)VulkanStuff->SimulationSeconds;
 
-	for (u32 i = 0; i < Swapchain->NumImages; i++)
-	{
-		vkDestroyFramebuffer(Device, Swapchain->Framebuffers[i], nullptr); // pAllocator
-	}
-	free(Swapchain->Framebuffers);
+	float Aspect = (float)VulkanStuff->Swapchain.Extents.width / (float)VulkanStuff->Swapchain.Extents.height;
+	// Rotate around z-axis
+	glm::mat4 Rotation = glm::rotate(glm::mat4(1.0f), TimePassed * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	// Z is up??
+	glm::mat4 View = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	glm::mat4 Proj = glm::perspective(glm::radians(45.0f), Aspect, 0.1f, 10.0f);
+	// Apparently we need to flip the Y-coordinate of the clip space coords, because it's inverted from OpenGL
+	Proj[1][1] *= -1.0f;
 
-	for (u32 i = 0; i < Swapchain->NumImages; i++)
+	// Hand out the offsets up front (cheap, but has to be in order), then fill them in in parallel
+	uniform_ring* Ring = &VulkanStuff->UniformRing;
+	BeginUniformFrame(Ring, UniformRegion);
+	for (u32 i = 0; i < VulkanStuff->NumDrawItems; i++)
 	{
-		vkDestroyImageView(Device, Swapchain->ImageViews[i], nullptr); // pAllocator
+		if (!PushUniforms(Ring, sizeof(uniform_buffer_object), &VulkanStuff->DrawItems[i].UniformOffset))
+		{
+			VulkanStuff->NumDrawItems = i;
+			break;
+		}
 	}
-	free(Swapchain->ImageViews);
-	free(Swapchain->Images);
 
-	vkDestroySwapchainKHR(Device, Swapchain->Handle, nullptr); // pAllocator
+	uniform_update_job Job
+	{
+		.DrawItems = VulkanStuff->DrawItems,
+		.Mapped = Ring->Mapped,
+		.Rotation = Rotation,
+		.View = View,
+		.Proj = Proj,
+	};
+	ParallelFor(VulkanStuff->NumDrawItems, UNIFORM_UPDATE_BATCH_SIZE, UpdateUniformsJob, &Job);
 }
 
-// TODO: Getting some ugly artefacts here: Framebuffer actually does not resize until user has 'let go' of the mouse drag;
-// while dragging everything looks messed up. May be an issue with GLFW event polling - when I move to doing native Win32
-// this should be fixed. Possibly relevant links:
-// - Reddit discussion: https://www.reddit.com/r/vulkan/comments/174yy9b/smooth_window_resize_help/
-// - vkCube source code: https://github.com/KhronosGroup/Vulkan-Tools/blob/main/cube/cube.c
-static void RecreateSwapchain(vulkan_stuff* VulkanStuff, GLFWwindow* Window)
+static void RecordDraws(vulkan_stuff* VulkanStuff, VkCommandBuffer CommandBuffer, u32 FirstDraw, u32 OnePastLastDraw)
 {
-	s32 Width, Height;
-	glfwGetFramebufferSize(Window, &Width, &Height);
-	// TODO: This spinlock is gross - there must surely be a better way
-	while (Width == 0 || Height == 0)
+	VkDeviceSize VertexOffset = 0;
+	vkCmdBindVertexBuffers(CommandBuffer, 0, 1, &VulkanStuff->VertexBuffer->Buffer.Handle, &VertexOffset);
+	vkCmdBindIndexBuffer(CommandBuffer, VulkanStuff->IndexBuffer->Buffer.Handle, 0, VK_INDEX_TYPE_UINT16);
+
+	VkViewport Viewport
 	{
-		glfwGetFramebufferSize(Window, &Width, &Height);
-		glfwWaitEvents();
-	}
+		.x = 0.0f,
+		.y = 0.0f,
+		.width = (f32)VulkanStuff->Swapchain.Extents.width,
+		.height = (f32)VulkanStuff->Swapchain.Extents.height,
+		.minDepth = 0.0f,
+		.maxDepth = 1.0f,
+	};
+	vkCmdSetViewport(CommandBuffer, 0, 1, &Viewport);
 
-	vkDeviceWaitIdle(VulkanStuff->Device);
+	VkRect2D Scissor { .extent = VulkanStuff->Swapchain.Extents };
+	vkCmdSetScissor(CommandBuffer, 0, 1, &Scissor);
 
-	// TODO: Slightly piggy - we just need to retrieve the updated framebuffer size here...
-	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(VulkanStuff->PhysicalDevice.Handle,
-											  VulkanStuff->Surface,
-											  &VulkanStuff->PhysicalDevice.SwapChainDeets.Capabilities);
-	
-	CleanUpSwapchain(VulkanStuff->Device, &VulkanStuff->Swapchain, VulkanStuff->DepthImage);
+	VkPipeline FallbackPipeline = GetPipeline(VulkanStuff->FallbackPipeline);
+	VkPipeline BoundPipeline = VK_NULL_HANDLE;
+	for (u32 i = FirstDraw; i < OnePastLastDraw; i++)
+	{
+		draw_item* Draw = VulkanStuff->DrawItems + i;
+		VkPipeline Pipeline = GetPipeline(Draw->Pipeline);
+		if (!Pipeline)
+		{
+			Pipeline = FallbackPipeline;
+		}
+		if (!Pipeline)
+		{
+			continue;
+		}
+		if (Pipeline != BoundPipeline)
+		{
+			vkCmdBindPipeline(CommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, Pipeline);
+			BoundPipeline = Pipeline;
+		}
 
-	VulkanStuff->Swapchain = CreateSwapChain(&VulkanStuff->PhysicalDevice, VulkanStuff->Device, Window, VulkanStuff->Surface);
-	VulkanStuff->DepthImage = CreateDepthBuffer(VulkanStuff->Device, VulkanStuff->PhysicalDevice.Handle, &VulkanStuff->Swapchain);
+		u32 DynamicOffset = Draw->UniformOffset;
+		vkCmdBindDescriptorSets(CommandBuffer, 
+								VK_PIPELINE_BIND_POINT_GRAPHICS, 
+								s_Pipelines.Layout, 
+								0, 1, 
+								&VulkanStuff->DescSet,
+								1, &DynamicOffset);
 
-	CreateFramebuffers(&VulkanStuff->Swapchain, VulkanStuff->DepthImage, VulkanStuff->Device, VulkanStuff->RenderPass);
+		vkCmdDrawIndexed(CommandBuffer, ArrayCount(s_Indices), 1, 0, 0, 0);
+	}
 }
 
-static vulkan_stuff InitVulkan(GLFWwindow* Window)
+struct parallel_record_job
 {
-	vulkan_stuff Result = {};
-
-	Result.Instance = CreateInstance();
-	Result.Surface = CreateSurface(Result.Instance, Window);
-	Result.PhysicalDevice = PickPhysicalDevice(Result.Instance, Result.Surface);
-	Result.Device = CreateLogicalDevice(Result.PhysicalDevice);
-	vkGetDeviceQueue(Result.Device, Result.PhysicalDevice.QueueFamilyIndices.GraphicsFamily, 0, &Result.GraphicsQueue);
-	Result.Swapchain = CreateSwapChain(&Result.PhysicalDevice, Result.Device, Window, Result.Surface);
-	Result.RenderPass = CreateRenderPass(Result.Device, Result.PhysicalDevice.Handle, &Result.Swapchain);
-	Result.DescSetLayout = CreateDescriptorSetLayout(Result.Device);
-	Result.Pipeline = CreateGraphicsPipeline(Result.Device, &Result.Swapchain, Result.RenderPass, Result.DescSetLayout);
-	Result.CommandPool = CreateCommandPool(Result.Device, Result.PhysicalDevice.QueueFamilyIndices.GraphicsFamily);
-	Result.DepthImage = CreateDepthBuffer(Result.Device, Result.PhysicalDevice.Handle, &Result.Swapchain);
-	CreateFramebuffers(&Result.Swapchain, Result.DepthImage, Result.Device, Result.RenderPass);
-	Result.Texture = CreateTexture(Result.Device, Result.PhysicalDevice.Handle, Result.CommandPool, Result.GraphicsQueue);
-	Result.TextureSampler = CreateTextureSampler(Result.Device, Result.PhysicalDevice.Handle);
-	Result.VertexBuffer = CreateVertexBuffer(Result.Device, Result.PhysicalDevice.Handle, Result.CommandPool, Result.GraphicsQueue);
-	Result.IndexBuffer = CreateIndexBuffer(Result.Device, Result.PhysicalDevice.Handle, Result.CommandPool, Result.GraphicsQueue);
-	Result.UniformBuffers = CreateUniformBuffers(Result.Device, Result.PhysicalDevice.Handle, &Result.UniformBufferPtrs);
-	Result.DescPool = CreateDescriptorPool(Result.Device);
-	Result.DescSets = CreateDescriptorSets(Result.Device, Result.DescSetLayout, Result.DescPool, Result.UniformBuffers, 
-										   Result.Texture.ImageView, Result.TextureSampler);
-	Result.CommandBuffers = CreateCommandBuffers(Result.Device, Result.CommandPool);
-	CreateSyncObjects(&Result);
-
-	return Result;
-}
+	vulkan_stuff* VulkanStuff;
+	u32 Slot;
+	u32 ImageIndex;
+};
 
-static void UpdateUniformBuffer(vulkan_stuff* VulkanStuff)
+// job_func, one per chunk. Every chunk records a secondary, even if its share of the draws comes out empty, so the
+// primary can always just execute all of them.
+static void RecordDrawsJob(void* UserData, u32 ChunkIndex)
 {
-	static std::chrono::time_point StartTime = std::chrono::high_resolution_clock::now();
-
-	std::chrono::time_point CurrentTime = std::chrono::high_resolution_clock::now();
-	float TimePassed = std::chrono::duration<float, std::chrono::seconds::period>(CurrentTime - StartTime).count();
-
-	float Aspect = (float)VulkanStuff->Swapchain.Extents.width / (float)VulkanStuff->Swapchain.Extents.height;
-	uniform_buffer_object Ubo
+	parallel_record_job* Job = (parallel_record_job*)UserData;
+	vulkan_stuff* VulkanStuff = Job->VulkanStuff;
+	parallel_recorder* Recorder = &VulkanStuff->Recorder;
+
+	u32 NumDraws = VulkanStuff->NumDrawItems;
+	u32 NumChunks = Recorder->NumWorkers;
+	u32 FirstDraw = (u32)((u64)NumDraws * ChunkIndex / NumChunks);
+	u32 OnePastLastDraw = (u32)((u64)NumDraws * (ChunkIndex + 1) / NumChunks);
+
+	vkResetCommandPool(VulkanStuff->Device, Recorder->Pools[Job->Slot][ChunkIndex], 0);
+	VkCommandBuffer CommandBuffer = Recorder->Secondaries[Job->Slot][ChunkIndex];
+	rendering_formats* Formats = &VulkanStuff->RenderingFormats;
+	VkCommandBufferInheritanceRenderingInfo InheritanceRenderingInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO,
+		.colorAttachmentCount = 1,
+		.pColorAttachmentFormats = &Formats->Colour,
+		.depthAttachmentFormat = Formats->Depth,
+		.stencilAttachmentFormat = Formats->Stencil,
+		.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+	};
+	VkCommandBufferInheritanceInfo InheritanceInfo
 	{
-		// Rotate around z-axis
-		.Model = glm::rotate(glm::mat4(1.0f), TimePassed * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f)),
-		// Z is up??
-		.View = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f)),
-		.Proj = glm::perspective(glm::radians(45.0f), Aspect, 0.1f, 10.0f),
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+		.pNext = VulkanStuff->RenderPass ? nullptr : &InheritanceRenderingInfo,
+		.renderPass = VulkanStuff->RenderPass,
+		.subpass = 0,
+		.framebuffer = VulkanStuff->RenderPass ? VulkanStuff->Swapchain.Framebuffers[Job->ImageIndex] : VK_NULL_HANDLE,
 	};
-	// Apparently we need to flip the Y-coordinate of the clip space coords, because it's inverted from OpenGL
-	Ubo.Proj[1][1] *= -1.0f;
-
-	void* CpuBuffer = VulkanStuff->UniformBufferPtrs[VulkanStuff->CurrentFrame];
-	memcpy(CpuBuffer, &Ubo, sizeof(Ubo));
-}
-
-static void RecordCommandBuffer(vulkan_stuff* VulkanStuff, u32 ImageIndex)
-{
 	VkCommandBufferBeginInfo BeginInfo
 	{
-		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+		.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+		.pInheritanceInfo = &InheritanceInfo,
 	};
-	VkCommandBuffer CommandBuffer = VulkanStuff->CommandBuffers[VulkanStuff->CurrentFrame];
 	if (vkBeginCommandBuffer(CommandBuffer, &BeginInfo) == VK_SUCCESS)
 	{
-		Assert(ImageIndex < VulkanStuff->Swapchain.NumImages);
-		VkClearValue ClearValues[] 
+		RecordDraws(VulkanStuff, CommandBuffer, FirstDraw, OnePastLastDraw);
+		if (vkEndCommandBuffer(CommandBuffer) != VK_SUCCESS)
 		{
-			{ .color = { 0.0f, 0.0f, 0.0f, 1.0f } },
-			{ .depthStencil = { .depth = 1.0f, .stencil = 0 } },
-		};
+			fprintf(stderr, "Failed to end secondary command buffer\n");
+			Assert(false);
+		}
+	}
+	else
+	{
+		fprintf(stderr, "Failed to begin secondary command buffer\n");
+		Assert(false);
+	}
+}
+
+// NOTE: The attachments have to be in their attachment layouts already, either way - the render pass doesn't transition
+// anything, so both paths share the barriers in RecordCommandBuffer
+static void BeginSwapchainRendering(vulkan_stuff* VulkanStuff, VkCommandBuffer CommandBuffer, u32 ImageIndex, b32 FromSecondaries)
+{
+	VkClearValue ClearValues[] 
+	{
+		{ .color = { 0.0f, 0.0f, 0.0f, 1.0f } },
+		{ .depthStencil = { .depth = 1.0f, .stencil = 0 } },
+	};
+	VkRect2D RenderArea = { .offset = {0, 0}, .extent = VulkanStuff->Swapchain.Extents };
+	if (VulkanStuff->RenderPass)
+	{
 		VkRenderPassBeginInfo RenderPassInfo
 		{
 			.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
 			.renderPass = VulkanStuff->RenderPass,
 			.framebuffer = VulkanStuff->Swapchain.Framebuffers[ImageIndex],
-			.renderArea = { .offset = {0, 0}, .extent = VulkanStuff->Swapchain.Extents },
+			.renderArea = RenderArea,
 			.clearValueCount = ArrayCount(ClearValues),
 			.pClearValues = ClearValues,
 		};
-		vkCmdBeginRenderPass(CommandBuffer, &RenderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-		vkCmdBindPipeline(CommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, VulkanStuff->Pipeline.Handle);
-		
-		VkDeviceSize VertexOffset = 0;
-		vkCmdBindVertexBuffers(CommandBuffer, 0, 1, &VulkanStuff->VertexBuffer.Handle, &VertexOffset);
-		vkCmdBindIndexBuffer(CommandBuffer, VulkanStuff->IndexBuffer.Handle, 0, VK_INDEX_TYPE_UINT16);
-
-		VkViewport Viewport
-		{
-			.x = 0.0f,
-			.y = 0.0f,
-			.width = (f32)VulkanStuff->Swapchain.Extents.width,
-			.height = (f32)VulkanStuff->Swapchain.Extents.height,
-			.minDepth = 0.0f,
-			.maxDepth = 1.0f,
+		vkCmdBeginRenderPass(CommandBuffer, &RenderPassInfo,
+							 FromSecondaries ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+	}
+	else
+	{
+		VkRenderingAttachmentInfo ColourAttachment
+		{
+			.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+			.imageView = VulkanStuff->Swapchain.ImageViews[ImageIndex],
+			.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+			.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+			.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+			.clearValue = ClearValues[0],
 		};
-		vkCmdSetViewport(CommandBuffer, 0, 1, &Viewport);
-
-		VkRect2D Scissor { .extent = VulkanStuff->Swapchain.Extents };
-		vkCmdSetScissor(CommandBuffer, 0, 1, &Scissor);
+		// Nothing reads the depth buffer after the pass and the next frame clears it, so don't bother writing it out
+		VkRenderingAttachmentInfo DepthAttachment
+		{
+			.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+			.imageView = VulkanStuff->DepthImage.ImageView,
+			.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+			.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+			.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+			.clearValue = ClearValues[1],
+		};
+		VkRenderingInfo RenderingInfo
+		{
+			.sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+			.flags = FromSecondaries ? (VkRenderingFlags)VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0,
+			.renderArea = RenderArea,
+			.layerCount = 1,
+			.colorAttachmentCount = 1,
+			.pColorAttachments = &ColourAttachment,
+			.pDepthAttachment = &DepthAttachment,
+			// The stencil's only there because it comes with the depth format, so it goes along for the ride
+			.pStencilAttachment = VulkanStuff->RenderingFormats.Stencil != VK_FORMAT_UNDEFINED ? &DepthAttachment : nullptr,
+		};
+		vkCmdBeginRendering(CommandBuffer, &RenderingInfo);
+	}
+}
 
-		vkCmdBindDescriptorSets(CommandBuffer, 
-								VK_PIPELINE_BIND_POINT_GRAPHICS, 
-								VulkanStuff->Pipeline.Layout, 
-								0, 1, 
-								VulkanStuff->DescSets + VulkanStuff->CurrentFrame,
-								0, nullptr);
+static void EndSwapchainRendering(vulkan_stuff* VulkanStuff, VkCommandBuffer CommandBuffer)
+{
+	if (VulkanStuff->RenderPass)
+	{
+		vkCmdEndRenderPass(CommandBuffer);
+	}
+	else
+	{
+		vkCmdEndRendering(CommandBuffer);
+	}
+}
 
-		vkCmdDrawIndexed(CommandBuffer, ArrayCount(s_Indices), 1, 0, 0, 0);
+// Parallel splits the draws across the job system, see parallel_recorder. Only for per-frame command buffers - the
+// secondaries get thrown away when their slot comes round again, so a cached primary can't hang on to them.
+static void RecordCommandBuffer(vulkan_stuff* VulkanStuff, VkCommandBuffer CommandBuffer, u32 ImageIndex, b32 Parallel)
+{
+	VkCommandBufferBeginInfo BeginInfo
+	{
+		.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO
+	};
+	if (vkBeginCommandBuffer(CommandBuffer, &BeginInfo) == VK_SUCCESS)
+	{
+		Assert(ImageIndex < VulkanStuff->Swapchain.NumImages);
+		swap_chain* Swapchain = &VulkanStuff->Swapchain;
+		Swapchain->ImageStates[ImageIndex] = SWAPCHAIN_ACQUIRED_STATE;
+
+		// NOTE: Both attachments get cleared, so their old contents can go. Whatever used the depth buffer last was
+		// another frame just like this one, so assume that instead of trusting the tracked state - a cached command
+		// buffer gets replayed long after the state it was recorded against, and still has to wait on those writes.
+		VulkanStuff->DepthImage.State = IMAGE_USAGE_STATES[ImageUsage_DepthAttachment];
+		barrier_batch Barriers = BeginBarrierBatch(CommandBuffer);
+		RequireImageState(&Barriers, Swapchain->Images[ImageIndex], VK_IMAGE_ASPECT_COLOR_BIT, Swapchain->ImageStates + ImageIndex,
+						  ImageUsage_ColourAttachment, true);
+		RequireImage(&Barriers, &VulkanStuff->DepthImage, ImageUsage_DepthAttachment, true);
+		RequireImage(&Barriers, &VulkanStuff->Texture->Texture, ImageUsage_FragmentSampled, false);
+		FlushBarriers(&Barriers);
+
+		parallel_recorder* Recorder = &VulkanStuff->Recorder;
+		if (Parallel)
+		{
+			u32 Slot = VulkanStuff->Frames.CurrentSlot;
+			parallel_record_job Job
+			{
+				.VulkanStuff = VulkanStuff,
+				.Slot = Slot,
+				.ImageIndex = ImageIndex,
+			};
+			BeginSwapchainRendering(VulkanStuff, CommandBuffer, ImageIndex, true);
+			job_counter Counter = {};
+			KickJobs(RecordDrawsJob, &Job, Recorder->NumWorkers, &Counter);
+			WaitForCounter(&Counter);
+			vkCmdExecuteCommands(CommandBuffer, Recorder->NumWorkers, Recorder->Secondaries[Slot]);
+		}
+		else
+		{
+			BeginSwapchainRendering(VulkanStuff, CommandBuffer, ImageIndex, false);
+			RecordDraws(VulkanStuff, CommandBuffer, 0, VulkanStuff->NumDrawItems);
+		}
+		EndSwapchainRendering(VulkanStuff, CommandBuffer);
 
-		vkCmdEndRenderPass(CommandBuffer);
+		// NOTE: Offscreen images just stay as colour attachments, PRESENT_SRC isn't even a thing without VK_KHR_swapchain
+		if (!Swapchain->OffscreenImages)
+		{
+			RequireImageState(&Barriers, Swapchain->Images[ImageIndex], VK_IMAGE_ASPECT_COLOR_BIT, Swapchain->ImageStates + ImageIndex,
+							  ImageUsage_Present, false);
+			FlushBarriers(&Barriers);
+		}
 
 		if (vkEndCommandBuffer(CommandBuffer) != VK_SUCCESS)
 		{
@@ -2006,18 +6744,69 @@ static void RecordCommandBuffer(vulkan_stuff* VulkanStuff, u32 ImageIndex)
 	}
 }
 
+// Makes sure everything the frame draws with is in VRAM, and that the frame waits for any of it that's still uploading
+// Returns true if anything got reloaded (so any recorded command buffers are pointing at stale handles)
+static b32 UseSceneResources(vulkan_stuff* VulkanStuff)
+{
+	b32 Result = false;
+	residency_manager* Residency = &VulkanStuff->Residency;
+	streamable* Streamables[] = { VulkanStuff->VertexBuffer, VulkanStuff->IndexBuffer, VulkanStuff->Texture };
+	for (u32 i = 0; i < ArrayCount(Streamables); i++)
+	{
+		if (UseStreamable(Residency, Streamables[i]))
+		{
+			if (Streamables[i] == VulkanStuff->Texture)
+			{
+				// NOTE: Fine to rewrite the set here - if the texture got evicted, no frame in flight can have drawn with it
+				WriteTextureDescriptor(VulkanStuff->Device, VulkanStuff->DescSet, VulkanStuff->Texture->Texture.ImageView, VulkanStuff->TextureSampler);
+			}
+			Result = true;
+		}
+		if (Streamables[i]->ReadyTicket > VulkanStuff->SceneUploadTicket)
+		{
+			VulkanStuff->SceneUploadTicket = Streamables[i]->ReadyTicket;
+		}
+	}
+	return Result;
+}
+
 static void DrawFrame(vulkan_stuff* VulkanStuff, GLFWwindow* Window)
 {
-	vkWaitForFences(VulkanStuff->Device, 1, VulkanStuff->InFlightFences + VulkanStuff->CurrentFrame, VK_TRUE, UINT64_MAX);
+	frame_scheduler* Frames = &VulkanStuff->Frames;
+	u32 Slot = BeginFrame(Frames);
+	ResetArena(&VulkanStuff->FrameArena);
+	CollectUploads(&VulkanStuff->Uploads);
+	CollectDeletions(&VulkanStuff->Deletions);
+	BeginResidencyFrame(&VulkanStuff->Residency);
+	if (s_Capture.Enabled)
+	{
+		CollectReadbacks(GetCompletedFrameValue(Frames));
+	}
 
-	u32 ImageIndex;
-	// Sooo... the ImageIndex is written to immediately, but the image may in fact not be available to use until the semaphore has signalled..?
-	VkResult CallResult = vkAcquireNextImageKHR(VulkanStuff->Device,
-												VulkanStuff->Swapchain.Handle,
-												UINT64_MAX,
-												VulkanStuff->ImageAvailableSemaphores[VulkanStuff->CurrentFrame],
-												VK_NULL_HANDLE,
-												&ImageIndex);
+	present_timer* PresentTimer = &VulkanStuff->PresentTimer;
+	// NOTE: Pending presents get forgotten whenever the swapchain's recreated, so these are all to the current one
+	if (PresentTimer->WaitForPresent && PollPresents(PresentTimer, VulkanStuff->Device, VulkanStuff->Swapchain.Handle))
+	{
+		VulkanStuff->Swapchain.HasCompletedPresent = true;
+	}
+
+	// NOTE: Headless, there's nothing to acquire from or present to - each slot has its own offscreen image, and
+	// BeginFrame has already waited for the last frame that used it
+	b32 Headless = VulkanStuff->Swapchain.OffscreenImages != nullptr;
+	u32 ImageIndex = Slot;
+	VkResult CallResult = VK_SUCCESS;
+	std::chrono::time_point AcquireStart = std::chrono::high_resolution_clock::now();
+	if (!Headless)
+	{
+		// Sooo... the ImageIndex is written to immediately, but the image may in fact not be available to use until the semaphore has signalled..?
+		CallResult = vkAcquireNextImageKHR(VulkanStuff->Device,
+										   VulkanStuff->Swapchain.Handle,
+										   UINT64_MAX,
+										   Frames->ImageAvailable[Slot],
+										   VK_NULL_HANDLE,
+										   &ImageIndex);
+	}
+	std::chrono::time_point AcquiredAt = std::chrono::high_resolution_clock::now();
 	if (CallResult == VK_ERROR_OUT_OF_DATE_KHR)
 	{
 		RecreateSwapchain(VulkanStuff, Window);
@@ -2029,33 +6818,138 @@ static void DrawFrame(vulkan_stuff* VulkanStuff, GLFWwindow* Window)
 	}
 	else
 	{
-		vkResetFences(VulkanStuff->Device, 1, VulkanStuff->InFlightFences + VulkanStuff->CurrentFrame);
+		if (!Headless)
+		{
+			// The presentation engine only hands an image back once it's done presenting it, so getting one back that
+			// we've presented before means that present completed (without present waits, that's all we've got to go on)
+			swap_chain* Swapchain = &VulkanStuff->Swapchain;
+			if (Swapchain->ImagePresented[ImageIndex])
+			{
+				Swapchain->HasCompletedPresent = true;
+			}
+			Swapchain->ImagePresented[ImageIndex] = true;
+			if (Swapchain->HasCompletedPresent && VulkanStuff->Deletions.NumRetiredSwapchains)
+			{
+				CollectRetiredSwapchains(&VulkanStuff->Deletions);
+			}
+		}
+
+		command_cache* Cache = &VulkanStuff->CommandCache;
+		u32 UniformRegion = Slot;
+		if (Cache->Enabled)
+		{
+			// This image's command buffer and uniform region are only ours again once the last frame that used them is done
+			WaitForFrame(Frames, Cache->LastFrameUsed[ImageIndex]);
+			UniformRegion = ImageIndex;
+		}
+
+		// Uniforms first, so the draws know their dynamic offsets when we record them
+		u32 NumDrawItems = VulkanStuff->NumDrawItems;
+		UpdateUniformBuffer(VulkanStuff, UniformRegion);
+		u32 PipelinesVersion = s_Pipelines.Version.load(std::memory_order_acquire);
+		if (UseSceneResources(VulkanStuff) || VulkanStuff->NumDrawItems != NumDrawItems ||
+			VulkanStuff->PipelinesVersion != PipelinesVersion)
+		{
+			MarkCommandCacheDirty(Cache);
+		}
+		VulkanStuff->PipelinesVersion = PipelinesVersion;
+
+		VkCommandBuffer CommandBuffer = VK_NULL_HANDLE;
+		if (Cache->Enabled)
+		{
+			CommandBuffer = Cache->CommandBuffers[ImageIndex];
+			if (Cache->RecordedVersion[ImageIndex] != Cache->Version)
+			{
+				vkResetCommandBuffer(CommandBuffer, 0);
+				RecordCommandBuffer(VulkanStuff, CommandBuffer, ImageIndex, false);
+				Cache->RecordedVersion[ImageIndex] = Cache->Version;
+				Cache->NumRecordings++;
+			}
+			Cache->LastFrameUsed[ImageIndex] = GetCurrentFrameValue(Frames);
+		}
+		else
+		{
+			CommandBuffer = GetFrameCommandBuffer(Frames);
+			vkResetCommandBuffer(CommandBuffer, 0);
+			b32 Parallel = VulkanStuff->Recorder.NumWorkers > 1 &&
+						   VulkanStuff->NumDrawItems >= VulkanStuff->Recorder.NumWorkers * PARALLEL_RECORD_MIN_DRAWS_PER_WORKER;
+			RecordCommandBuffer(VulkanStuff, CommandBuffer, ImageIndex, Parallel);
+		}
 
-		vkResetCommandBuffer(VulkanStuff->CommandBuffers[VulkanStuff->CurrentFrame], 0);
-		RecordCommandBuffer(VulkanStuff, ImageIndex);
+		// NOTE: The capture copy goes in its own command buffer after the frame's, so cached and parallel recording don't
+		// have to know about it
+		VkCommandBuffer CommandBuffers[] = { CommandBuffer, VK_NULL_HANDLE };
+		u32 NumCommandBuffers = 1;
+		if (s_Capture.Enabled && CanCaptureSwapchain(&VulkanStuff->Swapchain))
+		{
+			CommandBuffers[1] = RecordCapture(&VulkanStuff->Swapchain, ImageIndex, Slot, GetCurrentFrameValue(Frames), Frames->FramesSubmitted);
+			NumCommandBuffers += CommandBuffers[1] ? 1 : 0;
+		}
 
-		UpdateUniformBuffer(VulkanStuff);
+		// Anything recorded since the last submit has to go out now, or we'd be waiting on a value that never gets signalled
+		SubmitUploads(&VulkanStuff->Uploads);
 
-		VkPipelineStageFlags WaitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+		// Headless skips the first wait (image available) and the first signal (render finished) - no presentation engine
+		u32 FirstSemaphore = Headless ? 1 : 0;
+		VkSemaphore WaitSemaphores[] = { Frames->ImageAvailable[Slot], VulkanStuff->Uploads.Timeline };
+		VkPipelineStageFlags WaitStages[] =
+		{
+			VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		};
+		u64 WaitValues[] = { 0, VulkanStuff->SceneUploadTicket }; // Values for binary semaphores are ignored
+		VkSemaphore SignalSemaphores[] = { Frames->RenderFinished[Slot], Frames->Timeline };
+		u64 SignalValues[] = { 0, GetCurrentFrameValue(Frames) };
+		VkTimelineSemaphoreSubmitInfo TimelineInfo
+		{
+			.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+			.waitSemaphoreValueCount = (u32)ArrayCount(WaitValues) - FirstSemaphore,
+			.pWaitSemaphoreValues = WaitValues + FirstSemaphore,
+			.signalSemaphoreValueCount = (u32)ArrayCount(SignalValues) - FirstSemaphore,
+			.pSignalSemaphoreValues = SignalValues + FirstSemaphore,
+		};
 		VkSubmitInfo SubmitInfo
 		{
 			.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-			.waitSemaphoreCount = 1,
-			.pWaitSemaphores = VulkanStuff->ImageAvailableSemaphores + VulkanStuff->CurrentFrame,
-			.pWaitDstStageMask = &WaitStage,
-			.commandBufferCount = 1,
-			.pCommandBuffers = VulkanStuff->CommandBuffers + VulkanStuff->CurrentFrame,
-			.signalSemaphoreCount = 1,
-			.pSignalSemaphores = VulkanStuff->RenderFinishedSempaphores + VulkanStuff->CurrentFrame,
+			.pNext = &TimelineInfo,
+			.waitSemaphoreCount = (u32)ArrayCount(WaitSemaphores) - FirstSemaphore,
+			.pWaitSemaphores = WaitSemaphores + FirstSemaphore,
+			.pWaitDstStageMask = WaitStages + FirstSemaphore,
+			.commandBufferCount = NumCommandBuffers,
+			.pCommandBuffers = CommandBuffers,
+			.signalSemaphoreCount = (u32)ArrayCount(SignalSemaphores) - FirstSemaphore,
+			.pSignalSemaphores = SignalSemaphores + FirstSemaphore,
 		};
 
-		if (vkQueueSubmit(VulkanStuff->GraphicsQueue, 1, &SubmitInfo, VulkanStuff->InFlightFences[VulkanStuff->CurrentFrame]) == VK_SUCCESS)
+		if (vkQueueSubmit(VulkanStuff->GraphicsQueue, 1, &SubmitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+		{
+			fprintf(stderr, "Couldn't submit draw command buffer\n");
+			Assert(false);
+		}
+		else if (Headless)
 		{
+			Frames->FramesSubmitted++;
+			VulkanStuff->Residency.FrameNumber++;
+		}
+		else
+		{
+			Frames->FramesSubmitted++;
+			VulkanStuff->Residency.FrameNumber++;
+			std::chrono::time_point PresentedAt = std::chrono::high_resolution_clock::now();
+			u64 PresentId = TrackPresent(PresentTimer, VulkanStuff->Swapchain.PresentPolicy, AcquiredAt, PresentedAt,
+										 std::chrono::duration<f64>(AcquiredAt - AcquireStart).count());
+			VkPresentIdKHR PresentIdInfo
+			{
+				.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR,
+				.swapchainCount = 1,
+				.pPresentIds = &PresentId,
+			};
 			VkPresentInfoKHR PresentInfo
 			{
 				.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+				.pNext = PresentId ? &PresentIdInfo : nullptr,
 				.waitSemaphoreCount = 1,
-				.pWaitSemaphores = VulkanStuff->RenderFinishedSempaphores + VulkanStuff->CurrentFrame,
+				.pWaitSemaphores = Frames->RenderFinished + Slot,
 				.swapchainCount = 1,
 				.pSwapchains = &VulkanStuff->Swapchain.Handle,
 				.pImageIndices = &ImageIndex,
@@ -2071,27 +6965,120 @@ static void DrawFrame(vulkan_stuff* VulkanStuff, GLFWwindow* Window)
 				fprintf(stderr, "Failed to queue image for presentation (whatever that means)\n");
 				Assert(false);
 			}
-
-			VulkanStuff->CurrentFrame = (VulkanStuff->CurrentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
-		}
-		else
-		{
-			fprintf(stderr, "Couldn't submit draw command buffer\n");
-			Assert(false);
 		}
 	}
 
 }
 
-static void MainLoop(GLFWwindow* Window, vulkan_stuff* VulkanStuff)
+// Minimised, or sized down to nothing - either way there's nothing to draw to
+static b32 IsSuspended(GLFWwindow* Window, vulkan_stuff* VulkanStuff)
+{
+	s32 Width, Height;
+	glfwGetFramebufferSize(Window, &Width, &Height);
+	b32 Result = VulkanStuff->Minimised || Width == 0 || Height == 0;
+	return Result;
+}
+
+static void MainLoop(GLFWwindow* Window, vulkan_stuff* VulkanStuff, app_config* Config)
 {
+	// NOTE: Steady state, the frame loop should never touch the heap - only evictions coming back in should
+	u64 HeapAllocationsAtStart = s_NumHeapAllocations;
+	b32 FirstFrame = true;
+	u64 NumSuspensions = 0;
+	std::chrono::time_point LastTick = std::chrono::high_resolution_clock::now();
 	while (!glfwWindowShouldClose(Window))
 	{
 		glfwPollEvents();
+		if (IsSuspended(Window, VulkanStuff))
+		{
+			// NOTE: Nothing gets acquired, recorded or submitted while we're suspended, so the GPU goes quiet, and the CPU
+			// sleeps in here until an event comes in (or the next tick, if we're ticking)
+			NumSuspensions++;
+			while (!glfwWindowShouldClose(Window) && IsSuspended(Window, VulkanStuff))
+			{
+				if (Config->TickWhileMinimised)
+				{
+					glfwWaitEventsTimeout(MINIMISED_TICK_SECONDS);
+					std::chrono::time_point Now = std::chrono::high_resolution_clock::now();
+					VulkanStuff->SimulationSeconds += std::chrono::duration<f64>(Now - LastTick).count();
+					LastTick = Now;
+				}
+				else
+				{
+					glfwWaitEvents();
+				}
+			}
+			// Whatever happened to the window while we were away, one recreation covers it
+			LastTick = std::chrono::high_resolution_clock::now();
+			if (!glfwWindowShouldClose(Window))
+			{
+				VulkanStuff->PendingFramebufferResize = false;
+				RecreateSwapchain(VulkanStuff, Window);
+			}
+			continue;
+		}
+
+		std::chrono::time_point Now = std::chrono::high_resolution_clock::now();
+		VulkanStuff->SimulationSeconds += std::chrono::duration<f64>(Now - LastTick).count();
+		LastTick = Now;
+#if _DEBUG
+		u64 HeapAllocationsBeforeFrame = s_NumHeapAllocations;
+#endif
 		DrawFrame(VulkanStuff, Window);
+		if (FirstFrame)
+		{
+			// NOTE: This is when the first frame was submitted, not when it hit the screen
+			printf("Time to first frame: %.2f ms\n", SecondsSinceStartup() * 1000.0);
+			FirstFrame = false;
+		}
+#if _DEBUG
+		if (s_NumHeapAllocations != HeapAllocationsBeforeFrame)
+		{
+			fprintf(stderr, "WARNING: Frame %llu made %llu heap allocation(s)\n", (unsigned long long)VulkanStuff->Residency.FrameNumber,
+					(unsigned long long)(s_NumHeapAllocations - HeapAllocationsBeforeFrame));
+		}
+#endif
 	}
+	printf("Frame loop made %llu heap allocations\n", (unsigned long long)(s_NumHeapAllocations - HeapAllocationsAtStart));
+	printf("Suspended %llu times\n", (unsigned long long)NumSuspensions);
+
+	vkDeviceWaitIdle(VulkanStuff->Device);
+}
 
+// NOTE: Fixed timestep, so every run draws exactly the same frames no matter how fast the device is
+static constexpr f64 HEADLESS_FRAME_SECONDS = 1.0 / 60.0;
+
+static void RunHeadless(vulkan_stuff* VulkanStuff, u32 NumFrames)
+{
+	std::chrono::time_point Start = std::chrono::high_resolution_clock::now();
+	f64 MaxFrameSeconds = 0.0;
+	for (u32 i = 0; i < NumFrames; i++)
+	{
+		// NOTE: Backpressure goes here rather than in DrawFrame - an offline render wants every frame captured, and
+		// waiting here keeps it out of the worst-frame CPU time (it still counts towards the total)
+		if (s_Capture.Enabled)
+		{
+			WaitForFreeReadback(&VulkanStuff->Frames);
+		}
+		std::chrono::time_point FrameStart = std::chrono::high_resolution_clock::now();
+		DrawFrame(VulkanStuff, nullptr);
+		VulkanStuff->SimulationSeconds += HEADLESS_FRAME_SECONDS;
+		f64 FrameSeconds = std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - FrameStart).count();
+		if (FrameSeconds > MaxFrameSeconds)
+		{
+			MaxFrameSeconds = FrameSeconds;
+		}
+		if (i == 0)
+		{
+			printf("Time to first frame: %.2f ms\n", SecondsSinceStartup() * 1000.0);
+		}
+	}
+	// Submitted isn't done - count the time it takes the GPU to catch up too
 	vkDeviceWaitIdle(VulkanStuff->Device);
+	f64 TotalSeconds = std::chrono::duration<f64>(std::chrono::high_resolution_clock::now() - Start).count();
+	printf("Headless: %u frames in %.3f s - %.3f ms/frame on average (%.1f fps), %.3f ms worst on the CPU\n",
+		   NumFrames, TotalSeconds, NumFrames ? TotalSeconds * 1000.0 / NumFrames : 0.0,
+		   TotalSeconds > 0.0 ? NumFrames / TotalSeconds : 0.0, MaxFrameSeconds * 1000.0);
 }
 
 static void CleanUp(GLFWwindow* Window, vulkan_stuff* VulkanStuff)
@@ -2099,45 +7086,94 @@ static void CleanUp(GLFWwindow* Window, vulkan_stuff* VulkanStuff)
 #if _DEBUG
 	DestroyDebugCallback(VulkanStuff->Instance);
 #endif
-	CleanUpSwapchain(VulkanStuff->Device, &VulkanStuff->Swapchain, VulkanStuff->DepthImage);
-	vkDestroySampler(VulkanStuff->Device, VulkanStuff->TextureSampler, nullptr); // pAllocator
-	vkDestroyImageView(VulkanStuff->Device, VulkanStuff->Texture.ImageView, nullptr); // pAllocator
-	vkDestroyImage(VulkanStuff->Device, VulkanStuff->Texture.Image, nullptr); // pAllocator
-	vkFreeMemory(VulkanStuff->Device, VulkanStuff->Texture.Memory, nullptr); // pAllocator
-
-	for (u32 i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
-	{
-		vkDestroyBuffer(VulkanStuff->Device, VulkanStuff->UniformBuffers[i].Handle, nullptr); // pAllocator
-		vkFreeMemory(VulkanStuff->Device, VulkanStuff->UniformBuffers[i].Memory, nullptr); // pAllocator
-	}
-	vkDestroyDescriptorPool(VulkanStuff->Device, VulkanStuff->DescPool, nullptr); // pAllocator
-	vkDestroyDescriptorSetLayout(VulkanStuff->Device, VulkanStuff->DescSetLayout, nullptr); // pAllocator
-	vkDestroyBuffer(VulkanStuff->Device, VulkanStuff->IndexBuffer.Handle, nullptr); // pAllocator
-	vkFreeMemory(VulkanStuff->Device, VulkanStuff->IndexBuffer.Memory, nullptr); // pAllocator
-	vkDestroyBuffer(VulkanStuff->Device, VulkanStuff->VertexBuffer.Handle, nullptr); // pAllocator
-	vkFreeMemory(VulkanStuff->Device, VulkanStuff->VertexBuffer.Memory, nullptr); // pAllocator
-	for (u32 i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
-	{
-		vkDestroySemaphore(VulkanStuff->Device, VulkanStuff->ImageAvailableSemaphores[i], nullptr); // pAllocator
-		vkDestroySemaphore(VulkanStuff->Device, VulkanStuff->RenderFinishedSempaphores[i], nullptr); // pAllocator
-		vkDestroyFence(VulkanStuff->Device, VulkanStuff->InFlightFences[i], nullptr); // pAllocator
-	}
-	vkDestroyCommandPool(VulkanStuff->Device, VulkanStuff->CommandPool, nullptr); // pAllocator
-	vkDestroyPipeline(VulkanStuff->Device, VulkanStuff->Pipeline.Handle, nullptr); // pAllocator
-	vkDestroyPipelineLayout(VulkanStuff->Device, VulkanStuff->Pipeline.Layout, nullptr); // pAllocator
-	vkDestroyRenderPass(VulkanStuff->Device, VulkanStuff->RenderPass, nullptr); // pAllocator
-	vkDestroyDevice(VulkanStuff->Device, nullptr); // pAllocator
-	vkDestroySurfaceKHR(VulkanStuff->Instance, VulkanStuff->Surface, nullptr); // pAllocator
-	vkDestroyInstance(VulkanStuff->Instance, nullptr); // pAllocator
-	glfwDestroyWindow(Window);
-	glfwTerminate();
-}
-
-int main()
-{
-	GLFWwindow* Window = InitWindow();
-	vulkan_stuff VulkanStuff = InitVulkan(Window);
-	glfwSetWindowUserPointer(Window, &VulkanStuff);
-	MainLoop(Window, &VulkanStuff);
-	CleanUp(Window, &VulkanStuff);
+	PrintGpuMemoryStats(&VulkanStuff->GpuAllocator);
+	PrintFrameSchedulerStats(&VulkanStuff->Frames);
+	PrintPipelineStats();
+	PrintPresentStats(&VulkanStuff->PresentTimer);
+	if (VulkanStuff->CommandCache.Enabled)
+	{
+		printf("Command cache: recorded %llu times over %llu frames\n", (unsigned long long)VulkanStuff->CommandCache.NumRecordings,
+			   (unsigned long long)VulkanStuff->Frames.FramesSubmitted);
+	}
+	printf("Evicted %u streamables (%.2f MB) over %llu frames\n", VulkanStuff->Residency.NumEvictions,
+		   VulkanStuff->Residency.EvictedBytes / (1024.0 * 1024.0), (unsigned long long)VulkanStuff->Residency.FrameNumber);
+
+	if (VulkanStuff->SwapchainRecreations)
+	{
+		printf("Recreated the swapchain %u times, %.2f ms on average\n", VulkanStuff->SwapchainRecreations,
+			   VulkanStuff->SwapchainRecreationSeconds * 1000.0 / VulkanStuff->SwapchainRecreations);
+	}
+
+	ShutdownFrameCapture();
+	FlushDeletions(&VulkanStuff->Deletions);
+	CleanUpSwapchain(VulkanStuff->Device, &VulkanStuff->GpuAllocator, &VulkanStuff->Swapchain, &VulkanStuff->DepthImage);
+	vkDestroySampler(VulkanStuff->Device, VulkanStuff->TextureSampler, HostCallbacks(HostObject_Sampler));
+	DestroyStreamable(&VulkanStuff->Residency, VulkanStuff->Texture);
+
+	DestroyBuffer(&VulkanStuff->GpuAllocator, &VulkanStuff->UniformRing.Buffer);
+	vkDestroyDescriptorPool(VulkanStuff->Device, VulkanStuff->DescPool, HostCallbacks(HostObject_DescriptorPool));
+	vkDestroyDescriptorSetLayout(VulkanStuff->Device, VulkanStuff->DescSetLayout, HostCallbacks(HostObject_DescriptorSetLayout));
+	DestroyStreamable(&VulkanStuff->Residency, VulkanStuff->IndexBuffer);
+	DestroyStreamable(&VulkanStuff->Residency, VulkanStuff->VertexBuffer);
+	DestroyUploadEngine(&VulkanStuff->Uploads);
+	DestroyGpuAllocator(&VulkanStuff->GpuAllocator);
+	DestroyFrameScheduler(&VulkanStuff->Frames);
+	DestroyParallelRecorder(&VulkanStuff->Recorder);
+	DestroyPipelineRegistry();
+	ShutdownJobSystem();
+	vkDestroyCommandPool(VulkanStuff->Device, VulkanStuff->CommandPool, HostCallbacks(HostObject_CommandPool));
+	// NOTE: The on-disk cache and the merged one both end up in here, same reserve as loading it
+	memory_arena PipelineCacheArena = CreateArena("Pipeline cache save", PIPELINE_CACHE_ARENA_SIZE);
+	SavePipelineCache(VulkanStuff->Device, VulkanStuff->PhysicalDevice.Handle, VulkanStuff->PipelineCache,
+					  &PipelineCacheArena, PIPELINE_CACHE_FILE_NAME);
+	DestroyArena(&PipelineCacheArena);
+	vkDestroyPipelineCache(VulkanStuff->Device, VulkanStuff->PipelineCache, HostCallbacks(HostObject_PipelineCache));
+	if (VulkanStuff->RenderPass)
+	{
+		vkDestroyRenderPass(VulkanStuff->Device, VulkanStuff->RenderPass, HostCallbacks(HostObject_RenderPass));
+	}
+	vkDestroyDevice(VulkanStuff->Device, HostCallbacks(HostObject_Device));
+	if (VulkanStuff->Surface)
+	{
+		vkDestroySurfaceKHR(VulkanStuff->Instance, VulkanStuff->Surface, HostCallbacks(HostObject_Surface));
+	}
+	vkDestroyInstance(VulkanStuff->Instance, HostCallbacks(HostObject_Instance));
+	PrintHostAllocStats();
+	DestroyHostAllocator();
+
+	printf("Arenas:\n");
+	PrintArenaStats(&VulkanStuff->PermanentArena);
+	PrintArenaStats(&VulkanStuff->SwapchainArena);
+	PrintArenaStats(&VulkanStuff->FrameArena);
+	DestroyArena(&VulkanStuff->PermanentArena);
+	DestroyArena(&VulkanStuff->SwapchainArena);
+	DestroyArena(&VulkanStuff->FrameArena);
+	if (Window)
+	{
+		glfwDestroyWindow(Window);
+		glfwTerminate();
+	}
+}
+
+int main(int ArgCount, char** Args)
+{
+	StartStartupTimeline();
+	app_config Config = ParseCommandLine(ArgCount, Args);
+	vulkan_stuff VulkanStuff = {};
+	if (Config.HeadlessFrames)
+	{
+		InitVulkan(&VulkanStuff, nullptr, &Config);
+		RunHeadless(&VulkanStuff, Config.HeadlessFrames);
+		CleanUp(nullptr, &VulkanStuff);
+	}
+	else
+	{
+		u32 WindowStage = BeginStartupStage("Window");
+		GLFWwindow* Window = InitWindow();
+		EndStartupStage(WindowStage);
+		InitVulkan(&VulkanStuff, Window, &Config);
+		glfwSetWindowUserPointer(Window, &VulkanStuff);
+		MainLoop(Window, &VulkanStuff, &Config);
+		CleanUp(Window, &VulkanStuff);
+	}
 }
\ No newline at end of file